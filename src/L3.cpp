@@ -8,8 +8,14 @@
 #include <unordered_set>
 #include <algorithm>
 #include <set>
+#include <utility>
+
+#include <label_scoping.h>
+#include <unordered_map>
 
 #include <tile_o_tron_4000.h>
+#include <l2_out.h>
+#include <peephole.h>
 #include <tiles.h> // bad.. should be singpulare
 
 using namespace L3;
@@ -115,7 +121,7 @@ void Dump::visit(Var* item){
         result << item->name;
 }
 void Dump::visit(Label* item){
-        result << item->name;
+        result << (labels ? (*labels)(item->name) : item->name);
 }
 void Dump::visit(Int_Literal* item){
         result << item->val;
@@ -139,23 +145,28 @@ void Var         ::accept(AST_Item_Visitor &v) { v.visit(this); }
 void Label       ::accept(AST_Item_Visitor &v) { v.visit(this); }
 void Int_Literal ::accept(AST_Item_Visitor &v) { v.visit(this); }
 void Runtime_Fun ::accept(AST_Item_Visitor &v) { v.visit(this); }
-void STAHP::accept(AST_Item_Visitor &v){
-        throw std::logic_error(std::string("look this class shouldn't exist, but you're a bad programmer, so.... idk what the moral here is. Don't be you? Yeah, that'd be great. I recommend doing that.\n"  " meanwhile: ") + static_cast<Dump&>(v).result.str());
-}
 
 // instructions
 
-Instruction::Instruction(std::vector<L3_ptr<AST_Item>> operands) :
+Instruction::Instruction(Kind kind, std::initializer_list<L3_ptr<AST_Item>> operands) :
+        AST_Item(kind),
         operands(operands)
 {}
 
-Instruction::Instruction() = default;
+Instruction::Instruction(Kind kind, Operands operands) :
+        AST_Item(kind),
+        operands(std::move(operands))
+{}
+
+Instruction::Instruction(Kind kind) :
+        AST_Item(kind)
+{}
 
 Instruction::~Instruction() = default;
 
 
 Val_Return::Val_Return(L3_ptr<AST_Item> result) :
-        Instruction({result}) // ew
+        Instruction(node_kind, {result}) // ew
 {}
 
 L3_ptr<AST_Item>  Val_Return::get_result(){
@@ -164,7 +175,7 @@ L3_ptr<AST_Item>  Val_Return::get_result(){
 }
 
 Load::Load(ast_ptr loadee) :
-        Instruction({loadee})
+        Instruction(node_kind, {loadee})
 {}
 
 ast_ptr Load::get_loadee(){
@@ -173,7 +184,7 @@ ast_ptr Load::get_loadee(){
 }
 
 Store::Store(ast_ptr storee) :
-        Instruction({storee})
+        Instruction(node_kind, {storee})
 {}
 
 ast_ptr Store::get_storee(){
@@ -182,7 +193,7 @@ ast_ptr Store::get_storee(){
 }
 
 Assignment::Assignment(ast_ptr lhs, ast_ptr rhs) :
-        Instruction({lhs, rhs})
+        Instruction(node_kind, {lhs, rhs})
 {}
 
 ast_ptr Assignment::get_rhs(){
@@ -201,9 +212,14 @@ std::vector<ast_ptr> vector_concat(std::vector<ast_ptr> a,
         return a;
 }
 
-Call::Call(std::vector<ast_ptr> everything) :
-        Instruction(everything),
-        numargs(everything.size() - 1)
+Call::Call(const std::vector<ast_ptr>& everything) :
+        Instruction(node_kind, Operands(everything.begin(), everything.end())),
+        numargs(operands.size() - 1)
+{}
+
+Call::Call(Operands everything) :
+        Instruction(node_kind, std::move(everything)),
+        numargs(operands.size() - 1)
 {}
 
 ast_ptr Call::get_callee(){
@@ -222,7 +238,7 @@ std::vector<ast_ptr> Call::get_args(){
 Cjump::Cjump(L3_ptr<Var> cond,
              L3_ptr<Label> t_target,
              L3_ptr<Label> f_target) :
-        Instruction({cond, t_target, f_target})
+        Instruction(node_kind, {cond, t_target, f_target})
 {}
 
 ast_ptr Cjump::get_cond(){
@@ -242,7 +258,7 @@ ast_ptr Cjump::get_false_target(){
 
 
 Goto::Goto(L3_ptr<Label> target) :
-        Instruction({target})
+        Instruction(node_kind, {target})
 {}
 
 ast_ptr Goto::get_target(){
@@ -251,7 +267,7 @@ ast_ptr Goto::get_target(){
 }
 
 Binop::Binop(Op op, ast_ptr lhs, ast_ptr rhs) :
-        Instruction({lhs, rhs}),
+        Instruction(node_kind, {lhs, rhs}),
         op(op)
 {}
 
@@ -305,210 +321,233 @@ ast_ptr Binop::get_lhs(){
 }
 
 
+Void_Return::Void_Return() :
+        Instruction(node_kind)
+{}
+
 Label::Label(std::string name) :
+        Instruction(node_kind),
+        name(name)
+{}
+
+Label::Label(Symbol name) :
+        Instruction(node_kind),
         name(name)
 {}
 
 Int_Literal::Int_Literal(int64_t val) :
+        AST_Item(node_kind),
         val(val)
 {}
 
 Runtime_Fun::Runtime_Fun(Runtime_Fun::Fun fun) :
+        AST_Item(node_kind),
         fun(fun)
 {}
 
 Var::Var(std::string name) :
+        AST_Item(node_kind),
         name(name)
 {}
 
-Function::Function(Label name) :
+Var::Var(Symbol name) :
+        AST_Item(node_kind),
         name(name)
 {}
 
-std::unordered_set<std::string> Function::grabber_of_the_vars(){
-        std::unordered_set<std::string> names;
-        for(auto i_ptr : instructions){
-                auto i_names = walk_for_names<Var, Label>(i_ptr);
-                names.insert(i_names.begin(), i_names.end());
+bool L3::is_runtime_fun_name(Symbol name){
+        static const Symbol print{std::string("print")};
+        static const Symbol allocate{std::string("allocate")};
+        static const Symbol array_error{std::string("array-error")};
+
+        return name == print || name == allocate || name == array_error;
+}
+
+bool L3::is_runtime_call(ast_ptr callee){
+        if(auto var = node_cast<Var>(callee)){
+                return is_runtime_fun_name(var->name);
+        }
+        return is_one_of<Runtime_Fun>(callee);
+}
+
+Function::Function(Label name) :
+        AST_Item(node_kind),
+        name(std::move(name)),
+        instructions(Arena_Allocator<L3_ptr<Instruction>>(arena))
+{}
+
+Program::Program() :
+        AST_Item(node_kind)
+{}
+
+Program::Program(Functions_t functions) :
+        AST_Item(node_kind),
+        functions(std::move(functions))
+{}
+
+std::unordered_set<Symbol> Function::grabber_of_the_vars(){
+        std::unordered_set<Symbol> names;
+        for(const auto& i_ptr : instructions){
+                walk_for_names<Var, Label>(i_ptr, names);
         }
 
         return names;
 }
 
 std::unordered_set<std::string> Function::grabber_of_the_labels(){
-        std::unordered_set<std::string> names;
+        std::unordered_set<Symbol> names;
 
-        for(auto i_ptr : instructions){
-                auto i_names = walk_for_names<Label, Var>(i_ptr);
-                names.insert(i_names.begin(), i_names.end());
+        for(const auto& i_ptr : instructions){
+                walk_for_names<Label, Var>(i_ptr, names);
         }
 
         names.insert(name.name);
 
-        auto names_it = names.begin();
+        // only now, once per distinct label, touch the actual strings
         auto stripped_names = std::unordered_set<std::string>{};
+        stripped_names.reserve(names.size());
 
-        while(names_it != names.end()){
-                stripped_names.insert(names_it->substr(1));
-                names_it++;
+        for(auto label : names){
+                stripped_names.insert(label.str().substr(1));
         }
 
         return stripped_names;
 }
 
-std::string Function::find_prefix(std::unordered_set<std::string> scrambled_symbols){
-
-        std::set<std::string> symbols(scrambled_symbols.begin(), scrambled_symbols.end());
-
-        auto z_symbol =
-                std::find_if(symbols.begin(),
-                             symbols.end(),
-                             [](const std::string& s){
-                                     return s[0] == 'z';
-                             });
-
-        if(z_symbol == symbols.end()){
-                return std::string{'z'};
+std::string Function::find_prefix(const std::unordered_set<std::string>& scrambled_symbols){
+        std::vector<const std::string*> symbols;
+        symbols.reserve(scrambled_symbols.size());
+        for(auto& symbol : scrambled_symbols){
+                symbols.push_back(&symbol);
         }
-        else{
-                char next_char = '0';
-                std::string the_prefix{"z0"};
-                for(; z_symbol != symbols.end(); z_symbol++){
-                        auto symbol = *z_symbol;
-
-                        bool found_prefix{false};
-                        // the_prefix can't collide with anything previous
-                        // since if collision was possible, it would have
-                        // sorted after the string we're checking
-                        while(!found_prefix){
-
-                                if(next_char == ':'){
-                                        next_char = '0';
-                                        the_prefix.push_back(next_char);
-                                }
 
-                                if(the_prefix == symbol.substr(0, the_prefix.length())){
-                                        char prefix_add =
-                                                symbol[the_prefix.length() - 1] + 1;
-                                        the_prefix[the_prefix.length() - 1] = prefix_add;
-                                        next_char = prefix_add + 1;
-                                }
-                                else{
-                                        found_prefix = true;
-                                }
-                        }
-                }
-                return the_prefix;
-        }
+        return collision_free_prefix(symbols);
 }
 
+void Function::emit_l2(L2_Out& out,
+                       std::function<std::string()> name_gen,
+                       Tiling tiling,
+                       const Label_Names& labels,
+                       Peephole_Report* report,
+                       bool peephole){
+        static std::array<const char*, 6> arg_reg_str = {"rdi",
+                                                         "rsi",
+                                                         "rdx",
+                                                         "rcx",
+                                                         "r8",
+                                                         "r9"};
 
 
-std::string Function::enstringify_l2ishly(std::function<std::string()> name_gen){
-        Dump v;
-
-        static std::array<char*, 6> arg_reg_str = {"rdi",
-                                                   "rsi",
-                                                   "rdx",
-                                                   "rcx",
-                                                   "r8",
-                                                   "r9"};
 
-
-
-        v.result << "(";
-        name.accept(v);
-        v.result << "\n";
-        v.result << params.size() << " ";
-        v.result << (params.size() > 6) ? params.size() - 6 : 0; // I love magic numbers. So. Much.
-        v.result << "\n";
+        out << "(";
+        out.atom(&name);
+        out << "\n";
+        out << params.size() << " ";
+        out << int(params.size() > 6); // I love magic numbers. So. Much.
+        out << "\n";
 
         for(int i = 0; i < params.size(); i++){
                 if(i < 6){
-                v.result << "(";
-                params[i].accept(v);
-                v.result << " <- ";
-                v.result << arg_reg_str[i];
-                v.result << ")" << "\n";
+                out << "(";
+                out.atom(&params[i]);
+                out << " <- ";
+                out << arg_reg_str[i];
+                out << ")" << "\n";
                 } else {
-                        v.result << "(";
-                        params[i].accept(v);
-                        v.result << " <- ";
-                        v.result << "(stack-arg ";
-                        v.result << ((params.size() - i) * 8);
-                        v.result << "))\n";
+                        out << "(";
+                        out.atom(&params[i]);
+                        out << " <- ";
+                        out << "(stack-arg ";
+                        out << ((params.size() - i) * 8);
+                        out << "))\n";
                 }
         }
 
-        std::vector<Tile::tile_ptr> my_brand_new_tiles;
+        L2_Insts body;
 
-        my_brand_new_tiles.reserve(instructions.size());
+        if(tiling == Tiling::dp){
+                Tile_O_Tron_4000 tron{*this, name_gen, labels, body};
+                tron.tile();
+        } else {
+                std::vector<Tile::tile_ptr> my_brand_new_tiles;
 
-        auto names = grabber_of_the_labels();
+                my_brand_new_tiles.reserve(instructions.size());
 
-        auto prefix = find_prefix(names);
+                // Make me some tiles. Yummy.
+                for(auto i_ptr : instructions){
+                        my_brand_new_tiles.push_back(L3::Tile::match_tile(i_ptr, name_gen));
+                        my_brand_new_tiles.back()->name_labels(&labels);
+                }
 
-        // Make me some tiles. Yummy.
-        for(auto i_ptr : instructions){
-                my_brand_new_tiles.push_back(L3::Tile::match_me_bro(i_ptr, name_gen));
+                for(auto t_ptr : my_brand_new_tiles){
+                        t_ptr->emit(body);
+                }
         }
 
-        for(auto t_ptr : my_brand_new_tiles){
-                v.result << t_ptr->to_L2();
-                v.result << "\n";
+        if(peephole){
+                static const Peephole pass;
+                pass.run(body, report);
         }
 
-        v.result << ")";
+        print(body, out);
+        out << ")";
+}
 
-        return v.result.str();
+std::string Function::enstringify_l2ishly(std::function<std::string()> name_gen,
+                                          Tiling tiling,
+                                          const Label_Names& labels){
+        L2_Out out;
+        emit_l2(out, name_gen, tiling, labels);
+        return out.str();
 }
 
-namespace L3{
-        void prefixify_labels(ast_ptr item,
-                              std::string fun_prefix,
-                              std::set<std::string> globally_scoped_names){
+namespace{
+        // Each distinct label gets its new name built once
+        struct Label_Renamer{
+                const std::string& fun_prefix;
+                const std::unordered_set<Symbol>& globally_scoped_names;
+                Label_Names names;
+                std::unordered_set<Symbol> seen;
 
-                if(is_one_of<L3::Label>(item)){
-                        auto lab_ptr = dynamic_cast<L3::Label*>(item.get());
+                void rename(ast_ptr item){
+                        if(auto lab_ptr = node_cast<L3::Label>(item)){
+                                if(globally_scoped_names.count(lab_ptr->name)
+                                   || !seen.insert(lab_ptr->name).second){
+                                        return;
+                                }
 
-                        if(globally_scoped_names.count(lab_ptr->name)){
-                                return;
+                                auto new_name = ":" + fun_prefix + lab_ptr->name.str().substr(1);
+                                names.rename(lab_ptr->name, Symbol{new_name});
                         }
 
-                        auto super_fun_prefix = std::string(":");
-                        super_fun_prefix.append(fun_prefix);
-
-
-                        auto orig_label_name = lab_ptr->name.substr(1);
-
-                        lab_ptr->name = super_fun_prefix.append(orig_label_name);
-                }
-
-                else if(is_one_of<L3::Instruction>(item)){
-                        auto i_ptr = dynamic_cast<L3::Instruction*>(item.get());
-                        for(auto child : i_ptr->operands){
-                                prefixify_labels(child, fun_prefix, globally_scoped_names);
+                        else if(auto i_ptr = node_cast<L3::Instruction>(item)){
+                                for(auto child : i_ptr->operands){
+                                        rename(child);
+                                }
                         }
                 }
-        }
+        };
 }
-void Function::scopify_labels(std::string fun_prefix, std::set<std::string> globally_scoped_names){
+
+Label_Names Function::scoped_label_names(const std::string& fun_prefix,
+                                         const std::unordered_set<Symbol>& globally_scoped_names){
+        Label_Renamer renamer{fun_prefix, globally_scoped_names, {}, {}};
+
         for(auto inst : instructions){
-                if(is_one_of<Call>(inst)){
-                        continue;
-                }
-                prefixify_labels(inst, fun_prefix, globally_scoped_names);
+                renamer.rename(inst);
         }
+
+        return std::move(renamer.names);
 }
 
 #ifdef UNIT_TEST
 
 TEST_CASE("Does the magical variadic caster work?"){
-        ast_ptr var_ptr{new Var("V1")};
+        ast_ptr var_ptr = make_AST<Var>("V1");
 
-        ast_ptr int_ptr{new Int_Literal(12)};
+        ast_ptr int_ptr = make_AST<Int_Literal>(12);
 
-        ast_ptr rt_fun_ptr{new Runtime_Fun(Runtime_Fun::print)};
+        ast_ptr rt_fun_ptr = make_AST<Runtime_Fun>(Runtime_Fun::print);
 
         SECTION("one type"){
                 REQUIRE(is_one_of<Var>(var_ptr));
@@ -527,4 +566,22 @@ TEST_CASE("Does the magical variadic caster work?"){
         }
 }
 
+TEST_CASE("node kinds"){
+        static_assert(kind_is_one_of<Instruction>(Kind::label), "labels are instructions");
+        static_assert(is_atom_kind(Kind::label), "and atoms");
+        static_assert(!kind_is_one_of<Instruction>(Kind::var), "vars aren't");
+        static_assert(kind_is_one_of<Load, Store>(Kind::store), "");
+        static_assert(!is_s_kind(Kind::runtime_fun), "");
+
+        ast_ptr lab = make_AST<Label>(":here");
+        ast_ptr go = make_AST<Goto>(node_cast<Label>(lab));
+
+        REQUIRE(node_cast<Label>(lab)->name.str() == ":here");
+        REQUIRE(node_cast<Instruction>(lab)->operands.empty());
+        REQUIRE(node_cast<Goto>(go)->get_target() == lab);
+        REQUIRE(node_cast<Var>(lab) == nullptr);
+        REQUIRE(node_cast<Cjump>(go) == nullptr);
+        REQUIRE(node_cast<Var>(nullptr) == nullptr);
+}
+
 #endif
@@ -3,11 +3,17 @@
 #include <stdint.h>
 #include <string>
 #include <vector>
+#include <initializer_list>
 #include <utils.h>
+#include <symbol.h>
+#include <arena.h>
+#include <memory>
 #include <sstream>
+#include <unordered_map>
 #include <unordered_set>
 #include <boost/optional/optional.hpp>
 #include <set>
+#include <functional>
 
 namespace L3{
 
@@ -32,6 +38,9 @@ namespace L3{
         struct Int_Literal;
         struct Runtime_Fun;
 
+        class L2_Out;
+        class Peephole_Report;
+
 
 ///////////////////////////////////////////////////////////////////////////////
 //                       Visitors and base-type things                       //
@@ -56,9 +65,30 @@ namespace L3{
                 virtual void visit(Runtime_Fun* item) = 0;
         };
 
+/*
+  What a function's labels are called once they're out of the function. A side
+  table, so the AST keeps the names it was parsed with and any number of
+  passes can look at it at once. Labels it doesn't know stay as they are.
+*/
+        class Label_Names{
+        public:
+                Symbol operator()(Symbol label) const{
+                        auto found = renamed.find(label);
+                        return found == renamed.end() ? label : found->second;
+                }
+
+                void rename(Symbol from, Symbol to){ renamed[from] = to; }
+                std::size_t size() const { return renamed.size(); }
+
+        private:
+                std::unordered_map<Symbol, Symbol> renamed;
+        };
+
         class Dump :
                 public AST_Item_Visitor{
         public:
+                explicit Dump(const Label_Names* labels = nullptr) : labels(labels) {}
+
                 void visit(Program* item)     override;
                 void visit(Function* item)    override;
                 void visit(Assignment* item)  override;
@@ -77,13 +107,62 @@ namespace L3{
                 void visit(Runtime_Fun* item) override;
 
                 std::stringstream result;
+                const Label_Names* labels;
+        };
+
+
+/*
+  Every node knows what it is, so type tests are a compare on a byte instead
+  of a trip through RTTI. The order matters: instructions and atoms are
+  contiguous ranges, with Label sitting in both.
+*/
+        enum class Kind : uint8_t{
+                program,
+                function,
+
+                // instructions
+                assignment,
+                binop,
+                load,
+                store,
+                goto_,
+                cjump,
+                call,
+                val_return,
+                void_return,
+                label,
+                // atoms, starting at label
+                var,
+                int_literal,
+                runtime_fun
         };
 
+        constexpr bool is_instruction_kind(Kind k){
+                return k >= Kind::assignment && k <= Kind::label;
+        }
+
+        constexpr bool is_atom_kind(Kind k){
+                return k >= Kind::label && k <= Kind::runtime_fun;
+        }
+
+        constexpr bool is_t_kind(Kind k){
+                return k == Kind::var || k == Kind::int_literal;
+        }
+
+        constexpr bool is_s_kind(Kind k){
+                return k == Kind::label || is_t_kind(k);
+        }
+
+        constexpr bool is_callable_kind(Kind k){
+                return k == Kind::runtime_fun || k == Kind::var || k == Kind::label;
+        }
 
         struct AST_Item{
+                explicit AST_Item(Kind kind) : kind(kind) {}
+
                 virtual void accept(AST_Item_Visitor &v) = 0;
 
-                bool has_already_been_tiled_why_are_you_still_here_question_mark{false};
+                Kind kind;
 
                 virtual ~AST_Item() = default;
         };
@@ -99,12 +178,16 @@ namespace L3{
   An instruction is any internal node in the program tree.
 */
         struct Instruction :
-                public virtual AST_Item{
+                public AST_Item{
+
+                // in the same arena as the node itself
+                using Operands = std::vector<L3_ptr<AST_Item>, Arena_Allocator<L3_ptr<AST_Item>>>;
 
-                Instruction();
-                Instruction(std::vector<L3_ptr<AST_Item>> operands);
+                explicit Instruction(Kind kind);
+                Instruction(Kind kind, std::initializer_list<L3_ptr<AST_Item>> operands);
+                Instruction(Kind kind, Operands operands);
 
-                const std::vector<L3_ptr<AST_Item>> operands;
+                const Operands operands;
 
                 virtual ~Instruction();
         };
@@ -113,6 +196,7 @@ namespace L3{
 
         struct Assignment :
                 public Instruction{
+                static constexpr Kind node_kind = Kind::assignment;
 
                 Assignment(ast_ptr lhs, ast_ptr rhs);
 
@@ -125,6 +209,7 @@ namespace L3{
 
         struct Goto :
                 public Instruction{
+                static constexpr Kind node_kind = Kind::goto_;
 
                 Goto(L3_ptr<Label> target);
 
@@ -135,6 +220,7 @@ namespace L3{
 
         struct Cjump :
                 public Instruction{
+                static constexpr Kind node_kind = Kind::cjump;
 
                 Cjump(L3_ptr<Var> cond,
                       L3_ptr<Label> t_target,
@@ -149,8 +235,10 @@ namespace L3{
 
         struct Call :
                 public Instruction{
+                static constexpr Kind node_kind = Kind::call;
 
-                Call(std::vector<ast_ptr> everything);
+                explicit Call(const std::vector<ast_ptr>& everything);
+                explicit Call(Operands everything);
 
                 ast_ptr get_callee();
 
@@ -163,6 +251,7 @@ namespace L3{
 
         struct Val_Return :
                 public Instruction{
+                static constexpr Kind node_kind = Kind::val_return;
 
                 Val_Return(L3_ptr<AST_Item> result);
 
@@ -173,6 +262,9 @@ namespace L3{
 
         struct Void_Return :
                 public Instruction{
+                static constexpr Kind node_kind = Kind::void_return;
+
+                Void_Return();
 
                 void accept(AST_Item_Visitor &v) override;
         };
@@ -183,6 +275,7 @@ namespace L3{
 // Internal instructions (internal nodes)
         struct Binop :
                 public Instruction{
+                static constexpr Kind node_kind = Kind::binop;
 
                 enum Op{
                         plus,
@@ -213,6 +306,8 @@ namespace L3{
 
         struct Load :
                 public Instruction{
+                static constexpr Kind node_kind = Kind::load;
+
                 Load(ast_ptr loadee);
 
                 ast_ptr get_loadee();
@@ -222,6 +317,8 @@ namespace L3{
 
         struct Store :
                 public Instruction{
+                static constexpr Kind node_kind = Kind::store;
+
                 Store(ast_ptr storee);
 
                 ast_ptr get_storee();
@@ -233,31 +330,33 @@ namespace L3{
 ///////////////////////////////////////////////////////////////////////////////
 //                                   Atoms                                    //
 ///////////////////////////////////////////////////////////////////////////////
-        struct Atom :
-                public virtual AST_Item{
-        };
-
         struct Var :
-                public Atom{
+                public AST_Item{
+                static constexpr Kind node_kind = Kind::var;
 
                 explicit Var(std::string name);
+                explicit Var(Symbol name);
 
-                std::string name;
+                Symbol name;
                 void accept(AST_Item_Visitor &v) override;
         };
 
+        // Both an atom and, when it stands alone in a function body, an
+        // instruction with no operands.
         struct Label :
-                public Atom,
                 public Instruction{
+                static constexpr Kind node_kind = Kind::label;
 
                 explicit Label(std::string name);
+                explicit Label(Symbol name);
 
-                std::string name;
+                Symbol name; // colon included
                 void accept(AST_Item_Visitor &v) override;
         };
 
         struct Int_Literal :
-                public Atom{
+                public AST_Item{
+                static constexpr Kind node_kind = Kind::int_literal;
 
                 explicit Int_Literal(int64_t val);
 
@@ -266,7 +365,8 @@ namespace L3{
         };
 
         struct Runtime_Fun:
-                public Atom{
+                public AST_Item{
+                static constexpr Kind node_kind = Kind::runtime_fun;
 
                 enum Fun{
                         print,
@@ -284,30 +384,56 @@ namespace L3{
 //                            Structural elements                            //
 ///////////////////////////////////////////////////////////////////////////////
 
-        template<typename T>
-        bool is_one_of(L3_ptr<AST_Item> item){
-                return dynamic_cast<T*>(item.get());
+        // Which kinds a pointer to T may point at
+        template <typename T>
+        struct Kind_Of{
+                static constexpr bool matches(Kind k){ return k == T::node_kind; }
+        };
+
+        template <>
+        struct Kind_Of<Instruction>{
+                static constexpr bool matches(Kind k){ return is_instruction_kind(k); }
+        };
+
+        template <>
+        struct Kind_Of<AST_Item>{
+                static constexpr bool matches(Kind){ return true; }
+        };
+
+        template <typename T>
+        constexpr bool kind_is_one_of(Kind k){
+                return Kind_Of<T>::matches(k);
         }
 
         template <typename T, typename T2, typename... Args>
+        constexpr bool kind_is_one_of(Kind k){
+                return Kind_Of<T>::matches(k) || kind_is_one_of<T2, Args...>(k);
+        }
+
+        template<typename T, typename... Args>
         bool is_one_of(L3_ptr<AST_Item> item){
-                return dynamic_cast<T*>(item.get()) ||
-                        is_one_of<T2, Args...>(item);
+                return item && kind_is_one_of<T, Args...>(item->kind);
+        }
+
+        // dynamic_cast, minus the dynamic
+        template <typename T>
+        T* node_cast(L3_ptr<AST_Item> item){
+                return is_one_of<T>(item) ? static_cast<T*>(item) : nullptr;
         }
 
         inline
         bool is_t(ast_ptr item){
-                return is_one_of<Var, Int_Literal>(item);
+                return item && is_t_kind(item->kind);
         }
 
         inline
         bool is_s(ast_ptr item){
-                return is_one_of<Label>(item) || is_t(item);
+                return item && is_s_kind(item->kind);
         }
 
         inline
         bool is_callable(ast_ptr item){
-                return is_one_of<Runtime_Fun, Var, Label>(item);
+                return item && is_callable_kind(item->kind);
         }
 
         inline
@@ -320,59 +446,87 @@ namespace L3{
                 return is_one_of<Load>(item);
         }
 
+        // print, allocate and array-error come out of the parser as Vars
+        bool is_runtime_fun_name(Symbol name);
+
+        // Calls to these don't come back through a return label
+        bool is_runtime_call(ast_ptr callee);
+
+
 
+        enum class Tiling{
+                munch, // match_tile, one L3 instruction at a time. Fast.
+                dp     // Tile_O_Tron_4000, cheapest cover of whole expression trees
+        };
 
         struct Function :
                 public AST_Item{
+                static constexpr Kind node_kind = Kind::function;
 
                 explicit Function(Label name);
 
+                Function(const Function&) = delete;
+                Function& operator=(const Function&) = delete;
+
+                // Declared first so it's torn down last: every node in
+                // instructions lives in here.
+                Arena arena;
+
                 Label name;
                 std::vector<Var> params;
-                std::vector<L3_ptr<Instruction>> instructions;
+                using Instructions = std::vector<L3_ptr<Instruction>, Arena_Allocator<L3_ptr<Instruction>>>;
+                Instructions instructions;
 
 
 
                 void accept(AST_Item_Visitor &v) override;
 
-                std::string enstringify_l2ishly(std::function<std::string()> name_gen);
+                // The whole function as L2, appended to out. The body goes
+                // through the peephole first unless told not to, report says
+                // what that did.
+                void emit_l2(L2_Out& out,
+                             std::function<std::string()> name_gen,
+                             Tiling tiling = Tiling::munch,
+                             const Label_Names& labels = Label_Names{},
+                             Peephole_Report* report = nullptr,
+                             bool peephole = true);
+
+                // emit_l2 into a string, for tests and anyone who wants a copy
+                std::string enstringify_l2ishly(std::function<std::string()> name_gen,
+                                                Tiling tiling = Tiling::munch,
+                                                const Label_Names& labels = Label_Names{});
 
 
                 std::unordered_set<std::string> grabber_of_the_labels();
-                std::unordered_set<std::string> grabber_of_the_vars();
+                std::unordered_set<Symbol> grabber_of_the_vars();
 
-                void scopify_labels(std::string fun_prefix, std::set<std::string> gsns);
+                // Every local label as :<fun_prefix><old name>. The function
+                // itself is left alone.
+                Label_Names scoped_label_names(const std::string& fun_prefix,
+                                               const std::unordered_set<Symbol>& gsns);
 
-                static  std::string find_prefix(std::unordered_set<std::string> scrambled_symbols);
+                static  std::string find_prefix(const std::unordered_set<std::string>& scrambled_symbols);
 
                 template <typename Find_Type, typename Ignore_Type>
-                std::unordered_set<std::string> walk_for_names(ast_ptr item){
+                void walk_for_names(const ast_ptr& item, std::unordered_set<Symbol>& names){
 
                         if(is_one_of<Int_Literal, Runtime_Fun, Ignore_Type>(item)){
-                                return {};
+                                return;
                         }
 
-                        std::unordered_set<std::string> names;
-
-                        auto name_atom_ptr = dynamic_cast<Find_Type*>(item.get());
+                        auto name_atom_ptr = node_cast<Find_Type>(item);
                         if(name_atom_ptr){
-                                if(name_atom_ptr->name != "print"
-                                   && name_atom_ptr->name != "allocate"
-                                   && name_atom_ptr->name != "array-error"){
+                                if(!is_runtime_fun_name(name_atom_ptr->name)){
                                         names.insert(name_atom_ptr->name);
-                                        return names;
-                                } else{
-                                        return {};
                                 }
+                                return;
                         }
 
-                        auto cur_i_ptr = dynamic_cast<Instruction*>(item.get());
+                        auto cur_i_ptr = node_cast<Instruction>(item);
                         if(cur_i_ptr){
-                                for(auto i_ptr : cur_i_ptr->operands){
-                                        auto child_names = walk_for_names<Find_Type, Ignore_Type>(i_ptr);
-                                        names.insert(child_names.begin(), child_names.end());
+                                for(const auto& i_ptr : cur_i_ptr->operands){
+                                        walk_for_names<Find_Type, Ignore_Type>(i_ptr, names);
                                 }
-                                return names;
                         } else {
                                 throw std::logic_error("You've missed a case in walk_for_names");
                         }
@@ -381,21 +535,22 @@ namespace L3{
 
         struct Program :
                 public AST_Item{
+                static constexpr Kind node_kind = Kind::program;
 
-                using Functions_t = std::vector<L3_ptr<Function>>;
+                using fun_ptr = std::unique_ptr<Function>;
+                using Functions_t = std::vector<fun_ptr>;
+                using Function_Sink = std::function<void(fun_ptr)>;
 
-                Program() = default;
+                Program();
                 explicit Program(Functions_t functions);
 
-                std::vector<L3_ptr<Function>> functions;
+                Functions_t functions;
 
+                // When set, the parser hands every function over as soon as
+                // its closing brace is seen instead of keeping it in functions.
+                Function_Sink function_sink;
 
-                void accept(AST_Item_Visitor &v) override;
-        };
 
-// Phony instructions
-        struct STAHP :
-                public AST_Item{
                 void accept(AST_Item_Visitor &v) override;
         };
 
@@ -404,8 +559,14 @@ namespace L3{
                 return ptrT{new T{std::forward<Args>(args)...}};
         }
 
+        // AST nodes go in the current arena, never on the heap by themselves
+        template <typename T, typename... Args>
+        T* make_node(Args&&... args){
+                return Arena::current().make<T>(std::forward<Args>(args)...);
+        }
+
         template <typename T, typename... Args>
         ast_ptr make_AST(Args&&... args){
-                return make_thing<ast_ptr, T>(std::forward<Args>(args)...);
+                return make_node<T>(std::forward<Args>(args)...);
         }
 }
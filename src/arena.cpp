@@ -0,0 +1,163 @@
+#include <arena.h>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+
+#ifdef UNIT_TEST
+#include <catch.hpp>
+#include <string>
+#endif
+
+using namespace L3;
+
+namespace{
+        // Enough for a typical function in one go, doubling after that.
+        const std::size_t first_chunk_size = 4096;
+        const std::size_t max_chunk_size = 64 * 1024;
+
+        thread_local std::vector<Arena*> arena_stack;
+
+        Arena& fallback_arena(){
+                thread_local Arena fallback;
+                return fallback;
+        }
+
+        inline char* align_up(char* p, std::size_t align){
+                auto bits = reinterpret_cast<std::uintptr_t>(p);
+                return reinterpret_cast<char*>((bits + align - 1) & ~(std::uintptr_t(align) - 1));
+        }
+}
+
+Arena::Arena() :
+        next(nullptr),
+        limit(nullptr),
+        newest(nullptr),
+        destructors(nullptr),
+        objects(0),
+        chunks(0),
+        reserved(0)
+{}
+
+Arena::~Arena(){
+        // newest first, so things die in the opposite order they were made
+        for(auto d = destructors; d; d = d->next){
+                d->destroy(d->obj);
+        }
+
+        while(newest){
+                auto prev = newest->prev;
+                std::free(newest);
+                newest = prev;
+        }
+}
+
+void Arena::new_chunk(std::size_t at_least){
+        std::size_t size = reserved ? reserved : first_chunk_size;
+        if(size > max_chunk_size){
+                size = max_chunk_size;
+        }
+        if(size < at_least + sizeof(Chunk) + alignof(std::max_align_t)){
+                size = at_least + sizeof(Chunk) + alignof(std::max_align_t);
+        }
+
+        auto chunk = static_cast<Chunk*>(std::malloc(size));
+        if(!chunk){
+                throw std::bad_alloc();
+        }
+        chunk->prev = newest;
+        newest = chunk;
+
+        next = reinterpret_cast<char*>(chunk + 1);
+        limit = reinterpret_cast<char*>(chunk) + size;
+
+        chunks++;
+        reserved += size;
+}
+
+void* Arena::allocate(std::size_t size, std::size_t align){
+        char* start = next ? align_up(next, align) : nullptr;
+
+        if(!start || start + size > limit){
+                new_chunk(size + align);
+                start = align_up(next, align);
+        }
+
+        next = start + size;
+        return start;
+}
+
+void Arena::remember_destructor(void* obj, void (*destroy)(void*)){
+        auto d = static_cast<Destructor*>(allocate(sizeof(Destructor), alignof(Destructor)));
+        d->destroy = destroy;
+        d->obj = obj;
+        d->next = destructors;
+        destructors = d;
+}
+
+Arena& Arena::current(){
+        return arena_stack.empty() ? fallback_arena() : *arena_stack.back();
+}
+
+void Arena::push_current(Arena& arena){
+        arena_stack.push_back(&arena);
+}
+
+void Arena::pop_current(){
+        arena_stack.pop_back();
+}
+
+Arena_Scope::Arena_Scope(Arena& arena) :
+        depth(arena_stack.size())
+{
+        Arena::push_current(arena);
+}
+
+Arena_Scope::~Arena_Scope(){
+        arena_stack.resize(depth);
+}
+
+#ifdef UNIT_TEST
+namespace{
+        struct Counted{
+                explicit Counted(int* deaths) : deaths(deaths) {}
+                ~Counted(){ (*deaths)++; }
+                int* deaths;
+                std::string padding{"long enough to not be a small string, surely"};
+        };
+}
+
+TEST_CASE("arenas hand out aligned memory and clean up after themselves"){
+        int deaths = 0;
+        {
+                Arena a;
+                for(int i = 0; i < 5000; i++){
+                        auto c = a.make<Counted>(&deaths);
+                        REQUIRE(reinterpret_cast<std::uintptr_t>(c) % alignof(Counted) == 0);
+                        auto big = static_cast<char*>(a.allocate(100000, 64));
+                        big[99999] = 'x';
+                        REQUIRE(reinterpret_cast<std::uintptr_t>(big) % 64 == 0);
+                }
+                REQUIRE(a.object_count() == 5000);
+                REQUIRE(deaths == 0);
+        }
+        REQUIRE(deaths == 5000);
+}
+
+TEST_CASE("arena scopes nest and unwind"){
+        Arena outer;
+        Arena inner;
+
+        Arena& before = Arena::current();
+        {
+                Arena_Scope s1(outer);
+                REQUIRE(&Arena::current() == &outer);
+                {
+                        Arena_Scope s2(inner);
+                        REQUIRE(&Arena::current() == &inner);
+                        Arena::push_current(outer); // left dangling on purpose
+                }
+                REQUIRE(&Arena::current() == &outer);
+        }
+        REQUIRE(&Arena::current() == &before);
+}
+#endif
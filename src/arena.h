@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace L3{
+
+/*
+  Bump allocator that owns AST nodes. Every Function has one and everything
+  hanging off its instructions lives in it, so a function's whole tree goes
+  away in one go when the Function does. Nodes point at each other with
+  plain non-owning pointers.
+
+  make_AST and friends allocate from the calling thread's current arena,
+  which is whatever Arena_Scope is innermost. Outside of any scope (unit
+  tests, mostly) nodes go to a per-thread arena that lives until the thread
+  exits.
+*/
+        class Arena{
+        public:
+                Arena();
+                ~Arena();
+
+                Arena(const Arena&) = delete;
+                Arena& operator=(const Arena&) = delete;
+
+                template <typename T, typename... Args>
+                T* make(Args&&... args){
+                        void* mem = allocate(sizeof(T), alignof(T));
+                        T* obj = new (mem) T{std::forward<Args>(args)...};
+
+                        if(!std::is_trivially_destructible<T>::value){
+                                remember_destructor(obj, &destroy<T>);
+                        }
+                        objects++;
+
+                        return obj;
+                }
+
+                void* allocate(std::size_t size, std::size_t align);
+
+                std::size_t object_count() const { return objects; }
+                std::size_t chunk_count() const { return chunks; }
+                std::size_t bytes_reserved() const { return reserved; }
+
+                static Arena& current();
+
+                // Only Arena_Scope and the PEGTL actions should need these.
+                static void push_current(Arena& arena);
+                static void pop_current();
+
+        private:
+                struct Chunk{
+                        Chunk* prev;
+                };
+
+                struct Destructor{
+                        void (*destroy)(void*);
+                        void* obj;
+                        Destructor* next;
+                };
+
+                template <typename T>
+                static void destroy(void* obj){
+                        static_cast<T*>(obj)->~T();
+                }
+
+                void remember_destructor(void* obj, void (*destroy)(void*));
+                void new_chunk(std::size_t at_least);
+
+                char* next;
+                char* limit;
+                Chunk* newest;
+                Destructor* destructors;
+
+                std::size_t objects;
+                std::size_t chunks;
+                std::size_t reserved;
+
+                friend class Arena_Scope;
+        };
+
+        // For containers inside nodes, so their storage sits in the same arena
+        // as the node. Freeing is a no-op; it all goes when the arena does.
+        template <typename T>
+        struct Arena_Allocator{
+                using value_type = T;
+
+                Arena_Allocator() : arena(&Arena::current()) {}
+                explicit Arena_Allocator(Arena& arena) : arena(&arena) {}
+
+                template <typename U>
+                Arena_Allocator(const Arena_Allocator<U>& other) : arena(other.arena) {}
+
+                T* allocate(std::size_t n){
+                        return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+                }
+
+                void deallocate(T*, std::size_t){}
+
+                Arena* arena;
+        };
+
+        template <typename T, typename U>
+        bool operator==(const Arena_Allocator<T>& a, const Arena_Allocator<U>& b){
+                return a.arena == b.arena;
+        }
+
+        template <typename T, typename U>
+        bool operator!=(const Arena_Allocator<T>& a, const Arena_Allocator<U>& b){
+                return a.arena != b.arena;
+        }
+
+        // Makes arena the current one until the scope ends, also undoing any
+        // push_current that was left hanging by an exception.
+        class Arena_Scope{
+        public:
+                explicit Arena_Scope(Arena& arena);
+                ~Arena_Scope();
+
+                Arena_Scope(const Arena_Scope&) = delete;
+                Arena_Scope& operator=(const Arena_Scope&) = delete;
+
+        private:
+                std::size_t depth;
+        };
+}
@@ -0,0 +1,237 @@
+#include <cfg.h>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+#ifdef UNIT_TEST
+#include <catch.hpp>
+#include <ll_parser.h>
+#include <working_copy.h>
+#include <chrono>
+#include <iostream>
+#endif
+
+using namespace L3;
+
+CFG CFG::build(const Function& fun){
+        CFG g;
+        const auto& insts = fun.instructions;
+
+        // Where the blocks start, and which block each label starts
+        std::unordered_map<Symbol, Block> starts;
+        bool ended = true;
+        for(std::size_t i = 0; i < insts.size(); i++){
+                auto label = node_cast<Label>(insts[i]);
+                if(ended || label){
+                        g.first.push_back(i);
+                }
+                if(label){
+                        starts[label->name] = g.first.size() - 1;
+                }
+                ended = is_one_of<Goto, Cjump, Val_Return, Void_Return>(insts[i]);
+        }
+        g.first.push_back(insts.size());
+
+        auto block_at = [&](ast_ptr target) -> Block{
+                auto found = starts.find(node_cast<Label>(target)->name);
+                if(found == starts.end()){
+                        throw std::logic_error("br to " + node_cast<Label>(target)->name.str()
+                                               + ", which isn't in " + fun.name.name.str());
+                }
+                return found->second;
+        };
+
+        const Block blocks = g.size();
+        g.succ_begin.reserve(blocks + 1);
+        g.succ.reserve(blocks + blocks / 2);
+        for(Block b = 0; b < blocks; b++){
+                g.succ_begin.push_back(g.succ.size());
+
+                auto last = insts[g.end(b) - 1];
+                if(auto jump = node_cast<Goto>(last)){
+                        g.succ.push_back(block_at(jump->get_target()));
+                } else if(auto cjump = node_cast<Cjump>(last)){
+                        auto t = block_at(cjump->get_true_target());
+                        auto f = block_at(cjump->get_false_target());
+                        g.succ.push_back(t);
+                        if(f != t){
+                                g.succ.push_back(f);
+                        }
+                } else if(!is_one_of<Val_Return, Void_Return>(last) && b + 1 < blocks){
+                        g.succ.push_back(b + 1);
+                }
+        }
+        g.succ_begin.push_back(g.succ.size());
+
+        // Predecessors are the same edges sorted by where they go: count,
+        // then drop each one in its slot
+        g.pred_begin.assign(blocks + 1, 0);
+        for(auto to : g.succ){
+                g.pred_begin[to + 1]++;
+        }
+        for(Block b = 0; b < blocks; b++){
+                g.pred_begin[b + 1] += g.pred_begin[b];
+        }
+        g.pred.resize(g.succ.size());
+        std::vector<uint32_t> filled(g.pred_begin.begin(), g.pred_begin.end() - 1);
+        for(Block b = 0; b < blocks; b++){
+                for(auto to : g.succs(b)){
+                        g.pred[filled[to]++] = b;
+                }
+        }
+
+        return g;
+}
+
+std::vector<CFG::Block> CFG::reverse_postorder() const{
+        std::vector<Block> order;
+        if(!size()){
+                return order;
+        }
+        order.reserve(size());
+
+        // Depth first without recursion, a function can be 100k blocks
+        // deep. Each stack entry is a block and how many of its succs
+        // have been looked at.
+        std::vector<bool> seen(size(), false);
+        std::vector<std::pair<Block, uint32_t>> stack{{0, 0}};
+        seen[0] = true;
+        while(!stack.empty()){
+                auto& top = stack.back();
+                auto next = succs(top.first);
+                if(top.second == next.size()){
+                        order.push_back(top.first);
+                        stack.pop_back();
+                        continue;
+                }
+                auto to = next.begin()[top.second++];
+                if(!seen[to]){
+                        seen[to] = true;
+                        stack.emplace_back(to, 0);
+                }
+        }
+
+        std::reverse(order.begin(), order.end());
+        return order;
+}
+
+#ifdef UNIT_TEST
+namespace{
+        Program parsed(const std::string& src){
+                return ll_parse(src.data(), src.data() + src.size(), "test");
+        }
+
+        std::vector<CFG::Block> all(CFG::Blocks blocks){
+                return std::vector<CFG::Block>(blocks.begin(), blocks.end());
+        }
+
+        using Bs = std::vector<CFG::Block>;
+}
+
+TEST_CASE("basic blocks split at labels and after brs and returns"){
+        Program p = parsed("define :f(a, p){\n"
+                           "  x <- 1\n"             // 0
+                           "  :top\n"               // 1
+                           "  x <- x + a\n"
+                           "  c <- x < 10\n"
+                           "  br c :top :out\n"
+                           "  y <- 2\n"             // 2, nobody gets here
+                           "  :out\n"               // 3
+                           "  :also_out\n"          // 4
+                           "  br a :done :done\n"
+                           "  :done\n"              // 5
+                           "  store p <- x\n"
+                           "  return x\n"
+                           "}\n");
+        auto g = CFG::build(*p.functions[0]);
+
+        REQUIRE(g.size() == 6);
+        REQUIRE(g.first == (std::vector<uint32_t>{0, 1, 5, 6, 7, 9, 12}));
+        REQUIRE(g.instruction_count() == 12);
+
+        REQUIRE(all(g.succs(0)) == (Bs{1}));
+        REQUIRE(all(g.succs(1)) == (Bs{1, 3}));
+        REQUIRE(all(g.succs(2)) == (Bs{3}));
+        REQUIRE(all(g.succs(3)) == (Bs{4}));
+        REQUIRE(all(g.succs(4)) == (Bs{5})); // both ways go to the same place
+        REQUIRE(g.succs(5).empty());
+
+        REQUIRE(g.preds(0).empty());
+        REQUIRE(all(g.preds(1)) == (Bs{0, 1}));
+        REQUIRE(g.preds(2).empty());
+        REQUIRE(all(g.preds(3)) == (Bs{1, 2}));
+        REQUIRE(all(g.preds(5)) == (Bs{4}));
+        // 2 can't be reached
+        REQUIRE(g.reverse_postorder() == (Bs{0, 1, 3, 4, 5}));
+}
+
+TEST_CASE("a working copy's cfg sticks around until its body changes"){
+        Program p = parsed("define :f(a){\n"
+                           "  br a :yes :no\n"
+                           "  :yes\n"
+                           "  return 1\n"
+                           "  :no\n"
+                           "  return 0\n"
+                           "}\n");
+        Working_Copy work{*p.functions[0]};
+        auto& fun = work.body;
+
+        SECTION("same one every time"){
+                auto& g = work.cfg();
+                REQUIRE(&work.cfg() == &g);
+                REQUIRE(g.size() == 3);
+        }
+
+        SECTION("and a new one after"){
+                {
+                        Arena_Scope scope{fun.arena};
+                        fun.instructions[0] = make_node<Goto>(make_AST<Label>(std::string(":no")));
+                }
+                work.body_changed();
+                auto& g = work.cfg();
+                REQUIRE(all(g.succs(0)) == (Bs{2}));
+                REQUIRE(g.preds(1).empty());
+                REQUIRE(CFG::build(*p.functions[0]).succs(0).size() == 2);
+        }
+
+        SECTION("nothing at all is no blocks"){
+                fun.instructions.clear();
+                work.body_changed();
+                REQUIRE(work.cfg().size() == 0);
+        }
+}
+
+TEST_CASE("br to a label that isn't there"){
+        Program p = parsed("define :f(){\n"
+                           "  br :nowhere\n"
+                           "}\n");
+        REQUIRE_THROWS_AS(CFG::build(*p.functions[0]), std::logic_error);
+}
+
+TEST_CASE("cfg of a huge function", "[.][bench]"){
+        for(int n : {10000, 100000, 400000}){
+                std::string src = "define :big(a, b, c){\n";
+                for(int i = 0; i < n; i++){
+                        auto num = std::to_string(i);
+                        src += "  :l" + num + "\n"
+                                "  i" + num + " <- a + " + num + "\n"
+                                "  store b <- i" + num + "\n"
+                                "  br c :l" + std::to_string(i / 2) + " :l" + std::to_string(i + 1) + "\n";
+                }
+                src += "  :l" + std::to_string(n) + "\n"
+                        "  return a\n}\n";
+                Program p = ll_parse(src.data(), src.data() + src.size(), "bench");
+                auto& fun = *p.functions[0];
+
+                auto start = std::chrono::steady_clock::now();
+                auto g = CFG::build(fun);
+                std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+                REQUIRE(g.size() == std::size_t(n) + 1);
+
+                std::cout << fun.instructions.size() << " instructions, " << g.size() << " blocks: "
+                          << took.count() << " s, "
+                          << took.count() * 1e9 / fun.instructions.size() << " ns per instruction\n";
+        }
+}
+#endif
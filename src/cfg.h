@@ -0,0 +1,68 @@
+#pragma once
+
+#include <L3.h>
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+
+namespace L3{
+
+/*
+  A function's basic blocks and the edges between them. A block starts at
+  every label and right after every br and return, so block b is
+  instructions [first[b], first[b + 1]) and only ever gets entered at the
+  top. Block 0 is where the function starts. A block that doesn't end in a
+  br or a return falls into the next one.
+
+  Edges are stored the flat way: all the successors in one array, block b's
+  being succs[succ_begin[b]] up to succs[succ_begin[b + 1]], and the same
+  for predecessors. Building it is two scans over the instructions plus one
+  over the edges, however big the function gets.
+
+  Passes don't build these themselves, they ask their Working_Copy for
+  work.cfg(), which keeps the last one around until work.body_changed().
+*/
+        struct CFG{
+                using Block = uint32_t;
+
+                // A run of block numbers, for range-for
+                struct Blocks{
+                        const Block* first;
+                        const Block* last;
+
+                        const Block* begin() const { return first; }
+                        const Block* end() const { return last; }
+                        std::size_t size() const { return last - first; }
+                        bool empty() const { return first == last; }
+                };
+
+                static CFG build(const Function& fun);
+
+                std::size_t size() const { return first.size() - 1; } // blocks
+
+                // Where block b's instructions are in fun.instructions
+                uint32_t begin(Block b) const { return first[b]; }
+                uint32_t end(Block b) const { return first[b + 1]; }
+
+                Blocks succs(Block b) const { return {succ.data() + succ_begin[b], succ.data() + succ_begin[b + 1]}; }
+                Blocks preds(Block b) const { return {pred.data() + pred_begin[b], pred.data() + pred_begin[b + 1]}; }
+
+                // The blocks reachable from the entry, each one before
+                // everything it leads to except along a back edge
+                std::vector<Block> reverse_postorder() const;
+
+                // How many instructions the function had when this was
+                // built. A stale one is a bug, see Working_Copy::cfg().
+                std::size_t instruction_count() const { return first.back(); }
+
+                // one per block, plus a sentinel
+                std::vector<uint32_t> first;
+                std::vector<uint32_t> succ_begin;
+                std::vector<uint32_t> pred_begin;
+
+                // one per edge
+                std::vector<Block> succ;
+                std::vector<Block> pred;
+        };
+}
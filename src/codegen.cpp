@@ -0,0 +1,289 @@
+#include <codegen.h>
+#include <thread_pool.h>
+#include <working_copy.h>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <vector>
+
+#ifdef UNIT_TEST
+#include <catch.hpp>
+#include <ll_parser.h>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#endif
+
+using namespace L3;
+
+void L3::compile_function(Function& fun,
+                          int64_t index,
+                          Label_Scoping& scoping,
+                          Tiling tiling,
+                          L2_Out& out,
+                          Peephole_Report* report,
+                          const L3_Passes& passes){
+        Working_Copy work{fun};
+        if(passes.fold){
+                fold_constants(work, passes.fold_report);
+        }
+        if(passes.dce){
+                eliminate_dead_code(work, passes.dce_report);
+        }
+
+        auto labels = scoping.scopify(fun, index);
+
+        work.body.emit_l2(out, scoping.return_labels(index), tiling, labels, report, passes.peephole);
+        out << "\n";
+}
+
+namespace{
+/*
+  Finished functions waiting for their turn. Slot i % window holds function
+  i, and function i can't be started until i - window has been written, so
+  a slot is never written to and read at the same time.
+*/
+        class Reorder_Buffer{
+        public:
+                explicit Reorder_Buffer(std::size_t window) :
+                        slots(window),
+                        done(window, false)
+                {}
+
+                // Where function i goes, once it's within the window.
+                // nullptr if everything got called off.
+                L2_Out* start(std::size_t i){
+                        std::unique_lock<std::mutex> guard(lock);
+                        changed.wait(guard, [&](){ return stopped || i < written + slots.size(); });
+                        if(stopped){
+                                return nullptr;
+                        }
+                        auto& out = slots[i % slots.size()];
+                        out.clear();
+                        return &out;
+                }
+
+                void finish(std::size_t i){
+                        {
+                                std::lock_guard<std::mutex> guard(lock);
+                                done[i % slots.size()] = true;
+                        }
+                        changed.notify_all();
+                }
+
+                // The next function in order, nullptr if everything got called off
+                const L2_Out* next(){
+                        std::unique_lock<std::mutex> guard(lock);
+                        changed.wait(guard, [&](){ return stopped || done[written % slots.size()]; });
+                        if(stopped){
+                                return nullptr;
+                        }
+                        return &slots[written % slots.size()];
+                }
+
+                void pop(){
+                        {
+                                std::lock_guard<std::mutex> guard(lock);
+                                done[written % slots.size()] = false;
+                                written++;
+                        }
+                        changed.notify_all();
+                }
+
+                void stop(){
+                        {
+                                std::lock_guard<std::mutex> guard(lock);
+                                stopped = true;
+                        }
+                        changed.notify_all();
+                }
+
+        private:
+                std::vector<L2_Out> slots;
+                std::vector<bool> done;
+                std::size_t written{0};
+                bool stopped{false};
+
+                std::mutex lock;
+                std::condition_variable changed;
+        };
+}
+
+void L3::compile_functions(const Program::Functions_t& functions,
+                           Label_Scoping& scoping,
+                           Tiling tiling,
+                           unsigned jobs,
+                           const std::function<void(const L2_Out&)>& write,
+                           std::size_t window,
+                           Peephole_Report* report,
+                           const L3_Passes& passes){
+        scoping.prefix(); // settle it before anybody else asks
+
+        if(jobs == 1){
+                L2_Out out;
+                for(std::size_t i = 0; i < functions.size(); i++){
+                        out.clear();
+                        compile_function(*functions[i], i, scoping, tiling, out, report, passes);
+                        write(out);
+                }
+                return;
+        }
+
+        Thread_Pool pool(jobs);
+        Reorder_Buffer buffer(window ? window : 4 * pool.size());
+        std::atomic<std::size_t> claimed{0};
+
+        for(unsigned t = 0; t < pool.size(); t++){
+                pool.submit([&](){
+                                try{
+                                        for(auto i = claimed++; i < functions.size(); i = claimed++){
+                                                auto out = buffer.start(i);
+                                                if(!out){
+                                                        return;
+                                                }
+                                                compile_function(*functions[i], i, scoping, tiling, *out, report, passes);
+                                                buffer.finish(i);
+                                        }
+                                } catch(...){
+                                        buffer.stop();
+                                        throw;
+                                }
+                        });
+        }
+
+        // The writer is this thread
+        std::exception_ptr write_failure;
+        try{
+                for(std::size_t i = 0; i < functions.size(); i++){
+                        auto out = buffer.next();
+                        if(!out){
+                                break;
+                        }
+                        write(*out);
+                        buffer.pop();
+                }
+        } catch(...){
+                write_failure = std::current_exception();
+                buffer.stop();
+        }
+
+        if(write_failure){
+                try{
+                        pool.wait();
+                } catch(...){
+                        // the write failure is the one to report
+                }
+                std::rethrow_exception(write_failure);
+        }
+        pool.wait();
+}
+
+#ifdef UNIT_TEST
+namespace{
+        std::string lots_of_functions(int funs){
+                std::string src;
+                for(int f = 0; f < funs; f++){
+                        auto n = std::to_string(f);
+                        src += "define :f" + n + "(a, b, p){\n"
+                                "  :top\n"
+                                "  t1 <- a + b\n"
+                                "  t2 <- t1 * 8\n"
+                                "  t3 <- p + t2\n"
+                                "  v <- load t3\n"
+                                "  store t3 <- v\n"
+                                "  a <- a - 1\n"
+                                "  c <- 0 < a\n"
+                                "  br c :top :out\n"
+                                "  :out\n";
+                        // uneven on purpose, so threads finish out of order
+                        for(int extra = 0; extra < f % 7 * 20; extra++){
+                                src += "  r <- call :f0(a, b, p)\n";
+                        }
+                        src += "  r <- call :f0(a, b, p)\n"
+                                "  return r\n"
+                                "}\n";
+                }
+                return src;
+        }
+
+        std::string compile_all(Program& p, Tiling tiling, unsigned jobs, std::size_t window = 0){
+                Label_Scoping scoping;
+                for(auto& fun : p.functions){
+                        scoping.collect(*fun);
+                }
+
+                std::string out;
+                compile_functions(p.functions, scoping, tiling, jobs,
+                                  [&](const L2_Out& l2){ out.append(l2.data(), l2.size()); },
+                                  window);
+                return out;
+        }
+}
+
+TEST_CASE("parallel codegen writes the same bytes as serial"){
+        auto src = lots_of_functions(300);
+        Program p = ll_parse(src.data(), src.data() + src.size(), "test");
+
+        for(auto tiling : {Tiling::munch, Tiling::dp}){
+                auto serial = compile_all(p, tiling, 1);
+                REQUIRE(serial.find(":z299_0ret") != std::string::npos);
+
+                for(unsigned jobs : {2u, 3u, 8u}){
+                        REQUIRE(compile_all(p, tiling, jobs) == serial);
+                        REQUIRE(compile_all(p, tiling, jobs, 1) == serial);
+                }
+        }
+}
+
+TEST_CASE("codegen leaves the program as it was parsed"){
+        auto src = lots_of_functions(50);
+        Program p = ll_parse(src.data(), src.data() + src.size(), "test");
+        Dump parsed;
+        p.accept(parsed);
+
+        auto first = compile_all(p, Tiling::dp, 1);
+        Dump after;
+        p.accept(after);
+        REQUIRE(after.result.str() == parsed.result.str());
+
+        // so doing it again, or from a fresh parse, is the same thing
+        REQUIRE(compile_all(p, Tiling::dp, 4) == first);
+        Program fresh = ll_parse(src.data(), src.data() + src.size(), "test");
+        REQUIRE(compile_all(fresh, Tiling::dp, 1) == first);
+}
+
+TEST_CASE("parallel codegen stops on the first failure"){
+        auto src = lots_of_functions(200);
+        Program p = ll_parse(src.data(), src.data() + src.size(), "test");
+
+        Label_Scoping scoping;
+        for(auto& fun : p.functions){
+                scoping.collect(*fun);
+        }
+
+        std::size_t writes = 0;
+        REQUIRE_THROWS_AS(compile_functions(p.functions, scoping, Tiling::dp, 4,
+                                            [&](const L2_Out&){
+                                                    if(++writes == 50){
+                                                            throw std::runtime_error("disk full");
+                                                    }
+                                            }, 2),
+                          std::runtime_error);
+        REQUIRE(writes == 50);
+}
+
+TEST_CASE("parallel codegen throughput", "[.][bench]"){
+        auto src = lots_of_functions(20000);
+        Program p = ll_parse(src.data(), src.data() + src.size(), "bench");
+
+        for(unsigned jobs : {1u, 2u, 4u, 8u}){
+                auto start = std::chrono::steady_clock::now();
+                auto out = compile_all(p, Tiling::dp, jobs);
+                std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+
+                std::cout << jobs << " threads: " << took.count() << " s, "
+                          << out.size() / took.count() / 1e6 << " MB/s of L2\n";
+        }
+}
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <L3.h>
+#include <const_fold.h>
+#include <dce.h>
+#include <l2_out.h>
+#include <label_scoping.h>
+#include <peephole.h>
+
+#include <cstddef>
+#include <functional>
+
+namespace L3{
+
+        // What gets done to a function's L3 before it's tiled, and where
+        // those passes report to. They rewrite a Working_Copy of it, the
+        // function itself is left as it was parsed. peephole is the cleanup
+        // on the L2 that comes out, see peephole.h.
+        struct L3_Passes{
+                bool fold{true};
+                Fold_Report* fold_report{nullptr};
+                bool dce{true};
+                DCE_Report* dce_report{nullptr};
+                bool peephole{true};
+        };
+
+        // Function index's L2, with the trailing newline, appended to out.
+        // Safe to call for different functions at once.
+        void compile_function(Function& fun,
+                              int64_t index,
+                              Label_Scoping& scoping,
+                              Tiling tiling,
+                              L2_Out& out,
+                              Peephole_Report* report = nullptr,
+                              const L3_Passes& passes = L3_Passes{});
+
+/*
+  Tiles every function on jobs threads and hands the results to write in
+  source order. Threads claim functions in order, so whoever is free takes
+  the next one, and finished functions wait in a ring of window buffers
+  until everything before them has been written. Nobody gets more than
+  window functions ahead of the writer, which bounds memory however
+  uneven the functions are.
+
+  Every name is picked per function (see label_scoping.h), so the output is
+  the same bytes for any number of threads. scoping needs to have seen
+  every function already. If tiling or write throws, everybody stops and the
+  first exception comes back out of here.
+*/
+        void compile_functions(const Program::Functions_t& functions,
+                               Label_Scoping& scoping,
+                               Tiling tiling,
+                               unsigned jobs,
+                               const std::function<void(const L2_Out&)>& write,
+                               std::size_t window = 0, // 0: a few per thread
+                               Peephole_Report* report = nullptr,
+                               const L3_Passes& passes = L3_Passes{});
+}
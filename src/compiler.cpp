@@ -1,6 +1,6 @@
 #include <parser.h>
-#include <fstream>
-#include <set>
+#include <lexer.h>
+#include <codegen.h>
 #include <unordered_set>
 #include <string>
 
@@ -9,59 +9,133 @@ using namespace L3;
 #ifndef UNIT_TEST
 int main(int argc, char** argv){
 
-        if(argc != 2){
-                std::cerr << "USAGE: " << argv[0] << " <source file>";
+        std::string source_file;
+        Parser_Backend backend = Parser_Backend::pegtl;
+        bool streaming = false;
+        unsigned jobs = 1;
+        Tiling tiling = Tiling::dp;
+        bool peephole_report = false;
+        bool fold_report = false;
+        bool dce_report = false;
+        L3_Passes passes;
+
+        for(int i = 1; i < argc; i++){
+                std::string arg{argv[i]};
+                if(arg == "--parser=pegtl"){
+                        backend = Parser_Backend::pegtl;
+                } else if(arg == "--parser=ll"){
+                        backend = Parser_Backend::ll;
+                } else if(arg == "--stream"){
+                        streaming = true;
+                } else if(arg == "--tiler=munch"){
+                        tiling = Tiling::munch;
+                } else if(arg == "--tiler=dp"){
+                        tiling = Tiling::dp;
+                } else if(arg == "--no-peephole"){
+                        passes.peephole = false;
+                } else if(arg == "--peephole-report"){
+                        peephole_report = true;
+                } else if(arg == "--no-fold"){
+                        passes.fold = false;
+                } else if(arg == "--fold-report"){
+                        fold_report = true;
+                } else if(arg == "--no-dce"){
+                        passes.dce = false;
+                } else if(arg == "--dce-report"){
+                        dce_report = true;
+                } else if(arg.compare(0, 7, "--jobs=") == 0){
+                        jobs = std::stoul(arg.substr(7));
+                } else {
+                        source_file = arg;
+                }
         }
 
-        Program p = parse_file(std::string(argv[1]));
-
-        std::ofstream shiny_new_prog("prog.L2");
-
-        shiny_new_prog << "(" << ":main" << "\n\n";
-
-        // scopify labels
-        std::unordered_set<std::string> final_label_names;
-        for(auto fun : p.functions){
-                auto fun_label_names = fun->grabber_of_the_labels();
-                final_label_names.insert(fun_label_names.begin(), fun_label_names.end());
+        if(source_file.empty()){
+                std::cerr << "USAGE: " << argv[0]
+                          << " [--parser=pegtl|ll] [--tiler=dp|munch] [--stream] [--jobs=N]"
+                          << " [--no-fold] [--fold-report] [--no-dce] [--dce-report]"
+                          << " [--no-peephole] [--peephole-report] <source file>\n";
+                return 1;
         }
-        auto scoping_prefix = Function::find_prefix(final_label_names);
 
-        std::set<std::string> globally_scoped_names;
-        for(auto fun : p.functions){
-                globally_scoped_names.insert(fun->name.name);
+        if(streaming && jobs != 1){
+                std::cerr << "--stream tiles each function as soon as it's parsed, "
+                          << "one at a time, so it can't take --jobs\n";
+                return 1;
         }
 
-        for(int i = 0; i < p.functions.size(); i++){
-                auto fun_prefix = scoping_prefix.append(std::to_string(i));
-                p.functions[i]->scopify_labels(fun_prefix, globally_scoped_names);
-        }
+        Peephole_Report report{peephole_rules()};
+        auto report_to = peephole_report ? &report : nullptr;
 
-        // Make return labels, tile, and output L2
-        std::unordered_set<std::string> label_names;
-        for(auto fun : p.functions){
-                auto fun_label_names = fun->grabber_of_the_labels();
-                label_names.insert(fun_label_names.begin(), fun_label_names.end());
+        Fold_Report folding;
+        if(fold_report){
+                passes.fold_report = &folding;
+        }
+        DCE_Report dead_code;
+        if(dce_report){
+                passes.dce_report = &dead_code;
         }
-        auto the_prefix = Function::find_prefix(label_names);
-
-        auto retlabel_maker = [the_prefix](){
-                auto my_prefix = std::string(":");
-                my_prefix.append(the_prefix);
-                static int label_counter = 0;
-                my_prefix.append(std::string(std::to_string(label_counter)));
-                my_prefix.append("ret");
-                label_counter += 1;
-                return my_prefix;};
-
 
-        for(auto fun : p.functions){
-                shiny_new_prog << fun->enstringify_l2ishly(retlabel_maker);
-                shiny_new_prog << "\n";
+        L2_File shiny_new_prog{"prog.L2"};
+        L2_Out buffer; // one function at a time, reused
+
+        buffer << "(" << ":main" << "\n\n";
+        shiny_new_prog.write(buffer);
+
+        if(streaming){
+                // Functions are tiled and written while the parser is still
+                // going, so the label prefix has to come from a quick scan of
+                // the raw text instead of the AST.
+                Label_Scoping scoping;
+                {
+                        Mapped_File source{source_file};
+                        auto census = census_labels(source.begin(), source.end());
+
+                        for(auto& label : census.labels){
+                                scoping.add_label_text(label);
+                        }
+                        for(auto name : census.function_names){
+                                scoping.add_global(name);
+                        }
+                }
+
+                int64_t fun_index = 0;
+                parse_file_streaming(source_file,
+                                     [&](Program::fun_ptr fun){
+                                             buffer.clear();
+                                             compile_function(*fun, fun_index++, scoping, tiling, buffer, report_to, passes);
+                                             shiny_new_prog.write(buffer);
+                                     },
+                                     backend);
+        } else {
+                Program p = jobs == 1
+                        ? parse_file(source_file, backend)
+                        : parse_file_parallel(source_file, jobs, backend);
+
+                // one pass to see every label, then scopify as we go
+                Label_Scoping scoping;
+                for(auto& fun : p.functions){
+                        scoping.collect(*fun);
+                }
+
+                // Tile and output L2, on jobs threads but always in order
+                compile_functions(p.functions, scoping, tiling, jobs,
+                                  [&](const L2_Out& fun_l2){ shiny_new_prog.write(fun_l2); },
+                                  0, report_to, passes);
         }
 
+        shiny_new_prog.write("\n)\n", 3);
+        shiny_new_prog.flush();
 
-        shiny_new_prog << "\n)\n";
+        if(fold_report){
+                folding.print(std::cerr);
+        }
+        if(dce_report){
+                dead_code.print(std::cerr);
+        }
+        if(peephole_report){
+                report.print(std::cerr);
+        }
 
         return 0;
 }
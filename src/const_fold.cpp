@@ -0,0 +1,375 @@
+#include <const_fold.h>
+#include <arena.h>
+#include <l2.h>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#ifdef UNIT_TEST
+#include <catch.hpp>
+#include <ll_parser.h>
+#include <chrono>
+#include <iostream>
+#endif
+
+using namespace L3;
+
+void Fold_Report::print(std::ostream& out) const{
+        print_totals(out, "constant folding", "L3 instructions");
+        out << "  propagated: " << propagated << "\n"
+            << "  folded: " << folded << "\n"
+            << "  branches decided: " << branches << "\n";
+}
+
+namespace{
+        class Folder{
+        public:
+                // What's known so far in the current block
+                std::unordered_map<Symbol, int64_t> known;
+
+                int64_t propagated{0};
+                int64_t folded{0};
+                int64_t branches{0};
+
+                // The number operand holds, if that's known
+                bool number(ast_ptr operand, int64_t& val){
+                        if(auto num = node_cast<Int_Literal>(operand)){
+                                val = num->val;
+                                return true;
+                        }
+                        if(auto var = node_cast<Var>(operand)){
+                                auto found = known.find(var->name);
+                                if(found != known.end()){
+                                        val = found->second;
+                                        return true;
+                                }
+                        }
+                        return false;
+                }
+
+                // operand, or the number it's known to be
+                ast_ptr value(ast_ptr operand){
+                        int64_t val;
+                        if(is_one_of<Var>(operand) && number(operand, val)){
+                                propagated++;
+                                return make_AST<Int_Literal>(val);
+                        }
+                        return operand;
+                }
+
+                // nullptr when the instruction can go
+                L3_ptr<Instruction> fold(L3_ptr<Instruction> inst){
+                        if(auto assign = node_cast<Assignment>(inst)){
+                                return fold(assign);
+                        }
+                        if(auto call = node_cast<Call>(inst)){
+                                return fold(call);
+                        }
+                        if(auto cjump = node_cast<Cjump>(inst)){
+                                int64_t cond;
+                                if(!number(cjump->get_cond(), cond)){
+                                        return inst;
+                                }
+                                // Same test the tiles use, (cjump 0 < c)
+                                auto target = cond > 0 ? cjump->get_true_target() : cjump->get_false_target();
+                                branches++;
+                                return make_node<Goto>(node_cast<Label>(target));
+                        }
+                        if(auto ret = node_cast<Val_Return>(inst)){
+                                auto result = value(ret->get_result());
+                                return result == ret->get_result() ? inst : make_node<Val_Return>(result);
+                        }
+                        return inst;
+                }
+
+                L3_ptr<Instruction> fold(Assignment* assign){
+                        auto lhs = assign->get_lhs();
+                        auto rhs = assign->get_rhs();
+
+                        if(is_one_of<Store>(lhs)){
+                                auto stored = value(rhs);
+                                return stored == rhs ? assign : make_node<Assignment>(lhs, stored);
+                        }
+
+                        auto dest = node_cast<Var>(lhs)->name;
+                        auto is_now = [&](int64_t val) -> L3_ptr<Instruction>{
+                                auto found = known.find(dest);
+                                if(found != known.end() && found->second == val){
+                                        return nullptr;
+                                }
+                                known[dest] = val;
+                                return make_node<Assignment>(lhs, make_AST<Int_Literal>(val));
+                        };
+
+                        if(auto num = node_cast<Int_Literal>(rhs)){
+                                return is_now(num->val) ? assign : nullptr;
+                        }
+
+                        if(auto var = node_cast<Var>(rhs)){
+                                int64_t val;
+                                if(number(var, val)){
+                                        propagated++;
+                                        return is_now(val);
+                                }
+                                if(var->name == dest){
+                                        return nullptr;
+                                }
+                                known.erase(dest);
+                                return assign;
+                        }
+
+                        if(auto binop = node_cast<Binop>(rhs)){
+                                int64_t a, b;
+                                bool a_known = number(binop->get_lhs(), a);
+                                bool b_known = number(binop->get_rhs(), b);
+                                if(a_known && b_known){
+                                        folded++;
+                                        return is_now(evaluate(binop->op, a, b));
+                                }
+
+                                auto new_a = value(binop->get_lhs());
+                                auto new_b = value(binop->get_rhs());
+                                known.erase(dest);
+                                if(new_a == binop->get_lhs() && new_b == binop->get_rhs()){
+                                        return assign;
+                                }
+                                return make_node<Assignment>(lhs, make_AST<Binop>(binop->op, new_a, new_b));
+                        }
+
+                        if(auto call = node_cast<Call>(rhs)){
+                                known.erase(dest);
+                                auto new_call = fold(call);
+                                return new_call == call ? assign : make_node<Assignment>(lhs, new_call);
+                        }
+
+                        // loads and labels
+                        known.erase(dest);
+                        return assign;
+                }
+
+                L3_ptr<Instruction> fold(Call* call){
+                        std::vector<ast_ptr> everything{call->get_callee()};
+                        bool changed = false;
+                        for(auto arg : call->get_args()){
+                                everything.push_back(value(arg));
+                                changed = changed || everything.back() != arg;
+                        }
+                        return changed ? make_node<Call>(everything) : call;
+                }
+        };
+}
+
+void L3::fold_constants(Working_Copy& work, Fold_Report* report){
+        auto& fun = work.body;
+        Arena_Scope scope{fun.arena};
+        Folder folder;
+
+        auto& insts = fun.instructions;
+        const auto before = insts.size();
+
+        std::size_t kept = 0;
+        for(std::size_t i = 0; i < insts.size(); i++){
+                auto inst = insts[i];
+
+                if(auto label = node_cast<Label>(inst)){
+                        folder.known.clear();
+
+                        // br :l right before :l
+                        auto jump = kept ? node_cast<Goto>(insts[kept - 1]) : nullptr;
+                        if(jump && node_cast<Label>(jump->get_target())->name == label->name){
+                                kept--;
+                        }
+                        insts[kept++] = inst;
+                        continue;
+                }
+
+                auto folded = folder.fold(inst);
+                if(folded){
+                        insts[kept++] = folded;
+                }
+                if(is_one_of<Goto, Cjump, Val_Return, Void_Return>(folded ? folded : inst)){
+                        folder.known.clear();
+                }
+        }
+        insts.resize(kept);
+
+        // A var set to a number that nobody reads anymore, because every
+        // read got the number instead, can go too
+        std::unordered_map<Symbol, int64_t> reads;
+        std::function<void(ast_ptr)> count_reads = [&](ast_ptr item){
+                if(auto var = node_cast<Var>(item)){
+                        reads[var->name]++;
+                } else if(auto inst = node_cast<Instruction>(item)){
+                        for(auto operand : inst->operands){
+                                count_reads(operand);
+                        }
+                }
+        };
+        auto constant_def = [](ast_ptr inst) -> Var*{
+                auto assign = node_cast<Assignment>(inst);
+                if(assign && is_one_of<Int_Literal>(assign->get_rhs())){
+                        return node_cast<Var>(assign->get_lhs());
+                }
+                return nullptr;
+        };
+        for(auto inst : insts){
+                if(auto assign = node_cast<Assignment>(inst)){
+                        if(!is_one_of<Var>(assign->get_lhs())){
+                                count_reads(assign->get_lhs());
+                        }
+                        count_reads(assign->get_rhs());
+                } else {
+                        count_reads(inst);
+                }
+        }
+        insts.erase(std::remove_if(insts.begin(), insts.end(),
+                                   [&](L3_ptr<Instruction> inst){
+                                           auto var = constant_def(inst);
+                                           return var && !reads.count(var->name);
+                                   }),
+                    insts.end());
+        kept = insts.size();
+        work.body_changed();
+
+        if(report){
+                report->before += before;
+                report->after += kept;
+                report->propagated += folder.propagated;
+                report->folded += folder.folded;
+                report->branches += folder.branches;
+        }
+}
+
+#ifdef UNIT_TEST
+namespace{
+        std::string folded(const std::string& src, Fold_Report* report = nullptr){
+                return dumped(src, [&](Working_Copy& work){ fold_constants(work, report); });
+        }
+}
+
+TEST_CASE("constants get folded and passed along"){
+        SECTION("through a chain of assignments"){
+                REQUIRE(folded("define :f(a){\n"
+                               "  x <- 5\n"
+                               "  y <- x * 8\n"
+                               "  z <- y + 1\n"
+                               "  w <- a + z\n"
+                               "  call print(z)\n"
+                               "  return y\n"
+                               "}\n") ==
+                        dumped("define :f(a){\n"
+                               "  w <- a + 41\n"
+                               "  call print(41)\n"
+                               "  return 40\n"
+                               "}\n"));
+        }
+
+        SECTION("wrapping, shifting and comparing like the CPU does"){
+                REQUIRE(folded("define :f(){\n"
+                               "  big <- 9223372036854775807\n"
+                               "  a <- big + 1\n"
+                               "  b <- 1 << 65\n"
+                               "  c <- -16 >> 2\n"
+                               "  d <- a < b\n"
+                               "  e <- 3 >= 3\n"
+                               "  store b <- e\n"
+                               "  call print(d)\n"
+                               "  call print(a)\n"
+                               "  return c\n"
+                               "}\n") ==
+                        dumped("define :f(){\n"
+                               "  b <- 2\n"
+                               "  store b <- 1\n"
+                               "  call print(1)\n"
+                               "  call print(-9223372036854775808)\n"
+                               "  return -4\n"
+                               "}\n"));
+        }
+
+        SECTION("known branches go straight there"){
+                Fold_Report report;
+                REQUIRE(folded("define :f(a){\n"
+                               "  c <- 1 < 2\n"
+                               "  br c :yes :no\n"
+                               "  :yes\n"
+                               "  c <- a < 2\n"
+                               "  br c :no :done\n"
+                               "  :no\n"
+                               "  d <- 0\n"
+                               "  d <- 0\n"
+                               "  br d :yes :done\n"
+                               "  :done\n"
+                               "  return\n"
+                               "}\n", &report) ==
+                        dumped("define :f(a){\n"
+                               "  c <- 1\n"
+                               "  :yes\n"
+                               "  c <- a < 2\n"
+                               "  br c :no :done\n"
+                               "  :no\n"
+                               "  :done\n"
+                               "  return\n"
+                               "}\n"));
+                REQUIRE(report.before == 11);
+                REQUIRE(report.after == 7);
+                REQUIRE(report.branches == 2);
+        }
+
+        SECTION("but nothing is known past a label, a load or a call"){
+                std::string src = "define :f(p){\n"
+                                  "  x <- 1\n"
+                                  "  :top\n"
+                                  "  y <- x + 1\n"
+                                  "  x <- load p\n"
+                                  "  z <- x + y\n"
+                                  "  x <- call :f(z)\n"
+                                  "  w <- x + 1\n"
+                                  "  x <- 2\n"
+                                  "  store p <- w\n"
+                                  "  br :top\n"
+                                  "}\n";
+                REQUIRE(folded(src) == dumped(src));
+        }
+}
+
+TEST_CASE("constant folding on the bench programs", "[.][bench]"){
+        std::string src;
+        for(int f = 0; f < 2000; f++){
+                auto n = std::to_string(f);
+                src += "define :f" + n + "(a, p){\n"
+                        "  n <- 10\n"
+                        "  size <- n * 8\n"
+                        "  size <- size + 8\n"
+                        "  arr <- call allocate(n, 1)\n"
+                        "  i <- 0\n"
+                        "  :loop" + n + "\n"
+                        "  off <- i * 8\n"
+                        "  addr <- arr + off\n"
+                        "  store addr <- a\n"
+                        "  i <- i + 1\n"
+                        "  more <- i < 10\n"
+                        "  br more :loop" + n + " :done" + n + "\n"
+                        "  :done" + n + "\n"
+                        "  debug <- 0\n"
+                        "  br debug :say" + n + " :out" + n + "\n"
+                        "  :say" + n + "\n"
+                        "  call print(size)\n"
+                        "  :out" + n + "\n"
+                        "  return arr\n"
+                        "}\n";
+        }
+        Program p = ll_parse(src.data(), src.data() + src.size(), "bench");
+
+        Fold_Report report;
+        auto start = std::chrono::steady_clock::now();
+        for(auto& fun : p.functions){
+                Working_Copy work{*fun};
+                fold_constants(work, &report);
+        }
+        std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+
+        std::cout << "folded in " << took.count() << " s\n";
+        report.print(std::cout);
+}
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <L3.h>
+#include <pass_report.h>
+#include <working_copy.h>
+
+#include <atomic>
+#include <ostream>
+
+namespace L3{
+
+/*
+  Constant folding and propagation on a function's L3, before it gets
+  tiled. Walking each basic block top to bottom, a var that was last set
+  to a number gets that number wherever it's read, a binop with two
+  numbers becomes its value (computed the way the CPU would, see
+  evaluate), and a br on a known condition becomes a plain br. A br right
+  before the label it goes to, and setting a var to the number it already
+  holds, go away.
+
+  Nothing is known at the top of a block, so a var only carries a number
+  from where it's set to the end of its block. Afterwards a var set to a
+  number that's read nowhere in the function loses that assignment; one
+  that's still read anywhere keeps it, anything finer takes liveness.
+*/
+        // L3 instructions in and out, and what got folded on the way
+        struct Fold_Report :
+                public Pass_Report{
+                void print(std::ostream& out) const;
+
+                std::atomic<int64_t> propagated{0}; // var reads that became numbers
+                std::atomic<int64_t> folded{0};     // binops that became numbers
+                std::atomic<int64_t> branches{0};   // conditional brs that aren't anymore
+        };
+
+        void fold_constants(Working_Copy& work, Fold_Report* report = nullptr);
+}
@@ -0,0 +1,433 @@
+#include <dataflow.h>
+#include <algorithm>
+#include <bitset>
+#include <stdexcept>
+
+#ifdef UNIT_TEST
+#include <catch.hpp>
+#include <ll_parser.h>
+#include <chrono>
+#include <iostream>
+#include <set>
+#endif
+
+using namespace L3;
+
+Bits::Bits(std::size_t size) :
+        bits(size),
+        words((size + 63) / 64, 0)
+{}
+
+void Bits::reset(std::size_t from, std::size_t to){
+        if(from >= to){
+                return;
+        }
+        auto first = from / 64;
+        auto last = (to - 1) / 64;
+        uint64_t head = ~uint64_t(0) << (from % 64);
+        uint64_t tail = ~uint64_t(0) >> (63 - (to - 1) % 64);
+        if(first == last){
+                words[first] &= ~(head & tail);
+                return;
+        }
+        words[first] &= ~head;
+        std::fill(words.begin() + first + 1, words.begin() + last, 0);
+        words[last] &= ~tail;
+}
+
+void Bits::clear(){
+        std::fill(words.begin(), words.end(), 0);
+}
+
+bool Bits::unite(const Bits& other){
+        uint64_t added = 0;
+        for(std::size_t i = 0; i < words.size(); i++){
+                auto united = words[i] | other.words[i];
+                added |= united ^ words[i];
+                words[i] = united;
+        }
+        return added != 0;
+}
+
+std::size_t Bits::count() const{
+        std::size_t total = 0;
+        for(auto word : words){
+                total += std::bitset<64>(word).count();
+        }
+        return total;
+}
+
+std::vector<uint32_t> Bits::ones() const{
+        std::vector<uint32_t> found;
+        for(std::size_t w = 0; w < words.size(); w++){
+                for(auto word = words[w]; word; word &= word - 1){
+                        std::size_t low = std::bitset<64>((word & -word) - 1).count();
+                        found.push_back(w * 64 + low);
+                }
+        }
+        return found;
+}
+
+Var_Numbering Var_Numbering::of(const Function& fun){
+        Var_Numbering vars;
+        for(auto& param : fun.params){
+                vars.add(param.name);
+        }
+        for(auto inst : fun.instructions){
+                if(auto def = defined_var(inst)){
+                        vars.add(def->name);
+                }
+                for_each_use(inst, [&](Var* var){ vars.add(var->name); });
+        }
+        return vars;
+}
+
+uint32_t Var_Numbering::add(Symbol name){
+        auto added = index.emplace(name, names.size());
+        if(added.second){
+                names.push_back(name);
+        }
+        return added.first->second;
+}
+
+int64_t Var_Numbering::find(Symbol name) const{
+        auto found = index.find(name);
+        return found == index.end() ? -1 : int64_t(found->second);
+}
+
+Var* L3::defined_var(L3_ptr<Instruction> inst){
+        auto assign = node_cast<Assignment>(inst);
+        return assign ? node_cast<Var>(assign->get_lhs()) : nullptr;
+}
+
+void Gen_Kill::apply(const Bits& from, Bits& to) const{
+        to = from;
+        for(auto range : kill){
+                to.reset(range.first, range.second);
+        }
+        for(auto bit : gen){
+                to.set(bit);
+        }
+}
+
+Dataflow_Solution L3::solve(const CFG& cfg, const Dataflow_Problem& problem){
+        const auto blocks = cfg.size();
+        if(problem.blocks.size() != blocks){
+                throw std::logic_error("need a Gen_Kill for every block");
+        }
+        const bool forward = problem.direction == Direction::forward;
+
+        Dataflow_Solution s;
+        s.in.assign(blocks, Bits(problem.bits));
+        s.out.assign(blocks, Bits(problem.bits));
+
+        // Reverse postorder, with anything the entry can't reach tacked on
+        // so it still gets an answer. Backwards goes the other way round.
+        auto order = cfg.reverse_postorder();
+        std::vector<bool> reached(blocks, false);
+        for(auto b : order){
+                reached[b] = true;
+        }
+        for(CFG::Block b = 0; b < blocks; b++){
+                if(!reached[b]){
+                        order.push_back(b);
+                }
+        }
+        if(!forward){
+                std::reverse(order.begin(), order.end());
+        }
+        std::vector<uint32_t> position(blocks);
+        for(uint32_t pos = 0; pos < blocks; pos++){
+                position[order[pos]] = pos;
+        }
+
+        // Sweep over whatever's pending, in order. Facts only ever get
+        // added, so a block's meet can be kept up to date as its
+        // neighbours change instead of redone every visit. A change only
+        // needs another sweep when it feeds a block this one already passed.
+        std::vector<bool> pending(blocks, true);
+        Bits scratch(problem.bits);
+        for(bool again = true; again;){
+                again = false;
+                for(uint32_t pos = 0; pos < blocks; pos++){
+                        if(!pending[pos]){
+                                continue;
+                        }
+                        pending[pos] = false;
+                        auto b = order[pos];
+                        auto& meet = forward ? s.in[b] : s.out[b];
+                        auto& result = forward ? s.out[b] : s.in[b];
+
+                        problem.blocks[b].apply(meet, scratch);
+                        s.visits++;
+                        if(scratch == result){
+                                continue;
+                        }
+                        std::swap(scratch, result);
+                        for(auto to : forward ? cfg.succs(b) : cfg.preds(b)){
+                                auto& their_meet = forward ? s.in[to] : s.out[to];
+                                if(their_meet.unite(result)){
+                                        pending[position[to]] = true;
+                                        again = again || position[to] <= pos;
+                                }
+                        }
+                }
+        }
+
+        return s;
+}
+
+Liveness Liveness::of(const Function& fun, const CFG& cfg){
+        Liveness live;
+        live.vars = Var_Numbering::of(fun);
+
+        Dataflow_Problem problem{Direction::backward, live.vars.size(), {}};
+        problem.blocks.resize(cfg.size());
+
+        // Which block last set/read each var, so each one goes in a list once
+        std::vector<uint32_t> set_in(live.vars.size(), -1);
+        std::vector<uint32_t> read_in(live.vars.size(), -1);
+        for(CFG::Block b = 0; b < cfg.size(); b++){
+                auto& effect = problem.blocks[b];
+                for(auto i = cfg.begin(b); i < cfg.end(b); i++){
+                        auto inst = fun.instructions[i];
+                        // read before it's set here: live coming in
+                        for_each_use(inst, [&](Var* var){
+                                auto v = live.vars.index.at(var->name);
+                                if(set_in[v] != b && read_in[v] != b){
+                                        read_in[v] = b;
+                                        effect.gen.push_back(v);
+                                }
+                        });
+                        if(auto def = defined_var(inst)){
+                                auto v = live.vars.index.at(def->name);
+                                if(set_in[v] != b){
+                                        set_in[v] = b;
+                                        effect.kill.emplace_back(v, v + 1);
+                                }
+                        }
+                }
+        }
+
+        live.flow = solve(cfg, problem);
+        return live;
+}
+
+Reaching_Definitions Reaching_Definitions::of(const Function& fun, const CFG& cfg){
+        Reaching_Definitions reach;
+        reach.vars = Var_Numbering::of(fun);
+        const auto& insts = fun.instructions;
+
+        // Number the defs var by var, so killing all of a var's defs is
+        // clearing one range
+        std::vector<int64_t> var_of(insts.size(), -1);
+        reach.first_def.assign(reach.vars.size() + 1, 0);
+        for(std::size_t i = 0; i < insts.size(); i++){
+                if(auto def = defined_var(insts[i])){
+                        var_of[i] = reach.vars.index.at(def->name);
+                        reach.first_def[var_of[i] + 1]++;
+                }
+        }
+        for(std::size_t v = 0; v < reach.vars.size(); v++){
+                reach.first_def[v + 1] += reach.first_def[v];
+        }
+        reach.def_at.resize(reach.first_def.back());
+        std::vector<uint32_t> def_of(insts.size());
+        std::vector<uint32_t> filled(reach.first_def.begin(), reach.first_def.end() - 1);
+        for(std::size_t i = 0; i < insts.size(); i++){
+                if(var_of[i] >= 0){
+                        def_of[i] = filled[var_of[i]]++;
+                        reach.def_at[def_of[i]] = i;
+                }
+        }
+
+        Dataflow_Problem problem{Direction::forward, reach.def_at.size(), {}};
+        problem.blocks.resize(cfg.size());
+
+        // The last def of each var in a block is the one that gets out
+        std::vector<uint32_t> set_in(reach.vars.size(), -1);
+        std::vector<uint32_t> last_def(reach.vars.size());
+        for(CFG::Block b = 0; b < cfg.size(); b++){
+                auto& effect = problem.blocks[b];
+                std::vector<uint32_t> defined;
+                for(auto i = cfg.begin(b); i < cfg.end(b); i++){
+                        if(var_of[i] < 0){
+                                continue;
+                        }
+                        auto v = var_of[i];
+                        if(set_in[v] != b){
+                                set_in[v] = b;
+                                defined.push_back(v);
+                                effect.kill.emplace_back(reach.first_def[v], reach.first_def[v + 1]);
+                        }
+                        last_def[v] = def_of[i];
+                }
+                for(auto v : defined){
+                        effect.gen.push_back(last_def[v]);
+                }
+        }
+
+        reach.flow = solve(cfg, problem);
+        return reach;
+}
+
+#ifdef UNIT_TEST
+namespace{
+        Program parsed(const std::string& src){
+                return ll_parse(src.data(), src.data() + src.size(), "test");
+        }
+
+        // bits as var names, sorted by name so it doesn't matter who's first
+        std::set<std::string> names(const Var_Numbering& vars, const Bits& bits){
+                std::set<std::string> found;
+                for(auto v : bits.ones()){
+                        found.insert(vars.names[v].str());
+                }
+                return found;
+        }
+
+        using Names = std::set<std::string>;
+}
+
+TEST_CASE("bits"){
+        Bits b(200);
+        REQUIRE(b.count() == 0);
+
+        for(std::size_t i = 0; i < 200; i++){
+                b.set(i);
+        }
+        b.reset(3, 3);
+        REQUIRE(b.count() == 200);
+        b.reset(10, 20);
+        REQUIRE(b.count() == 190);
+        b.reset(60, 140);
+        REQUIRE(b.count() == 110);
+        REQUIRE(!b.test(60));
+        REQUIRE(!b.test(139));
+        REQUIRE(b.test(140));
+        b.reset(199);
+        REQUIRE(!b.test(199));
+
+        Bits c(200);
+        c.set(5);
+        c.set(70);
+        REQUIRE(c.ones() == (std::vector<uint32_t>{5, 70}));
+        REQUIRE(b.unite(c));
+        REQUIRE(!b.unite(c));
+        REQUIRE(b.test(70));
+        REQUIRE(b.count() == 110);
+}
+
+TEST_CASE("liveness"){
+        Program p = parsed("define :f(a, n, p){\n"
+                           "  i <- 0\n"              // 0
+                           "  s <- 0\n"
+                           "  :top\n"                // 1
+                           "  c <- i < n\n"
+                           "  br c :body :done\n"
+                           "  :body\n"               // 2
+                           "  x <- load p\n"
+                           "  s <- s + x\n"
+                           "  i <- i + 1\n"
+                           "  dead <- a\n"
+                           "  br :top\n"
+                           "  :done\n"               // 3
+                           "  call print(s)\n"
+                           "  return\n"
+                           "}\n");
+        auto& fun = *p.functions[0];
+        auto live = Liveness::of(fun, CFG::build(fun));
+        auto& vars = live.vars;
+
+        REQUIRE(vars.size() == 8);
+        REQUIRE(vars.names[0].str() == "a");
+        REQUIRE(vars.find(Symbol{std::string("print")}) == -1);
+
+        REQUIRE(names(vars, live.flow.in[0]) == (Names{"a", "n", "p"}));
+        REQUIRE(names(vars, live.flow.in[1]) == (Names{"a", "i", "n", "p", "s"}));
+        REQUIRE(names(vars, live.flow.out[1]) == (Names{"a", "i", "n", "p", "s"}));
+        REQUIRE(names(vars, live.flow.out[2]) == (Names{"a", "i", "n", "p", "s"}));
+        REQUIRE(names(vars, live.flow.in[3]) == (Names{"s"}));
+        REQUIRE(names(vars, live.flow.out[3]).empty());
+}
+
+TEST_CASE("reaching definitions"){
+        Program p = parsed("define :f(a){\n"
+                           "  x <- 1\n"              // 0: block 0
+                           "  y <- 2\n"              // 1
+                           "  x <- 3\n"              // 2
+                           "  br a :left :right\n"
+                           "  :left\n"               // 4: block 1
+                           "  y <- 4\n"              // 5
+                           "  br :join\n"
+                           "  :right\n"              // 7: block 2
+                           "  x <- a + 1\n"          // 8
+                           "  :join\n"               // 9: block 3
+                           "  return x\n"
+                           "}\n");
+        auto& fun = *p.functions[0];
+        auto reach = Reaching_Definitions::of(fun, CFG::build(fun));
+
+        auto at = [&](const Bits& defs){
+                std::set<uint32_t> found;
+                for(auto d : defs.ones()){
+                        found.insert(reach.def_at[d]);
+                }
+                return found;
+        };
+        using At = std::set<uint32_t>;
+
+        REQUIRE(reach.def_at.size() == 5);
+        REQUIRE(at(reach.flow.in[0]).empty());
+        REQUIRE(at(reach.flow.out[0]) == (At{1, 2}));
+        REQUIRE(at(reach.flow.out[1]) == (At{2, 5}));
+        REQUIRE(at(reach.flow.out[2]) == (At{1, 8}));
+        REQUIRE(at(reach.flow.in[3]) == (At{1, 2, 5, 8}));
+
+        // a var's defs sit together
+        auto x = reach.vars.find(Symbol{std::string("x")});
+        REQUIRE(reach.first_def[x + 1] - reach.first_def[x] == 3);
+}
+
+TEST_CASE("dataflow on a function with lots of vars", "[.][bench]"){
+        const int blocks = 5000;
+        const int per_block = 10;
+
+        // loop_back(b) is where block b's br goes when it doesn't fall through
+        auto time_it = [&](const std::string& shape, std::function<int(int)> loop_back){
+                std::string src = "define :big(a, p){\n";
+                for(int b = 0; b < blocks; b++){
+                        auto n = std::to_string(b);
+                        auto prev = "v" + std::to_string(b ? b - 1 : 0) + "_" + std::to_string(per_block - 1);
+                        src += "  :l" + n + "\n";
+                        for(int k = 0; k < per_block; k++){
+                                auto var = "v" + n + "_" + std::to_string(k);
+                                src += "  " + var + " <- " + (k ? "v" + n + "_" + std::to_string(k - 1) : prev) + " + a\n";
+                        }
+                        src += "  store p <- v" + std::to_string(b / 3) + "_0\n"
+                                "  br a :l" + std::to_string(loop_back(b)) + " :l" + std::to_string(b + 1) + "\n";
+                }
+                src += "  :l" + std::to_string(blocks) + "\n"
+                        "  return a\n}\n";
+                Program p = ll_parse(src.data(), src.data() + src.size(), "bench");
+                auto& fun = *p.functions[0];
+                auto cfg = CFG::build(fun);
+
+                std::cout << shape << ":\n";
+                auto start = std::chrono::steady_clock::now();
+                auto live = Liveness::of(fun, cfg);
+                std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+                std::cout << "  liveness: " << live.vars.size() << " vars, " << cfg.size() << " blocks, "
+                          << live.flow.visits << " visits, " << took.count() << " s\n";
+
+                start = std::chrono::steady_clock::now();
+                auto reach = Reaching_Definitions::of(fun, cfg);
+                took = std::chrono::steady_clock::now() - start;
+                std::cout << "  reaching definitions: " << reach.def_at.size() << " defs, "
+                          << reach.flow.visits << " visits, " << took.count() << " s\n";
+        };
+
+        time_it("loops of 10 blocks, 2 deep", [](int b){ return b % 10 == 9 ? b - b % 100 : b - b % 10; });
+        time_it("every block a loop back to half way", [](int b){ return b / 2; });
+}
+#endif
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <L3.h>
+#include <cfg.h>
+
+#include <stdint.h>
+#include <cstddef>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace L3{
+
+/*
+  Iterative bit-vector dataflow over a function's basic blocks, plus the
+  two analyses everybody wants out of it: liveness and reaching
+  definitions.
+
+  Facts are numbered densely per function (vars by Var_Numbering, defs by
+  where they are) and every block gets an in and an out Bits of them.
+  What a block does is a short list of bits it sets and ranges it clears,
+  applied after copying what flows in. That and the union over preds/succs
+  are straight loops over 64 bit words, the compiler vectorizes them.
+  Blocks get revisited in reverse postorder (or its reverse, going
+  backwards) until nothing changes, which for the usual loop nests is a
+  couple of sweeps.
+*/
+        class Bits{
+        public:
+                Bits() = default;
+                explicit Bits(std::size_t size);
+
+                std::size_t size() const { return bits; }
+
+                bool test(std::size_t i) const { return words[i / 64] >> (i % 64) & 1; }
+                void set(std::size_t i) { words[i / 64] |= uint64_t(1) << (i % 64); }
+                void reset(std::size_t i) { words[i / 64] &= ~(uint64_t(1) << (i % 64)); }
+                void reset(std::size_t from, std::size_t to); // [from, to)
+                void clear();
+
+                // this |= other. True if that added anything.
+                bool unite(const Bits& other);
+
+                std::size_t count() const;
+                std::vector<uint32_t> ones() const;
+
+                bool operator==(const Bits& other) const { return words == other.words; }
+                bool operator!=(const Bits& other) const { return words != other.words; }
+
+        private:
+                std::size_t bits{0};
+                std::vector<uint64_t> words;
+        };
+
+        // Every var a function mentions (params first), numbered from 0
+        struct Var_Numbering{
+                static Var_Numbering of(const Function& fun);
+
+                uint32_t add(Symbol name);
+                // -1 if it isn't one
+                int64_t find(Symbol name) const;
+
+                std::size_t size() const { return names.size(); }
+
+                std::vector<Symbol> names;
+                std::unordered_map<Symbol, uint32_t> index;
+        };
+
+        // The var inst writes, nullptr if it doesn't
+        Var* defined_var(L3_ptr<Instruction> inst);
+
+        // f(Var*) for every var item reads, once per read. Runtime functions
+        // aren't vars.
+        template<typename F>
+        void for_each_use(ast_ptr item, F&& f){
+                if(auto var = node_cast<Var>(item)){
+                        if(!is_runtime_fun_name(var->name)){
+                                f(var);
+                        }
+                        return;
+                }
+                auto inst = node_cast<Instruction>(item);
+                if(!inst){
+                        return;
+                }
+                auto assign = node_cast<Assignment>(inst);
+                if(assign && is_one_of<Var>(assign->get_lhs())){
+                        for_each_use(assign->get_rhs(), f);
+                        return;
+                }
+                for(auto operand : inst->operands){
+                        for_each_use(operand, f);
+                }
+        }
+
+        enum class Direction{
+                forward,  // in is the union of the preds' outs
+                backward  // out is the union of the succs' ins
+        };
+
+        struct Gen_Kill{
+                std::vector<uint32_t> gen;
+                std::vector<std::pair<uint32_t, uint32_t>> kill; // [first, last) ranges
+
+                // gen | (from - kill), into to
+                void apply(const Bits& from, Bits& to) const;
+        };
+
+        struct Dataflow_Problem{
+                Direction direction;
+                std::size_t bits;
+                std::vector<Gen_Kill> blocks; // one per cfg block
+        };
+
+        struct Dataflow_Solution{
+                std::vector<Bits> in;  // at the top of each block
+                std::vector<Bits> out; // at the bottom
+                int64_t visits{0};     // blocks transferred, all told
+        };
+
+        Dataflow_Solution solve(const CFG& cfg, const Dataflow_Problem& problem);
+
+        // Which vars might still be read, at the edges of every block of
+        // cfg, which has to be fun's
+        struct Liveness{
+                static Liveness of(const Function& fun, const CFG& cfg);
+
+                Var_Numbering vars;
+                Dataflow_Solution flow;
+        };
+
+        // Which assignments to a var might be the last one done, at the edges
+        // of every block. Def d is instructions[def_at[d]], and var v's defs
+        // are d in [first_def[v], first_def[v + 1]). Params aren't defs.
+        struct Reaching_Definitions{
+                static Reaching_Definitions of(const Function& fun, const CFG& cfg);
+
+                Var_Numbering vars;
+                std::vector<uint32_t> def_at;
+                std::vector<uint32_t> first_def; // one per var, plus a sentinel
+                Dataflow_Solution flow;
+        };
+}
@@ -0,0 +1,350 @@
+#include <dce.h>
+#include <cfg.h>
+#include <dataflow.h>
+#include <unordered_set>
+#include <vector>
+
+#ifdef UNIT_TEST
+#include <catch.hpp>
+#include <ll_parser.h>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#endif
+
+using namespace L3;
+
+void DCE_Report::print(std::ostream& out) const{
+        print_totals(out, "dead code", "L3 instructions");
+        out << "  unreachable: " << unreachable << "\n"
+            << "  dead stores: " << dead_stores << "\n"
+            << "  dead assignments: " << dead_assignments << "\n"
+            << "  call results ignored: " << ignored_results << "\n"
+            << "  rounds: " << rounds << "\n";
+}
+
+namespace{
+        // Drops insts[i] wherever dead[i]
+        void compact(Function::Instructions& insts, const std::vector<bool>& dead){
+                std::size_t kept = 0;
+                for(std::size_t i = 0; i < insts.size(); i++){
+                        if(!dead[i]){
+                                insts[kept++] = insts[i];
+                        }
+                }
+                insts.resize(kept);
+        }
+
+        int64_t remove_unreachable(Function& fun){
+                auto& insts = fun.instructions;
+                std::vector<bool> dead(insts.size(), false);
+                int64_t removed = 0;
+
+                bool reachable = true;
+                for(std::size_t i = 0; i < insts.size(); i++){
+                        if(is_one_of<Label>(insts[i])){
+                                reachable = true;
+                        }
+                        if(!reachable){
+                                dead[i] = true;
+                                removed++;
+                        }
+                        if(is_one_of<Goto, Cjump, Val_Return, Void_Return>(insts[i])){
+                                reachable = false;
+                        }
+                }
+
+                if(removed){
+                        compact(insts, dead);
+                }
+                return removed;
+        }
+
+        // Bottom up through each block, remembering the addresses that get
+        // stored to further down with nothing able to read memory since
+        int64_t remove_dead_stores(Working_Copy& work){
+                auto& insts = work.body.instructions;
+                auto& cfg = work.cfg();
+                std::vector<bool> dead(insts.size(), false);
+                int64_t removed = 0;
+
+                std::unordered_set<Symbol> overwritten;
+                for(CFG::Block b = 0; b < cfg.size(); b++){
+                        overwritten.clear();
+                        for(auto i = cfg.end(b); i-- > cfg.begin(b);){
+                                auto inst = insts[i];
+                                auto assign = node_cast<Assignment>(inst);
+                                auto store = assign ? node_cast<Store>(assign->get_lhs()) : nullptr;
+                                if(store){
+                                        auto addr = node_cast<Var>(store->get_storee());
+                                        if(addr && !overwritten.insert(addr->name).second){
+                                                dead[i] = true;
+                                                removed++;
+                                        }
+                                        continue;
+                                }
+
+                                if(is_one_of<Call>(inst) || (assign && is_one_of<Call, Load>(assign->get_rhs()))){
+                                        overwritten.clear();
+                                } else if(auto def = defined_var(inst)){
+                                        overwritten.erase(def->name);
+                                }
+                        }
+                }
+
+                if(removed){
+                        compact(insts, dead);
+                }
+                return removed;
+        }
+
+        // Bottom up through each block from what's live at its end
+        void remove_dead_assignments(Working_Copy& work, int64_t& removed, int64_t& ignored){
+                auto& insts = work.body.instructions;
+                auto& cfg = work.cfg();
+                auto live = Liveness::of(work.body, cfg);
+                std::vector<bool> dead(insts.size(), false);
+                bool any_dead = false;
+
+                Bits now;
+                for(CFG::Block b = 0; b < cfg.size(); b++){
+                        now = live.flow.out[b];
+                        for(auto i = cfg.end(b); i-- > cfg.begin(b);){
+                                auto inst = insts[i];
+                                if(auto def = defined_var(inst)){
+                                        auto v = live.vars.index.at(def->name);
+                                        auto rhs = node_cast<Assignment>(inst)->get_rhs();
+                                        if(!now.test(v)){
+                                                if(auto call = node_cast<Call>(rhs)){
+                                                        // still has to happen
+                                                        inst = insts[i] = call;
+                                                        ignored++;
+                                                } else {
+                                                        dead[i] = any_dead = true;
+                                                        removed++;
+                                                        continue;
+                                                }
+                                        } else {
+                                                now.reset(v);
+                                        }
+                                }
+                                for_each_use(inst, [&](Var* var){ now.set(live.vars.index.at(var->name)); });
+                        }
+                }
+
+                if(any_dead){
+                        compact(insts, dead);
+                }
+        }
+}
+
+void L3::eliminate_dead_code(Working_Copy& work, DCE_Report* report){
+        auto& fun = work.body;
+        const int64_t before = fun.instructions.size();
+        int64_t unreachable = remove_unreachable(fun);
+        work.body_changed();
+
+        int64_t stores = 0;
+        int64_t assignments = 0;
+        int64_t ignored = 0;
+        int64_t rounds = 0;
+        for(bool again = true; again;){
+                rounds++;
+                auto was = fun.instructions.size();
+                auto was_ignored = ignored;
+
+                stores += remove_dead_stores(work);
+                work.body_changed();
+                remove_dead_assignments(work, assignments, ignored);
+                work.body_changed();
+
+                // A call that lost its assignment can make its args' defs dead
+                again = fun.instructions.size() != was || ignored != was_ignored;
+        }
+
+        if(report){
+                report->before += before;
+                report->after += fun.instructions.size();
+                report->unreachable += unreachable;
+                report->dead_stores += stores;
+                report->dead_assignments += assignments;
+                report->ignored_results += ignored;
+                report->rounds += rounds;
+        }
+}
+
+#ifdef UNIT_TEST
+namespace{
+        std::string cleaned(const std::string& src, DCE_Report* report = nullptr){
+                return dumped(src, [&](Working_Copy& work){ eliminate_dead_code(work, report); });
+        }
+}
+
+TEST_CASE("dead code goes"){
+        SECTION("nobody reads it"){
+                DCE_Report report;
+                REQUIRE(cleaned("define :f(a, p){\n"
+                                "  x <- a + 1\n"
+                                "  y <- x * 2\n"  // only for z
+                                "  z <- y + x\n"  // never read
+                                "  w <- load p\n"
+                                "  r <- call :f(a, p)\n"
+                                "  call print(a)\n"
+                                "  return a\n"
+                                "}\n", &report) ==
+                        dumped("define :f(a, p){\n"
+                               "  call :f(a, p)\n"
+                               "  call print(a)\n"
+                               "  return a\n"
+                               "}\n"));
+                REQUIRE(report.dead_assignments == 4);
+                REQUIRE(report.ignored_results == 1);
+                REQUIRE(report.after == 3);
+        }
+
+        SECTION("from the working copy, the parsed function keeps it"){
+                std::string src = "define :f(a){\n"
+                                  "  x <- a + 1\n"
+                                  "  return a\n"
+                                  "}\n";
+                Program p = ll_parse(src.data(), src.data() + src.size(), "test");
+                Working_Copy work{*p.functions[0]};
+                eliminate_dead_code(work);
+                REQUIRE(work.body.instructions.size() == 1);
+                REQUIRE(p.functions[0]->instructions.size() == 2);
+        }
+
+        SECTION("read around a loop is read"){
+                std::string src = "define :f(n){\n"
+                                  "  i <- 0\n"
+                                  "  s <- 0\n"
+                                  "  :top\n"
+                                  "  s <- s + i\n"
+                                  "  i <- i + 1\n"
+                                  "  c <- i < n\n"
+                                  "  br c :top :done\n"
+                                  "  :done\n"
+                                  "  return s\n"
+                                  "}\n";
+                REQUIRE(cleaned(src) == dumped(src));
+        }
+
+        SECTION("and one dead thing leads to the next"){
+                DCE_Report report;
+                REQUIRE(cleaned("define :f(a){\n"
+                                "  x <- a + 1\n"
+                                "  br a :yes :no\n"
+                                "  :yes\n"
+                                "  y <- x\n"
+                                "  :no\n"
+                                "  return a\n"
+                                "}\n", &report) ==
+                        dumped("define :f(a){\n"
+                               "  br a :yes :no\n"
+                               "  :yes\n"
+                               "  :no\n"
+                               "  return a\n"
+                               "}\n"));
+                REQUIRE(report.rounds == 3);
+        }
+
+        SECTION("nothing gets past a br or a return without a label"){
+                DCE_Report report;
+                REQUIRE(cleaned("define :f(a){\n"
+                                "  br :there\n"
+                                "  a <- 1\n"
+                                "  call print(a)\n"
+                                "  :there\n"
+                                "  br a :yes :no\n"
+                                "  return 2\n"
+                                "  :yes\n"
+                                "  return 1\n"
+                                "  call print(a)\n"
+                                "  :no\n"
+                                "  return 0\n"
+                                "  return 3\n"
+                                "}\n", &report) ==
+                        dumped("define :f(a){\n"
+                               "  br :there\n"
+                               "  :there\n"
+                               "  br a :yes :no\n"
+                               "  :yes\n"
+                               "  return 1\n"
+                               "  :no\n"
+                               "  return 0\n"
+                               "}\n"));
+                REQUIRE(report.unreachable == 5);
+        }
+}
+
+TEST_CASE("dead stores go"){
+        SECTION("stored over before anything looks"){
+                DCE_Report report;
+                REQUIRE(cleaned("define :f(p, q, a){\n"
+                                "  store p <- 1\n"  // dead
+                                "  store q <- 2\n"
+                                "  store p <- 3\n"  // dead
+                                "  store p <- a\n"
+                                "  return\n"
+                                "}\n", &report) ==
+                        dumped("define :f(p, q, a){\n"
+                               "  store q <- 2\n"
+                               "  store p <- a\n"
+                               "  return\n"
+                               "}\n"));
+                REQUIRE(report.dead_stores == 2);
+        }
+
+        SECTION("but not when something could look, or it's somewhere else"){
+                std::string src = "define :f(p, q){\n"
+                                  "  store p <- 1\n"
+                                  "  x <- load q\n"      // q might be p
+                                  "  store p <- x\n"
+                                  "  call print(x)\n"    // calls can look at anything
+                                  "  store p <- 2\n"
+                                  "  p <- p + 8\n"       // different place now
+                                  "  store p <- 3\n"
+                                  "  :l\n"               // and nobody knows who comes here
+                                  "  store p <- 4\n"
+                                  "  return\n"
+                                  "}\n";
+                REQUIRE(cleaned(src) == dumped(src));
+        }
+}
+
+TEST_CASE("dead code elimination on the bench programs", "[.][bench]"){
+        std::ostringstream src;
+        for(int f = 0; f < 2000; f++){
+                src << "define :f" << f << "(a, p){\n"
+                    << "  i <- 0\n"
+                    << "  unused <- a * 3\n"
+                    << "  :loop" << f << "\n"
+                    << "  t <- i * 8\n"
+                    << "  addr <- p + t\n"
+                    << "  store addr <- 0\n"
+                    << "  store addr <- a\n"
+                    << "  scratch <- t + unused\n"
+                    << "  i <- i + 1\n"
+                    << "  more <- i < 10\n"
+                    << "  br more :loop" << f << " :done" << f << "\n"
+                    << "  x <- 5\n"
+                    << "  :done" << f << "\n"
+                    << "  r <- call :f0(a, p)\n"
+                    << "  return p\n"
+                    << "}\n";
+        }
+        auto text = src.str();
+        Program p = ll_parse(text.data(), text.data() + text.size(), "bench");
+
+        DCE_Report report;
+        auto start = std::chrono::steady_clock::now();
+        for(auto& fun : p.functions){
+                Working_Copy work{*fun};
+                eliminate_dead_code(work, &report);
+        }
+        std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+
+        std::cout << "dead code eliminated in " << took.count() << " s\n";
+        report.print(std::cout);
+}
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <L3.h>
+#include <pass_report.h>
+#include <working_copy.h>
+
+#include <atomic>
+#include <ostream>
+
+namespace L3{
+
+/*
+  Dead code elimination on a working copy of a function's L3, before it
+  gets tiled. Three things go:
+
+    - anything after a br or a return that no label leads to
+    - a store to an address that gets stored to again before anything
+      could read it: no load and no call in between, and the address var
+      isn't set again. Only the exact same var counts as the same address.
+    - an assignment to a var that nobody reads afterwards (per liveness),
+      as long as the right hand side does nothing else. Calls stay, they
+      just lose the assignment.
+
+  Getting rid of one dead thing can make another one dead, so it goes
+  round until a round finds nothing. Each round is a liveness solve, see
+  dataflow.h. A var whose only reader is itself, round a loop, counts as
+  live.
+*/
+        // L3 instructions in and out, and why the missing ones went
+        struct DCE_Report :
+                public Pass_Report{
+                void print(std::ostream& out) const;
+
+                std::atomic<int64_t> unreachable{0};
+                std::atomic<int64_t> dead_stores{0};
+                std::atomic<int64_t> dead_assignments{0};
+                std::atomic<int64_t> ignored_results{0}; // calls that don't assign anymore
+                std::atomic<int64_t> rounds{0};
+        };
+
+        void eliminate_dead_code(Working_Copy& work, DCE_Report* report = nullptr);
+}
@@ -0,0 +1,418 @@
+#include <flat_function.h>
+#include <stdexcept>
+#include <unordered_map>
+
+#ifdef UNIT_TEST
+#include <catch.hpp>
+#include <ll_parser.h>
+#include <chrono>
+#include <iostream>
+#endif
+
+using namespace L3;
+
+namespace{
+        struct Flattener{
+                explicit Flattener(Flat_Function& f) : f(f) {}
+
+                void begin(Flat_Function::Op op, uint8_t binop = 0){
+                        f.ops.push_back(op);
+                        f.binops.push_back(binop);
+                        f.first_operand.push_back(f.kinds.size());
+                }
+
+                void name_operand(Flat_Function::Operand kind, Symbol name){
+                        auto it = index.find(name);
+                        if(it == index.end()){
+                                it = index.emplace(name, f.names.size()).first;
+                                f.names.push_back(name);
+                        }
+                        f.kinds.push_back(kind);
+                        f.values.push_back(it->second);
+                }
+
+                void operand(ast_ptr item){
+                        switch(item->kind){
+                        case Kind::var:
+                                name_operand(Flat_Function::Operand::var, node_cast<Var>(item)->name);
+                                break;
+                        case Kind::label:
+                                name_operand(Flat_Function::Operand::label, node_cast<Label>(item)->name);
+                                break;
+                        case Kind::int_literal:
+                                f.kinds.push_back(Flat_Function::Operand::number);
+                                f.values.push_back(f.numbers.size());
+                                f.numbers.push_back(node_cast<Int_Literal>(item)->val);
+                                break;
+                        default:
+                                throw std::logic_error("can't flatten a non-atom operand");
+                        }
+                }
+
+                void operands(const Instruction::Operands& items){
+                        for(auto item : items){
+                                operand(item);
+                        }
+                }
+
+                void instruction(Instruction* inst){
+                        using Op = Flat_Function::Op;
+
+                        switch(inst->kind){
+                        case Kind::assignment:{
+                                auto assgn = static_cast<Assignment*>(inst);
+                                auto lhs = assgn->get_lhs();
+                                auto rhs = assgn->get_rhs();
+
+                                if(auto store = node_cast<Store>(lhs)){
+                                        begin(Op::store);
+                                        operand(store->get_storee());
+                                        operand(rhs);
+                                } else if(auto load = node_cast<Load>(rhs)){
+                                        begin(Op::load);
+                                        operand(lhs);
+                                        operand(load->get_loadee());
+                                } else if(auto binop = node_cast<Binop>(rhs)){
+                                        begin(Op::binop, binop->op);
+                                        operand(lhs);
+                                        operand(binop->get_lhs());
+                                        operand(binop->get_rhs());
+                                } else if(auto call = node_cast<Call>(rhs)){
+                                        begin(Op::call_assign);
+                                        operand(lhs);
+                                        operands(call->operands);
+                                } else {
+                                        begin(Op::assign);
+                                        operand(lhs);
+                                        operand(rhs);
+                                }
+                                break;
+                        }
+                        case Kind::call:
+                                begin(Op::call);
+                                operands(inst->operands);
+                                break;
+                        case Kind::label:
+                                begin(Op::label);
+                                operand(inst);
+                                break;
+                        case Kind::goto_:
+                                begin(Op::goto_);
+                                operands(inst->operands);
+                                break;
+                        case Kind::cjump:
+                                begin(Op::cjump);
+                                operands(inst->operands);
+                                break;
+                        case Kind::val_return:
+                                begin(Op::val_return);
+                                operands(inst->operands);
+                                break;
+                        case Kind::void_return:
+                                begin(Op::void_return);
+                                break;
+                        default:
+                                throw std::logic_error("can't flatten that instruction");
+                        }
+                }
+
+                Flat_Function& f;
+                std::unordered_map<Symbol, uint32_t> index;
+        };
+}
+
+Flat_Function Flat_Function::flatten(Function& fun){
+        Flat_Function f;
+        f.name = fun.name.name;
+
+        f.params.reserve(fun.params.size());
+        for(auto& param : fun.params){
+                f.params.push_back(param.name);
+        }
+
+        f.ops.reserve(fun.instructions.size());
+        f.binops.reserve(fun.instructions.size());
+        f.first_operand.reserve(fun.instructions.size() + 1);
+        f.kinds.reserve(fun.instructions.size() * 3);
+        f.values.reserve(fun.instructions.size() * 3);
+
+        Flattener flattener{f};
+        for(auto inst : fun.instructions){
+                flattener.instruction(inst);
+        }
+        f.first_operand.push_back(f.kinds.size());
+
+        return f;
+}
+
+Program::fun_ptr Flat_Function::unflatten() const{
+        Program::fun_ptr fun{new Function{Label{name}}};
+        Arena_Scope scope{fun->arena};
+
+        for(auto param : params){
+                fun->params.push_back(Var{param});
+        }
+
+        auto atom = [this](uint32_t at) -> ast_ptr{
+                switch(kinds[at]){
+                case Operand::var:
+                        return make_AST<Var>(names[values[at]]);
+                case Operand::label:
+                        return make_AST<Label>(names[values[at]]);
+                default:
+                        return make_AST<Int_Literal>(numbers[values[at]]);
+                }
+        };
+        auto var = [&](uint32_t at){ return node_cast<Var>(atom(at)); };
+        auto label = [&](uint32_t at){ return node_cast<Label>(atom(at)); };
+        auto call = [&](uint32_t from, uint32_t to){
+                Instruction::Operands everything;
+                everything.reserve(to - from);
+                for(auto at = from; at < to; at++){
+                        everything.push_back(atom(at));
+                }
+                return make_node<Call>(std::move(everything));
+        };
+
+        auto& is = fun->instructions;
+        is.reserve(ops.size());
+
+        for(std::size_t i = 0; i < ops.size(); i++){
+                auto o = first_operand[i];
+
+                switch(ops[i]){
+                case Op::assign:
+                        is.push_back(make_node<Assignment>(atom(o), atom(o + 1)));
+                        break;
+                case Op::load:
+                        is.push_back(make_node<Assignment>(atom(o), make_AST<Load>(atom(o + 1))));
+                        break;
+                case Op::store:
+                        is.push_back(make_node<Assignment>(make_AST<Store>(atom(o)), atom(o + 1)));
+                        break;
+                case Op::binop:
+                        is.push_back(make_node<Assignment>(atom(o),
+                                                           make_AST<Binop>(static_cast<Binop::Op>(binops[i]),
+                                                                           atom(o + 1),
+                                                                           atom(o + 2))));
+                        break;
+                case Op::call:
+                        is.push_back(call(o, first_operand[i + 1]));
+                        break;
+                case Op::call_assign:
+                        is.push_back(make_node<Assignment>(atom(o), call(o + 1, first_operand[i + 1])));
+                        break;
+                case Op::label:
+                        is.push_back(label(o));
+                        break;
+                case Op::goto_:
+                        is.push_back(make_node<Goto>(label(o)));
+                        break;
+                case Op::cjump:
+                        is.push_back(make_node<Cjump>(var(o), label(o + 1), label(o + 2)));
+                        break;
+                case Op::val_return:
+                        is.push_back(make_node<Val_Return>(atom(o)));
+                        break;
+                case Op::void_return:
+                        is.push_back(make_node<Void_Return>());
+                        break;
+                }
+        }
+
+        return fun;
+}
+
+std::size_t Flat_Function::bytes_used() const{
+        return sizeof(*this)
+                + params.capacity() * sizeof(Symbol)
+                + ops.capacity() * sizeof(Op)
+                + binops.capacity() * sizeof(uint8_t)
+                + first_operand.capacity() * sizeof(uint32_t)
+                + kinds.capacity() * sizeof(Operand)
+                + values.capacity() * sizeof(uint32_t)
+                + names.capacity() * sizeof(Symbol)
+                + numbers.capacity() * sizeof(int64_t);
+}
+
+std::vector<bool> Flat_Function::label_names() const{
+        std::vector<bool> is_label(names.size(), false);
+        for(std::size_t at = 0; at < kinds.size(); at++){
+                if(kinds[at] == Operand::label){
+                        is_label[values[at]] = true;
+                }
+        }
+        return is_label;
+}
+
+std::unordered_set<Symbol> Flat_Function::grabber_of_the_vars() const{
+        std::vector<bool> is_var(names.size(), false);
+        for(std::size_t at = 0; at < kinds.size(); at++){
+                if(kinds[at] == Operand::var){
+                        is_var[values[at]] = true;
+                }
+        }
+
+        std::unordered_set<Symbol> vars;
+        for(std::size_t n = 0; n < names.size(); n++){
+                if(is_var[n] && !is_runtime_fun_name(names[n])){
+                        vars.insert(names[n]);
+                }
+        }
+        return vars;
+}
+
+std::unordered_set<std::string> Flat_Function::grabber_of_the_labels() const{
+        auto is_label = label_names();
+
+        std::unordered_set<std::string> labels;
+        labels.insert(name.str().substr(1));
+        for(std::size_t n = 0; n < names.size(); n++){
+                if(is_label[n]){
+                        labels.insert(names[n].str().substr(1));
+                }
+        }
+        return labels;
+}
+
+Label_Names Flat_Function::scoped_label_names(const std::string& fun_prefix,
+                                              const std::unordered_set<Symbol>& globally_scoped_names) const{
+        auto is_label = label_names();
+        auto super_fun_prefix = ":" + fun_prefix;
+
+        Label_Names scoped;
+        for(std::size_t n = 0; n < names.size(); n++){
+                if(is_label[n] && !globally_scoped_names.count(names[n])){
+                        scoped.rename(names[n], Symbol{super_fun_prefix + names[n].str().substr(1)});
+                }
+        }
+        return scoped;
+}
+
+#ifdef UNIT_TEST
+namespace{
+        std::string flat_test_src =
+                "define :main(a, b){\n"
+                "  x <- 5\n"
+                "  y <- x + -3\n"
+                "  z <- :lab\n"
+                "  :lab\n"
+                "  c <- x <= y\n"
+                "  br c :lab :out\n"
+                "  v <- load a\n"
+                "  store a <- v\n"
+                "  r <- call :f(x, 7)\n"
+                "  call print(r)\n"
+                "  br :out\n"
+                "  :out\n"
+                "  return r\n"
+                "}\n"
+                "\n"
+                "define :f(p, q){\n"
+                "  call array-error(p, q)\n"
+                "  return\n"
+                "}\n";
+
+        std::string dump(Program& p){
+                Dump v;
+                p.accept(v);
+                return v.result.str();
+        }
+}
+
+TEST_CASE("flat functions round trip"){
+        Program p = ll_parse(flat_test_src.data(),
+                             flat_test_src.data() + flat_test_src.size(),
+                             "test");
+
+        Program back;
+        for(auto& fun : p.functions){
+                back.functions.push_back(Flat_Function::flatten(*fun).unflatten());
+        }
+
+        REQUIRE(dump(back) == dump(p));
+}
+
+TEST_CASE("flat functions grab and scope names like the tree does"){
+        Program p = ll_parse(flat_test_src.data(),
+                             flat_test_src.data() + flat_test_src.size(),
+                             "test");
+        auto& main_fun = *p.functions[0];
+        auto flat = Flat_Function::flatten(main_fun);
+
+        REQUIRE(flat.size() == main_fun.instructions.size());
+        REQUIRE(flat.grabber_of_the_vars() == main_fun.grabber_of_the_vars());
+        REQUIRE(flat.grabber_of_the_labels() == main_fun.grabber_of_the_labels());
+
+        std::unordered_set<Symbol> gsns{Symbol{std::string(":main")},
+                                        Symbol{std::string(":f")}};
+        auto names = main_fun.scoped_label_names("z0_", gsns);
+        auto flat_names = flat.scoped_label_names("z0_", gsns);
+        REQUIRE(flat_names.size() == names.size());
+
+        Dump expected{&names};
+        main_fun.accept(expected);
+        Dump got{&flat_names};
+        flat.unflatten()->accept(got);
+
+        REQUIRE(got.result.str() == expected.result.str());
+
+        // and the flat function still has the names it was parsed with
+        Dump unscoped;
+        main_fun.accept(unscoped);
+        Dump flat_unscoped;
+        flat.unflatten()->accept(flat_unscoped);
+        REQUIRE(flat_unscoped.result.str() == unscoped.result.str());
+}
+
+TEST_CASE("flat vs tree walks", "[.][bench]"){
+        std::string src;
+        src += "define :big(a, b, c){\n";
+        for(int i = 0; i < 100000; i++){
+                auto n = std::to_string(i);
+                src += "  :l" + n + "\n"
+                        + "  i" + n + " <- a + " + n + "\n"
+                        + "  v" + n + " <- load b\n"
+                        + "  store b <- i" + n + "\n"
+                        + "  br c :l" + n + " :l0\n";
+        }
+        src += "  return a\n}\n";
+
+        Program p = ll_parse(src.data(), src.data() + src.size(), "bench");
+        auto& fun = *p.functions[0];
+        auto flat = Flat_Function::flatten(fun);
+
+        auto time_it = [](std::function<std::size_t()> walk){
+                auto start = std::chrono::steady_clock::now();
+                auto found = walk();
+                std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+                REQUIRE(found > 0);
+                return took.count();
+        };
+
+        // the arena plus every operand vector hanging off it
+        std::function<std::size_t(ast_ptr)> operand_bytes = [&](ast_ptr item) -> std::size_t{
+                auto inst = node_cast<Instruction>(item);
+                if(!inst){
+                        return 0;
+                }
+                std::size_t bytes = inst->operands.capacity() * sizeof(ast_ptr);
+                for(auto child : inst->operands){
+                        bytes += operand_bytes(child);
+                }
+                return bytes;
+        };
+        std::size_t tree_bytes = fun.arena.bytes_reserved()
+                + fun.instructions.capacity() * sizeof(ast_ptr);
+        for(auto inst : fun.instructions){
+                tree_bytes += operand_bytes(inst);
+        }
+
+        std::cout << "tree: " << tree_bytes / fun.instructions.size()
+                  << " bytes per instruction, var walk "
+                  << time_it([&](){ return fun.grabber_of_the_vars().size(); }) << " s\n";
+        std::cout << "flat: " << flat.bytes_used() / flat.size()
+                  << " bytes per instruction, var walk "
+                  << time_it([&](){ return flat.grabber_of_the_vars().size(); }) << " s\n";
+}
+#endif
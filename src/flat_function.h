@@ -0,0 +1,88 @@
+#pragma once
+
+#include <L3.h>
+
+#include <stdint.h>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace L3{
+
+/*
+  A Function body packed into parallel arrays instead of a tree of nodes.
+  Instruction i is ops[i] with operands [first_operand[i], first_operand[i+1]);
+  each operand is a kind plus an index into names or numbers. Walks that only
+  care about names (the grabbers, label scoping) are straight scans over
+  kinds/values, and scoping a label is one entry in the side table no matter
+  how often it's used.
+
+  Operand order per op:
+    assign       x s
+    load         x y            (x <- load y)
+    store        x s            (store x <- s)
+    binop        x t t          op in binops[i]
+    call         callee t...
+    call_assign  x callee t...
+    label        :l
+    goto_        :l
+    cjump        x :t :f
+    val_return   t
+    void_return
+*/
+        struct Flat_Function{
+                enum class Op : uint8_t{
+                        assign,
+                        load,
+                        store,
+                        binop,
+                        call,
+                        call_assign,
+                        label,
+                        goto_,
+                        cjump,
+                        val_return,
+                        void_return
+                };
+
+                enum class Operand : uint8_t{
+                        var,
+                        label,
+                        number
+                };
+
+                static Flat_Function flatten(Function& fun);
+
+                // Back to nodes, allocated in the new function's own arena
+                Program::fun_ptr unflatten() const;
+
+                std::size_t size() const { return ops.size(); }
+                std::size_t bytes_used() const;
+
+                // Same answers as the Function versions, names is left alone
+                std::unordered_set<Symbol> grabber_of_the_vars() const;
+                std::unordered_set<std::string> grabber_of_the_labels() const;
+                Label_Names scoped_label_names(const std::string& fun_prefix,
+                                               const std::unordered_set<Symbol>& globally_scoped_names) const;
+
+                Symbol name; // colon included
+                std::vector<Symbol> params;
+
+                // one per instruction, plus a sentinel in first_operand
+                std::vector<Op> ops;
+                std::vector<uint8_t> binops; // a Binop::Op, only meaningful for Op::binop
+                std::vector<uint32_t> first_operand;
+
+                // one per operand
+                std::vector<Operand> kinds;
+                std::vector<uint32_t> values;
+
+                // side tables. Every distinct name is in here once.
+                std::vector<Symbol> names;
+                std::vector<int64_t> numbers;
+
+        private:
+                // which entries of names are used as labels
+                std::vector<bool> label_names() const;
+        };
+}
@@ -0,0 +1,452 @@
+#include <l2.h>
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+#ifdef UNIT_TEST
+#include <catch.hpp>
+#endif
+
+using namespace L3;
+
+///////////////////////////////////////////////////////////////////////////////
+//                                 Operands                                  //
+///////////////////////////////////////////////////////////////////////////////
+
+L2_Operand L2_Operand::var(Symbol name){
+        L2_Operand it;
+        it.kind = Kind::name;
+        it.name = name;
+        return it;
+}
+
+L2_Operand L2_Operand::label(Symbol label){
+        L2_Operand it;
+        it.kind = Kind::label;
+        it.name = label;
+        return it;
+}
+
+L2_Operand L2_Operand::number(int64_t num){
+        L2_Operand it;
+        it.kind = Kind::num;
+        it.num = num;
+        return it;
+}
+
+L2_Operand L2_Operand::mem(Symbol base, int64_t offset){
+        L2_Operand it;
+        it.kind = Kind::mem;
+        it.name = base;
+        it.num = offset;
+        return it;
+}
+
+L2_Operand L2_Operand::of(ast_ptr atom, const Label_Names* labels){
+        switch(atom->kind){
+        case(L3::Kind::var):
+                return var(static_cast<Var*>(atom)->name);
+        case(L3::Kind::label):{
+                auto name = static_cast<L3::Label*>(atom)->name;
+                return label(labels ? (*labels)(name) : name);
+        }
+        case(L3::Kind::int_literal):
+                return number(static_cast<Int_Literal*>(atom)->val);
+        case(L3::Kind::runtime_fun):{
+                static const Symbol names[] = {Symbol{std::string("print")},
+                                               Symbol{std::string("allocate")},
+                                               Symbol{std::string("array-error")}};
+                return var(names[static_cast<Runtime_Fun*>(atom)->fun]);
+        }
+        default:
+                throw std::logic_error("that's not an atom");
+        }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                               Instructions                                //
+///////////////////////////////////////////////////////////////////////////////
+
+namespace{
+        L2_Inst make(L2_Inst::Op op){
+                L2_Inst inst;
+                inst.op = op;
+                return inst;
+        }
+
+        // L2 only knows <, <= and =, so a > b goes out as b < a
+        void flip_greater(L2_Inst& inst){
+                if(inst.how == Binop::ge || inst.how == Binop::geq){
+                        inst.how = inst.how == Binop::ge ? Binop::le : Binop::leq;
+                        std::swap(inst.x, inst.y);
+                }
+        }
+}
+
+L2_Inst L2_Inst::move(L2_Operand dst, L2_Operand x){
+        auto inst = make(Op::move);
+        inst.dst = dst;
+        inst.x = x;
+        return inst;
+}
+
+L2_Inst L2_Inst::arith(L2_Operand dst, Binop::Op how, L2_Operand x){
+        auto inst = make(Op::arith);
+        inst.dst = dst;
+        inst.how = how;
+        inst.x = x;
+        return inst;
+}
+
+L2_Inst L2_Inst::compare(L2_Operand dst, L2_Operand x, Binop::Op how, L2_Operand y){
+        auto inst = make(Op::compare);
+        inst.dst = dst;
+        inst.x = x;
+        inst.how = how;
+        inst.y = y;
+        flip_greater(inst);
+        return inst;
+}
+
+L2_Inst L2_Inst::cjump(L2_Operand x, Binop::Op how, L2_Operand y, Symbol t, Symbol f){
+        auto inst = make(Op::cjump);
+        inst.x = x;
+        inst.how = how;
+        inst.y = y;
+        inst.t = t;
+        inst.f = f;
+        flip_greater(inst);
+        return inst;
+}
+
+L2_Inst L2_Inst::label(Symbol t){
+        auto inst = make(Op::label);
+        inst.t = t;
+        return inst;
+}
+
+L2_Inst L2_Inst::goto_(Symbol t){
+        auto inst = make(Op::goto_);
+        inst.t = t;
+        return inst;
+}
+
+L2_Inst L2_Inst::call(L2_Operand callee, int64_t args){
+        auto inst = make(Op::call);
+        inst.x = callee;
+        inst.n = args;
+        return inst;
+}
+
+L2_Inst L2_Inst::return_(){
+        return make(Op::return_);
+}
+
+L2_Inst L2_Inst::inc(L2_Operand dst){
+        auto inst = make(Op::inc);
+        inst.dst = dst;
+        return inst;
+}
+
+L2_Inst L2_Inst::dec(L2_Operand dst){
+        auto inst = make(Op::dec);
+        inst.dst = dst;
+        return inst;
+}
+
+L2_Inst L2_Inst::lea(L2_Operand dst, L2_Operand base, L2_Operand index, int64_t scale){
+        auto inst = make(Op::lea);
+        inst.dst = dst;
+        inst.x = base;
+        inst.y = index;
+        inst.n = scale;
+        return inst;
+}
+
+bool L2_Inst::reads(Symbol name) const{
+        switch(op){
+        case(Op::move):
+                return x.mentions(name) || (dst.kind == L2_Operand::Kind::mem && dst.name == name);
+        case(Op::arith):
+        case(Op::inc):
+        case(Op::dec):
+                return dst.mentions(name) || x.mentions(name);
+        case(Op::compare):
+        case(Op::cjump):
+        case(Op::lea):
+                return x.mentions(name) || y.mentions(name);
+        case(Op::call):
+        case(Op::return_):
+                return true;
+        case(Op::label):
+        case(Op::goto_):
+                return false;
+        }
+        return true;
+}
+
+bool L2_Inst::writes(Symbol name) const{
+        switch(op){
+        case(Op::move):
+        case(Op::arith):
+        case(Op::compare):
+        case(Op::inc):
+        case(Op::dec):
+        case(Op::lea):
+                return dst.is_name(name);
+        case(Op::call):
+                return true;
+        case(Op::cjump):
+        case(Op::label):
+        case(Op::goto_):
+        case(Op::return_):
+                return false;
+        }
+        return true;
+}
+
+void L3::parallel_move(std::vector<L2_Move> moves, Symbol spare, L2_Insts& out){
+        moves.erase(std::remove_if(moves.begin(), moves.end(),
+                                   [](const L2_Move& move){ return move.dst == move.src; }),
+                    moves.end());
+
+        auto still_read = [&](const L2_Operand& dst, std::size_t except){
+                if(dst.kind != L2_Operand::Kind::name){
+                        return false;
+                }
+                for(std::size_t j = 0; j < moves.size(); j++){
+                        if(j != except && moves[j].src.mentions(dst.name)){
+                                return true;
+                        }
+                }
+                return false;
+        };
+
+        while(!moves.empty()){
+                bool moved = false;
+                for(std::size_t i = 0; i < moves.size(); i++){
+                        if(!still_read(moves[i].dst, i)){
+                                out.push_back(L2_Inst::move(moves[i].dst, moves[i].src));
+                                moves.erase(moves.begin() + i);
+                                moved = true;
+                                break;
+                        }
+                }
+                if(moved){
+                        continue;
+                }
+
+                // Every dst left is somebody's src, so what's left is
+                // cycles. Park one dst in spare and that cycle opens up.
+                auto parked = moves.front().dst;
+                out.push_back(L2_Inst::move(L2_Operand::var(spare), parked));
+                for(auto& move : moves){
+                        if(move.src == parked){
+                                move.src = L2_Operand::var(spare);
+                        }
+                }
+        }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                  Printing                                 //
+///////////////////////////////////////////////////////////////////////////////
+
+const char* L3::l2_op(Binop::Op how){
+        switch(how){
+        case(Binop::plus):        return "+";
+        case(Binop::mult):        return "*";
+        case(Binop::minus):       return "-";
+        case(Binop::and_):        return "&";
+        case(Binop::left_shift):  return "<<";
+        case(Binop::right_shift): return ">>";
+        case(Binop::le):          return "<";
+        case(Binop::leq):         return "<=";
+        case(Binop::eq):          return "=";
+        case(Binop::ge):          return ">";
+        case(Binop::geq):         return ">=";
+        }
+        throw std::logic_error("That's not an operator dude");
+}
+
+bool L3::is_comparison(Binop::Op how){
+        switch(how){
+        case(Binop::le):
+        case(Binop::leq):
+        case(Binop::eq):
+        case(Binop::ge):
+        case(Binop::geq):
+                return true;
+        default:
+                return false;
+        }
+}
+
+int64_t L3::evaluate(Binop::Op how, int64_t a, int64_t b){
+        auto ua = uint64_t(a);
+        auto ub = uint64_t(b);
+        switch(how){
+        case(Binop::plus):        return int64_t(ua + ub);
+        case(Binop::minus):       return int64_t(ua - ub);
+        case(Binop::mult):        return int64_t(ua * ub);
+        case(Binop::and_):        return int64_t(ua & ub);
+        case(Binop::left_shift):  return int64_t(ua << (ub & 63));
+        case(Binop::right_shift): return a >> (ub & 63);
+        case(Binop::le):          return a < b;
+        case(Binop::leq):         return a <= b;
+        case(Binop::eq):          return a == b;
+        case(Binop::ge):          return a > b;
+        case(Binop::geq):         return a >= b;
+        }
+        throw std::logic_error("That's not an operator dude");
+}
+
+L2_Out& L3::operator<<(L2_Out& out, const L2_Operand& operand){
+        switch(operand.kind){
+        case(L2_Operand::Kind::name):
+        case(L2_Operand::Kind::label):
+                return out << operand.name;
+        case(L2_Operand::Kind::num):
+                return out << operand.num;
+        case(L2_Operand::Kind::mem):
+                return out << "(mem " << operand.name << ' ' << operand.num << ')';
+        case(L2_Operand::Kind::none):
+                break;
+        }
+        throw std::logic_error("printing an operand that isn't there");
+}
+
+L2_Out& L3::operator<<(L2_Out& out, const L2_Inst& inst){
+        using Op = L2_Inst::Op;
+        switch(inst.op){
+        case(Op::move):
+                return out << '(' << inst.dst << " <- " << inst.x << ")\n";
+        case(Op::arith):
+                return out << '(' << inst.dst << ' ' << l2_op(inst.how) << "= " << inst.x << ")\n";
+        case(Op::compare):
+                return out << '(' << inst.dst << " <- " << inst.x << ' ' << l2_op(inst.how) << ' ' << inst.y << ")\n";
+        case(Op::cjump):
+                return out << "(cjump " << inst.x << ' ' << l2_op(inst.how) << ' ' << inst.y << ' '
+                           << inst.t << ' ' << inst.f << ")\n";
+        case(Op::label):
+                return out << inst.t << '\n';
+        case(Op::goto_):
+                return out << "(goto " << inst.t << ")\n";
+        case(Op::call):
+                return out << "(call " << inst.x << ' ' << inst.n << ")\n";
+        case(Op::return_):
+                return out << "(return)\n";
+        case(Op::inc):
+                return out << '(' << inst.dst << "++)\n";
+        case(Op::dec):
+                return out << '(' << inst.dst << "--)\n";
+        case(Op::lea):
+                return out << '(' << inst.dst << " @ " << inst.x << ' ' << inst.y << ' ' << inst.n << ")\n";
+        }
+        throw std::logic_error("no such L2 instruction");
+}
+
+void L3::print(const L2_Insts& insts, L2_Out& out){
+        for(auto& inst : insts){
+                out << inst;
+        }
+}
+
+#ifdef UNIT_TEST
+TEST_CASE("L2 instructions print the way L2 wants them"){
+        auto x = L2_Operand::var(Symbol{std::string("x")});
+        auto p = Symbol{std::string("p")};
+        auto t = Symbol{std::string(":t")};
+        auto f = Symbol{std::string(":f")};
+
+        L2_Insts insts{
+                L2_Inst::move(x, L2_Operand::mem(p, 16)),
+                L2_Inst::move(L2_Operand::mem(p, -8), L2_Operand::label(t)),
+                L2_Inst::arith(x, Binop::left_shift, L2_Operand::number(3)),
+                L2_Inst::compare(x, L2_Operand::number(-1), Binop::leq, x),
+                L2_Inst::cjump(x, Binop::eq, L2_Operand::number(0), t, f),
+                L2_Inst::label(t),
+                L2_Inst::goto_(f),
+                L2_Inst::call(L2_Operand::var(Symbol{std::string("print")}), 1),
+                L2_Inst::inc(x),
+                L2_Inst::dec(x),
+                L2_Inst::lea(x, x, L2_Operand::var(p), 8),
+                L2_Inst::return_()
+        };
+
+        L2_Out out;
+        print(insts, out);
+        REQUIRE(out.str() ==
+                "(x <- (mem p 16))\n"
+                "((mem p -8) <- :t)\n"
+                "(x <<= 3)\n"
+                "(x <- -1 <= x)\n"
+                "(cjump x = 0 :t :f)\n"
+                ":t\n"
+                "(goto :f)\n"
+                "(call print 1)\n"
+                "(x++)\n"
+                "(x--)\n"
+                "(x @ x p 8)\n"
+                "(return)\n");
+
+        REQUIRE(insts[0].reads(p));
+        REQUIRE(insts[1].reads(p));
+        REQUIRE_FALSE(insts[1].writes(p));
+        REQUIRE(insts[2].writes(x.name));
+        REQUIRE_FALSE(insts[4].writes(x.name));
+        REQUIRE(insts[7].writes(x.name));
+}
+
+TEST_CASE("parallel moves"){
+        auto name = [](const char* n){ return L2_Operand::var(Symbol{std::string(n)}); };
+        auto spare = Symbol{std::string("rax")};
+        auto moved = [&](std::vector<L2_Move> moves){
+                L2_Insts insts;
+                parallel_move(moves, spare, insts);
+                L2_Out out;
+                print(insts, out);
+                return out.str();
+        };
+
+        SECTION("nothing in the way is just the moves"){
+                REQUIRE(moved({{name("rdi"), name("a")}, {name("rsi"), L2_Operand::number(5)}}) ==
+                        "(rdi <- a)\n"
+                        "(rsi <- 5)\n");
+        }
+
+        SECTION("reads go before the writes that would clobber them"){
+                REQUIRE(moved({{name("rdi"), name("rsi")}, {name("rsi"), name("rdx")}, {name("rdx"), name("rdx")}}) ==
+                        "(rdi <- rsi)\n"
+                        "(rsi <- rdx)\n");
+                REQUIRE(moved({{name("rsi"), name("rdi")}, {name("rdi"), name("x")},
+                               {L2_Operand::mem(Symbol{std::string("rsp")}, -16), name("rdi")}}) ==
+                        "(rsi <- rdi)\n"
+                        "((mem rsp -16) <- rdi)\n"
+                        "(rdi <- x)\n");
+        }
+
+        SECTION("a cycle goes through the spare once"){
+                REQUIRE(moved({{name("rdi"), name("rsi")}, {name("rsi"), name("rdx")},
+                               {name("rdx"), name("rdi")}, {name("rcx"), name("rdi")}}) ==
+                        "(rcx <- rdi)\n"
+                        "(rax <- rdi)\n"
+                        "(rdi <- rsi)\n"
+                        "(rsi <- rdx)\n"
+                        "(rdx <- rax)\n");
+        }
+}
+
+TEST_CASE("greater comparisons come out flipped"){
+        auto x = L2_Operand::var(Symbol{std::string("x")});
+        auto t = Symbol{std::string(":t")};
+        auto f = Symbol{std::string(":f")};
+
+        L2_Out out;
+        out << L2_Inst::compare(x, x, Binop::ge, L2_Operand::number(3))
+            << L2_Inst::cjump(L2_Operand::number(3), Binop::geq, x, t, f);
+        REQUIRE(out.str() ==
+                "(x <- 3 < x)\n"
+                "(cjump x <= 3 :t :f)\n");
+}
+#endif
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <L3.h>
+#include <l2_out.h>
+
+#include <stdint.h>
+#include <vector>
+
+namespace L3{
+
+/*
+  L2 instructions as data, so passes can look at what the tiles produced
+  before it turns into text. No strings anywhere: names are Symbols and
+  numbers are numbers. Only the body of a function goes through here, the
+  header and the param moves are written straight out.
+*/
+        struct L2_Operand{
+                enum class Kind : uint8_t{
+                        none,
+                        name,  // a var or a register
+                        label,
+                        num,
+                        mem    // (mem name num)
+                };
+
+                Kind kind{Kind::none};
+                Symbol name;
+                int64_t num{0};
+
+                static L2_Operand var(Symbol name);
+                static L2_Operand label(Symbol label);
+                static L2_Operand number(int64_t num);
+                static L2_Operand mem(Symbol base, int64_t offset);
+
+                // An L3 Var, Label or Int_Literal. Labels go through the
+                // renames when there are any.
+                static L2_Operand of(ast_ptr atom, const Label_Names* labels = nullptr);
+
+                bool is_name(Symbol which) const { return kind == Kind::name && name == which; }
+
+                // Does reading this operand read which? (mem x M) reads x.
+                bool mentions(Symbol which) const{
+                        return (kind == Kind::name || kind == Kind::mem) && name == which;
+                }
+
+                bool operator==(const L2_Operand& other) const{
+                        return kind == other.kind && name == other.name && num == other.num;
+                }
+                bool operator!=(const L2_Operand& other) const { return !(*this == other); }
+        };
+
+        struct L2_Inst{
+                enum class Op : uint8_t{
+                        move,    // (dst <- x)
+                        arith,   // (dst how= x)
+                        compare, // (dst <- x how y)
+                        cjump,   // (cjump x how y :t :f)
+                        label,   // :t
+                        goto_,   // (goto :t)
+                        call,    // (call x n)
+                        return_, // (return)
+                        inc,     // (dst++)
+                        dec,     // (dst--)
+                        lea      // (dst @ x y n)
+                };
+
+                Op op;
+                Binop::Op how{Binop::plus};
+                L2_Operand dst;
+                L2_Operand x;
+                L2_Operand y;
+                Symbol t;
+                Symbol f;
+                int64_t n{0};
+
+                static L2_Inst move(L2_Operand dst, L2_Operand x);
+                static L2_Inst arith(L2_Operand dst, Binop::Op how, L2_Operand x);
+                // > and >= get turned around into < and <=
+                static L2_Inst compare(L2_Operand dst, L2_Operand x, Binop::Op how, L2_Operand y);
+                static L2_Inst cjump(L2_Operand x, Binop::Op how, L2_Operand y, Symbol t, Symbol f);
+                static L2_Inst label(Symbol t);
+                static L2_Inst goto_(Symbol t);
+                static L2_Inst call(L2_Operand callee, int64_t args);
+                static L2_Inst return_();
+                static L2_Inst inc(L2_Operand dst);
+                static L2_Inst dec(L2_Operand dst);
+                static L2_Inst lea(L2_Operand dst, L2_Operand base, L2_Operand index, int64_t scale);
+
+                // Whether running this could read or change name. Memory
+                // doesn't count, calls read and clobber everything.
+                bool reads(Symbol name) const;
+                bool writes(Symbol name) const;
+        };
+
+        using L2_Insts = std::vector<L2_Inst>;
+
+        // One (dst <- src) out of a bunch that should all happen at once
+        struct L2_Move{
+                L2_Operand dst;
+                L2_Operand src;
+        };
+
+        // The moves in an order where every src gets read before its var is
+        // overwritten, in as few moves as that takes: one each, plus one
+        // through spare for every cycle (like rdi and rsi trading places).
+        // Sources can't be mem, and spare can't be any of the dsts or srcs.
+        void parallel_move(std::vector<L2_Move> moves, Symbol spare, L2_Insts& out);
+
+        // "+", "<=", ...
+        const char* l2_op(Binop::Op how);
+
+        // <, <=, =, > or >=
+        bool is_comparison(Binop::Op how);
+
+        // a how b the way the CPU does it: wrapping at 64 bits, shifts only
+        // looking at the low 6 bits of the count, comparisons giving 0 or 1
+        int64_t evaluate(Binop::Op how, int64_t a, int64_t b);
+
+        L2_Out& operator<<(L2_Out& out, const L2_Operand& operand);
+        L2_Out& operator<<(L2_Out& out, const L2_Inst& inst); // with the newline
+
+        void print(const L2_Insts& insts, L2_Out& out);
+}
@@ -0,0 +1,285 @@
+#include <l2_out.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef UNIT_TEST
+#include <catch.hpp>
+#include <ll_parser.h>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#endif
+
+using namespace L3;
+
+namespace{
+        const char digit_pairs[] =
+                "00010203040506070809"
+                "10111213141516171819"
+                "20212223242526272829"
+                "30313233343536373839"
+                "40414243444546474849"
+                "50515253545556575859"
+                "60616263646566676869"
+                "70717273747576777879"
+                "80818283848586878889"
+                "90919293949596979899";
+}
+
+char* L3::format_int(char* first, int64_t num){
+        // Negate in unsigned so INT64_MIN works
+        uint64_t left = num < 0 ? 0 - uint64_t(num) : uint64_t(num);
+        if(num < 0){
+                *first++ = '-';
+        }
+
+        char digits[20];
+        char* at = digits + sizeof(digits);
+        while(left >= 100){
+                auto pair = (left % 100) * 2;
+                left /= 100;
+                *--at = digit_pairs[pair + 1];
+                *--at = digit_pairs[pair];
+        }
+        if(left >= 10){
+                *--at = digit_pairs[left * 2 + 1];
+                *--at = digit_pairs[left * 2];
+        } else {
+                *--at = char('0' + left);
+        }
+
+        auto len = digits + sizeof(digits) - at;
+        std::memcpy(first, at, len);
+        return first + len;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                   L2_Out                                  //
+///////////////////////////////////////////////////////////////////////////////
+
+char* L2_Out::grab(std::size_t len){
+        if(used + len > buf.size()){
+                buf.resize(std::max(buf.size() * 2, std::max<std::size_t>(used + len, 4096)));
+        }
+        auto at = buf.data() + used;
+        used += len;
+        return at;
+}
+
+void L2_Out::append(const char* text, std::size_t len){
+        std::memcpy(grab(len), text, len);
+}
+
+L2_Out& L2_Out::operator<<(const char* text){
+        append(text, std::strlen(text));
+        return *this;
+}
+
+L2_Out& L2_Out::operator<<(const std::string& text){
+        append(text.data(), text.size());
+        return *this;
+}
+
+L2_Out& L2_Out::operator<<(char c){
+        *grab(1) = c;
+        return *this;
+}
+
+L2_Out& L2_Out::operator<<(Symbol name){
+        return *this << name.str();
+}
+
+L2_Out& L2_Out::operator<<(long long num){
+        auto at = grab(20);
+        used -= 20 - (format_int(at, num) - at);
+        return *this;
+}
+
+void L2_Out::atom(ast_ptr item, const Label_Names* labels){
+        switch(item->kind){
+        case(Kind::var):
+                *this << static_cast<Var*>(item)->name;
+                break;
+        case(Kind::label):{
+                auto name = static_cast<L3::Label*>(item)->name;
+                *this << (labels ? (*labels)(name) : name);
+                break;
+        }
+        case(Kind::int_literal):
+                *this << static_cast<Int_Literal*>(item)->val;
+                break;
+        case(Kind::runtime_fun):
+                break; // Dump has never printed these either
+        default:
+                throw std::logic_error("that's not an atom");
+        }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                  L2_File                                  //
+///////////////////////////////////////////////////////////////////////////////
+
+L2_File::L2_File(const std::string& filename) :
+        file(filename, std::ios::binary),
+        filename(filename)
+{
+        if(!file){
+                throw std::runtime_error("can't open " + filename);
+        }
+        pending.reserve(chunk);
+}
+
+L2_File::~L2_File(){
+        try{
+                flush();
+        } catch(...){
+                // nowhere to report it from here, call flush() first to hear about it
+        }
+}
+
+void L2_File::write(const L2_Out& out){
+        write(out.data(), out.size());
+}
+
+void L2_File::write(const char* text, std::size_t len){
+        if(pending.size() + len > chunk){
+                flush();
+        }
+
+        // Anything as big as a whole chunk goes out as it is
+        if(len >= chunk){
+                if(!file.write(text, len)){
+                        throw std::runtime_error("can't write " + filename);
+                }
+                return;
+        }
+        pending.insert(pending.end(), text, text + len);
+}
+
+void L2_File::flush(){
+        if(!pending.empty()){
+                if(!file.write(pending.data(), pending.size())){
+                        throw std::runtime_error("can't write " + filename);
+                }
+                pending.clear();
+        }
+        if(!file.flush()){
+                throw std::runtime_error("can't write " + filename);
+        }
+}
+
+#ifdef UNIT_TEST
+TEST_CASE("ints come out the way streams would print them"){
+        for(int64_t num : {int64_t{0}, int64_t{7}, int64_t{-7}, int64_t{10}, int64_t{99},
+                           int64_t{100}, int64_t{-16}, int64_t{123456789},
+                           std::numeric_limits<int64_t>::max(),
+                           std::numeric_limits<int64_t>::min()}){
+                std::stringstream ss;
+                ss << num;
+
+                L2_Out out;
+                out << num;
+                REQUIRE(out.str() == ss.str());
+        }
+}
+
+TEST_CASE("an L2_Out holds what got put in it"){
+        L3::Label_Names names;
+        names.rename(Symbol{std::string(":loop")}, Symbol{std::string(":z0_loop")});
+
+        L3::Var x{"x"};
+        L3::Label loop{":loop"};
+        L3::Int_Literal eight{8};
+
+        L2_Out out;
+        out << "(";
+        out.atom(&x, &names);
+        out << " <- ";
+        out.atom(&eight, &names);
+        out << ")\n(goto ";
+        out.atom(&loop, &names);
+        out << ')' << '\n';
+        out.atom(&loop);
+        REQUIRE(out.str() == "(x <- 8)\n(goto :z0_loop)\n:loop");
+
+        out.clear();
+        std::string big(10000, 'a');
+        out << big << int64_t{-1};
+        REQUIRE(out.str() == big + "-1");
+}
+
+TEST_CASE("an L2_File gets everything, big and small"){
+        std::string path{"/tmp/L3_l2_out_test.L2"};
+        std::string expected;
+        {
+                L2_File file{path};
+                L2_Out out;
+                for(int i = 0; i < 5000; i++){
+                        out.clear();
+                        out << "(x <- " << i << ")\n";
+                        file.write(out);
+                        expected += out.str();
+                }
+                std::string big(3 * L2_File::chunk, 'b');
+                file.write(big.data(), big.size());
+                file.write("\n)\n", 3);
+                expected += big + "\n)\n";
+        }
+        REQUIRE(slurp_file(path) == expected);
+        std::remove(path.c_str());
+
+        REQUIRE_THROWS_AS(L2_File{"/no/such/dir/prog.L2"}, std::runtime_error);
+}
+
+TEST_CASE("L2 emission throughput", "[.][bench]"){
+        std::string src;
+        for(int f = 0; f < 5000; f++){
+                auto n = std::to_string(f);
+                src += "define :f" + n + "(a, b, p){\n"
+                        "  :top\n"
+                        "  t1 <- a + b\n"
+                        "  t2 <- t1 * 8\n"
+                        "  t3 <- p + t2\n"
+                        "  v <- load t3\n"
+                        "  w <- v + 1\n"
+                        "  store t3 <- w\n"
+                        "  a <- a - 1\n"
+                        "  c <- 0 < a\n"
+                        "  br c :top :out\n"
+                        "  :out\n"
+                        "  s <- b - a\n"
+                        "  call print(s)\n"
+                        "  r <- call :f0(a, b, p)\n"
+                        "  r <- r + 123456\n"
+                        "  return r\n"
+                        "}\n";
+        }
+        Program p = ll_parse(src.data(), src.data() + src.size(), "bench");
+        std::string path{"/tmp/L3_l2_out_bench.L2"};
+
+        for(auto tiling : {Tiling::munch, Tiling::dp}){
+                auto start = std::chrono::steady_clock::now();
+                std::size_t bytes = 0;
+                {
+                        L2_File file{path};
+                        L2_Out out;
+                        for(auto& fun : p.functions){
+                                out.clear();
+                                fun->emit_l2(out, [](){return std::string(":ret");}, tiling);
+                                bytes += out.size();
+                                file.write(out);
+                        }
+                        file.flush();
+                }
+                std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+
+                std::cout << (tiling == Tiling::munch ? "munch: " : "dp:    ")
+                          << bytes / took.count() / 1e6 << " MB/s of L2 ("
+                          << bytes << " bytes in " << took.count() << " s)\n";
+        }
+        std::remove(path.c_str());
+}
+#endif
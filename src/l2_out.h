@@ -0,0 +1,75 @@
+#pragma once
+
+#include <L3.h>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace L3{
+
+/*
+  Where L2 text gets built. One growable buffer per function: tiles append
+  straight into it, names are copied out of the symbol table, and numbers
+  are formatted in place without going through a stream or a temporary
+  string. clear() keeps the memory, so one of these can be reused for every
+  function.
+*/
+        class L2_Out{
+        public:
+                L2_Out& operator<<(const char* text);
+                L2_Out& operator<<(const std::string& text);
+                L2_Out& operator<<(char c);
+                L2_Out& operator<<(Symbol name);
+                L2_Out& operator<<(long long num);
+                L2_Out& operator<<(long num)          { return *this << (long long)num; }
+                L2_Out& operator<<(int num)           { return *this << (long long)num; }
+                L2_Out& operator<<(unsigned long num) { return *this << (long long)num; }
+
+                // A Var, Label or Int_Literal the way L2 spells it. Labels go
+                // through the renames when there are any.
+                void atom(ast_ptr item, const Label_Names* labels = nullptr);
+
+                const char* data() const { return buf.data(); }
+                std::size_t size() const { return used; }
+                std::string str() const { return std::string(buf.data(), used); }
+                void clear() { used = 0; }
+
+        private:
+                char* grab(std::size_t len);
+                void append(const char* text, std::size_t len);
+
+                std::vector<char> buf;
+                std::size_t used{0};
+        };
+
+        // to_chars for an int64, no terminator. first needs room for 20 chars.
+        char* format_int(char* first, int64_t num);
+
+/*
+  The output file. Finished function buffers are copied into one big
+  pending block and that goes out in a single write once it's past a
+  megabyte, so the file sees a handful of large writes instead of a small
+  one per instruction. Throws runtime_error when the file can't be opened
+  or written.
+*/
+        class L2_File{
+        public:
+                explicit L2_File(const std::string& filename);
+                ~L2_File();
+
+                L2_File(const L2_File&) = delete;
+                L2_File& operator=(const L2_File&) = delete;
+
+                void write(const L2_Out& out);
+                void write(const char* text, std::size_t len);
+                void flush();
+
+                static const std::size_t chunk = std::size_t{1} << 20;
+
+        private:
+                std::ofstream file;
+                std::string filename;
+                std::vector<char> pending;
+        };
+}
@@ -0,0 +1,255 @@
+#include <label_scoping.h>
+#include <array>
+#include <memory>
+#include <stdexcept>
+
+#ifdef UNIT_TEST
+#include <catch.hpp>
+#include <ll_parser.h>
+#include <chrono>
+#include <iostream>
+#endif
+
+using namespace L3;
+
+void Label_Scoping::collect(Function& fun){
+        scratch.clear();
+        for(auto inst : fun.instructions){
+                fun.walk_for_names<Label, Var>(inst, scratch);
+        }
+
+        for(auto label : scratch){
+                add_label(label);
+        }
+
+        add_label(fun.name.name);
+        add_global(fun.name.name);
+}
+
+void Label_Scoping::add_label(Symbol label){
+        auto& text = label.str();
+        if(text.size() > 1 && text[1] == 'z'){
+                z_labels.insert(text.substr(1));
+        }
+}
+
+void Label_Scoping::add_label_text(const std::string& stripped){
+        if(!stripped.empty() && stripped[0] == 'z'){
+                z_labels.insert(stripped);
+        }
+}
+
+void Label_Scoping::add_global(Symbol name){
+        global_names.insert(name);
+}
+
+const std::string& Label_Scoping::prefix(){
+        if(!have_prefix){
+                std::vector<const std::string*> labels;
+                labels.reserve(z_labels.size());
+                for(auto& label : z_labels){
+                        labels.push_back(&label);
+                }
+
+                the_prefix = collision_free_prefix(labels);
+                have_prefix = true;
+        }
+        return the_prefix;
+}
+
+Label_Names Label_Scoping::scopify(Function& fun, int64_t index){
+        return fun.scoped_label_names(prefix() + std::to_string(index) + "_", global_names);
+}
+
+std::function<std::string()> Label_Scoping::return_labels(int64_t index){
+        // std::function gets copied around by value, the copies have to
+        // keep counting together
+        auto fun_prefix = ":" + prefix() + std::to_string(index) + "_";
+        auto count = std::make_shared<int64_t>(0);
+        return [fun_prefix, count](){
+                return fun_prefix + std::to_string((*count)++) + "ret";
+        };
+}
+
+std::string L3::collision_free_prefix(const std::vector<const std::string*>& stripped_labels){
+        std::vector<const std::string*> in_the_way;
+        for(auto label : stripped_labels){
+                if(!label->empty() && (*label)[0] == 'z'){
+                        in_the_way.push_back(label);
+                }
+        }
+
+        std::string prefix{"z"};
+        if(in_the_way.empty()){
+                return prefix;
+        }
+
+        // Extend one digit at a time. Any digit no label has at this spot
+        // finishes it. Otherwise follow the least used digit: that keeps at
+        // most a tenth of the labels still in the way, so the whole thing
+        // is linear.
+        while(true){
+                auto at = prefix.size();
+
+                std::array<std::size_t, 10> uses{};
+                for(auto label : in_the_way){
+                        if(label->size() > at){
+                                char c = (*label)[at];
+                                if(c >= '0' && c <= '9'){
+                                        uses[c - '0']++;
+                                }
+                        }
+                }
+
+                for(int d = 0; d < 10; d++){
+                        if(!uses[d]){
+                                prefix.push_back('0' + d);
+                                return prefix;
+                        }
+                }
+
+                int fewest = 9;
+                for(int d = 8; d >= 0; d--){
+                        if(uses[d] < uses[fewest]){
+                                fewest = d;
+                        }
+                }
+                prefix.push_back('0' + fewest);
+
+                std::vector<const std::string*> still_in_the_way;
+                still_in_the_way.reserve(uses[fewest]);
+                for(auto label : in_the_way){
+                        if(label->size() > at && (*label)[at] == prefix.back()){
+                                still_in_the_way.push_back(label);
+                        }
+                }
+                in_the_way.swap(still_in_the_way);
+        }
+}
+
+#ifdef UNIT_TEST
+namespace{
+        std::string prefix_of(std::vector<std::string> labels){
+                std::vector<const std::string*> ptrs;
+                for(auto& l : labels){
+                        ptrs.push_back(&l);
+                }
+                return collision_free_prefix(ptrs);
+        }
+}
+
+TEST_CASE("scoping prefixes never start a label"){
+        REQUIRE(prefix_of({"main", "loop"}) == "z");
+        REQUIRE(prefix_of({"z"}) == "z0");
+        REQUIRE(prefix_of({"z0", "z1", "z2", "z3", "z4",
+                           "z5", "z6", "z7", "z8", "z9"}) == "z90");
+
+        std::vector<std::string> crowded;
+        for(int i = 0; i < 5000; i++){
+                crowded.push_back("z" + std::to_string(i));
+        }
+        auto prefix = prefix_of(crowded);
+        for(auto& label : crowded){
+                REQUIRE(label.compare(0, prefix.size(), prefix) != 0);
+        }
+}
+
+TEST_CASE("scoping renames labels per function"){
+        std::string src =
+                "define :main(){\n"
+                "  :z\n"
+                "  call :f()\n"
+                "  br :z\n"
+                "}\n"
+                "define :f(){\n"
+                "  :z\n"
+                "  x <- :main\n"
+                "  return\n"
+                "}\n";
+        Program p = ll_parse(src.data(), src.data() + src.size(), "test");
+
+        Label_Scoping scoping;
+        for(auto& fun : p.functions){
+                scoping.collect(*fun);
+        }
+        REQUIRE(scoping.prefix() == "z0");
+
+        auto main_rets = scoping.return_labels(0);
+        auto f_rets = scoping.return_labels(1);
+        REQUIRE(main_rets() == ":z00_0ret");
+        REQUIRE(f_rets() == ":z01_0ret");
+        REQUIRE(main_rets() == ":z00_1ret");
+        auto copy = main_rets;
+        REQUIRE(copy() == ":z00_2ret");
+        REQUIRE(main_rets() == ":z00_3ret");
+
+        std::vector<std::string> scoped;
+        for(std::size_t i = 0; i < p.functions.size(); i++){
+                auto names = scoping.scopify(*p.functions[i], i);
+                Dump v{&names};
+                p.functions[i]->accept(v);
+                scoped.push_back(v.result.str());
+        }
+
+        REQUIRE(scoped[0] ==
+                "define :main(){\n"
+                "  :z00_z\n"
+                "  call :f()\n"
+                "  br :z00_z\n"
+                "}");
+        REQUIRE(scoped[1] ==
+                "define :f(){\n"
+                "  :z01_z\n"
+                "  x <- :main\n"
+                "  return\n"
+                "}");
+
+        SECTION("and leaves the functions alone"){
+                Dump v;
+                p.accept(v);
+                REQUIRE(v.result.str() ==
+                        "define :main(){\n"
+                        "  :z\n"
+                        "  call :f()\n"
+                        "  br :z\n"
+                        "}\n"
+                        "\n"
+                        "define :f(){\n"
+                        "  :z\n"
+                        "  x <- :main\n"
+                        "  return\n"
+                        "}\n");
+        }
+}
+
+TEST_CASE("label scoping on lots of functions", "[.][bench]"){
+        for(int funs : {25000, 100000}){
+                std::string src;
+                for(int f = 0; f < funs; f++){
+                        auto n = std::to_string(f);
+                        src += "define :f" + n + "(a){\n"
+                                + "  :loop\n"
+                                + "  a <- a - 1\n"
+                                + "  br a :loop :z" + n + "\n"
+                                + "  :z" + n + "\n"
+                                + "  call :f0(a)\n"
+                                + "  return\n"
+                                + "}\n";
+                }
+                Program p = ll_parse(src.data(), src.data() + src.size(), "bench");
+
+                auto start = std::chrono::steady_clock::now();
+                Label_Scoping scoping;
+                for(auto& fun : p.functions){
+                        scoping.collect(*fun);
+                }
+                for(std::size_t i = 0; i < p.functions.size(); i++){
+                        scoping.scopify(*p.functions[i], i);
+                }
+                std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+
+                std::cout << funs << " functions: " << took.count() << " s, prefix "
+                          << scoping.prefix() << "\n";
+        }
+}
+#endif
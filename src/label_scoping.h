@@ -0,0 +1,56 @@
+#pragma once
+
+#include <L3.h>
+
+#include <functional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace L3{
+
+/*
+  Labels are per function in L3 and global in L2, so every local label gets
+  renamed to :<prefix><function index>_<old name>. The prefix starts no label
+  in the program, and the index is all digits up to the '_', so no two
+  functions can produce the same label. Return labels are
+  <prefix><function index>_<n>ret, and since no L3 label starts with a digit
+  those can't collide either. Each function counts its own, so the names
+  don't depend on which thread tiles what, or in what order.
+
+  Feed it every function (or the raw-text census when streaming) first, then
+  ask for the prefix once and scopify functions one at a time. Only labels
+  that start with 'z' can get in the prefix's way, so those are the only
+  ones kept around.
+*/
+        class Label_Scoping{
+        public:
+                // All labels in fun, and fun's name as a global
+                void collect(Function& fun);
+
+                void add_label(Symbol label); // colon included
+                void add_label_text(const std::string& stripped);
+                void add_global(Symbol name);
+
+                const std::string& prefix();
+                const std::unordered_set<Symbol>& globals() const { return global_names; }
+
+                // What fun's labels are called in L2. fun itself isn't touched.
+                Label_Names scopify(Function& fun, int64_t index);
+
+                // Fresh return labels for the function at index
+                std::function<std::string()> return_labels(int64_t index);
+
+        private:
+                std::unordered_set<Symbol> scratch;
+                std::unordered_set<std::string> z_labels;
+                std::unordered_set<Symbol> global_names;
+
+                std::string the_prefix;
+                bool have_prefix{false};
+        };
+
+        // The shortest z<digits> that isn't the start of any of stripped_labels.
+        // Linear in their total length.
+        std::string collision_free_prefix(const std::vector<const std::string*>& stripped_labels);
+}
@@ -0,0 +1,378 @@
+#include <lexer.h>
+#include <cstring>
+#include <stdexcept>
+#include <limits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef UNIT_TEST
+#include <catch.hpp>
+#endif
+
+using namespace L3;
+
+namespace{
+        // same set as pegtl::space
+        inline bool is_space(char c){
+                return c == ' ' || (c >= '\t' && c <= '\r');
+        }
+
+        inline bool is_name_start(char c){
+                return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+        }
+
+        inline bool is_digit(char c){
+                return c >= '0' && c <= '9';
+        }
+
+        inline bool is_name_char(char c){
+                return is_name_start(c) || is_digit(c);
+        }
+
+        inline const char* skip_spaces(const char* it, const char* end){
+#ifdef __SSE2__
+                const __m128i nine = _mm_set1_epi8(9);
+                const __m128i four = _mm_set1_epi8(4);
+                const __m128i blank = _mm_set1_epi8(' ');
+
+                while(end - it >= 16){
+                        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+
+                        // '\t'..'\r' is a 5 wide range: (c - 9) <= 4, unsigned
+                        __m128i shifted = _mm_sub_epi8(chunk, nine);
+                        __m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(shifted, four), shifted);
+                        __m128i spaces = _mm_or_si128(in_range, _mm_cmpeq_epi8(chunk, blank));
+
+                        unsigned not_space = ~_mm_movemask_epi8(spaces) & 0xFFFF;
+                        if(not_space){
+                                return it + __builtin_ctz(not_space);
+                        }
+                        it += 16;
+                }
+#endif
+                while(it != end && is_space(*it)){
+                        it++;
+                }
+                return it;
+        }
+}
+
+const char* L3::skip_seps(const char* it, const char* end){
+        while(true){
+                it = skip_spaces(it, end);
+
+                if(it == end || *it != ';'){
+                        return it;
+                }
+
+                // comments run to the end of the line (or file)
+                auto eol = static_cast<const char*>(std::memchr(it, '\n', end - it));
+                it = eol ? eol + 1 : end;
+        }
+}
+
+bool Token_Stream::text_is(const Token& tok, const char* word, std::size_t word_len) const{
+        return length(tok) == word_len && !std::memcmp(text(tok), word, word_len);
+}
+
+std::string Token_Stream::where(uint32_t offset) const{
+        std::size_t line = 1;
+        std::size_t col = 1;
+        for(uint32_t i = 0; i < offset && i < source_len; i++){
+                if(source[i] == '\n'){
+                        line++;
+                        col = 1;
+                } else {
+                        col++;
+                }
+        }
+        return std::to_string(line) + ":" + std::to_string(col);
+}
+
+Token_Stream L3::tokenize(const char* begin, const char* end){
+        if(std::size_t(end - begin) >= std::numeric_limits<uint32_t>::max()){
+                throw std::runtime_error("source too big for 32 bit token offsets");
+        }
+
+        Token_Stream ts;
+        ts.source = begin;
+        ts.source_len = end - begin;
+        // a token every ~4 bytes is about what our generated code looks like
+        ts.tokens.reserve(ts.source_len / 4 + 1);
+
+        auto push = [&](const char* from, const char* to, Token::Kind kind){
+                ts.tokens.push_back(Token{uint32_t(from - begin), uint32_t(to - begin), kind});
+        };
+
+        const char* it = begin;
+        while(true){
+                it = skip_seps(it, end);
+                if(it == end){
+                        break;
+                }
+
+                const char* start = it;
+                char c = *it;
+
+                if(is_name_start(c)){
+                        do{ it++; } while(it != end && is_name_char(*it));
+                        push(start, it, Token::name);
+                        continue;
+                }
+
+                if(is_digit(c)){
+                        do{ it++; } while(it != end && is_digit(*it));
+                        push(start, it, Token::number);
+                        continue;
+                }
+
+                if(c == ':'){
+                        it++;
+                        if(it == end || !is_name_start(*it)){
+                                throw std::runtime_error(ts.where(start - begin) + ": label needs a name");
+                        }
+                        do{ it++; } while(it != end && is_name_char(*it));
+                        push(start, it, Token::label);
+                        continue;
+                }
+
+                char next = (it + 1 != end) ? it[1] : '\0';
+                Token::Kind kind;
+                std::size_t len = 1;
+
+                switch(c){
+                case '<':
+                        if(next == '-'){
+                                kind = Token::arrow; len = 2;
+                        } else if(next == '<'){
+                                kind = Token::left_shift; len = 2;
+                        } else if(next == '='){
+                                kind = Token::less_eq; len = 2;
+                        } else {
+                                kind = Token::less;
+                        }
+                        break;
+                case '>':
+                        if(next == '>'){
+                                kind = Token::right_shift; len = 2;
+                        } else if(next == '='){
+                                kind = Token::greater_eq; len = 2;
+                        } else {
+                                kind = Token::greater;
+                        }
+                        break;
+                case '+': kind = Token::plus;    break;
+                case '-': kind = Token::minus;   break;
+                case '*': kind = Token::star;    break;
+                case '&': kind = Token::amp;     break;
+                case '=': kind = Token::eq;      break;
+                case '(': kind = Token::l_paren; break;
+                case ')': kind = Token::r_paren; break;
+                case '{': kind = Token::l_brace; break;
+                case '}': kind = Token::r_brace; break;
+                case ',': kind = Token::comma;   break;
+                default:
+                        throw std::runtime_error(ts.where(start - begin)
+                                                 + ": no token starts with '" + std::string(1, c) + "'");
+                }
+
+                it += len;
+                push(start, it, kind);
+        }
+
+        push(end, end, Token::eof);
+        return ts;
+}
+
+Label_Census L3::census_labels(const char* begin, const char* end){
+        Label_Census census;
+        bool after_define = false;
+
+        const char* it = begin;
+        while(true){
+                it = skip_seps(it, end);
+                if(it == end){
+                        break;
+                }
+
+                const char* start = it;
+
+                if(*it == ':'){
+                        do{ it++; } while(it != end && is_name_char(*it));
+                        if(it - start > 1){
+                                census.labels.insert(std::string(start + 1, it));
+                                if(after_define){
+                                        census.function_names.insert(Symbol(start, it - start));
+                                }
+                        }
+                        after_define = false;
+                        continue;
+                }
+
+                if(is_name_char(*it)){
+                        do{ it++; } while(it != end && is_name_char(*it));
+                        after_define = it - start == 6 && !std::memcmp(start, "define", 6);
+                        continue;
+                }
+
+                it++;
+                after_define = false;
+        }
+
+        return census;
+}
+
+namespace{
+        const char* next_close_brace(const char* it, const char* end){
+                for(; it != end; it++){
+                        if(*it == '}'){
+                                return it;
+                        }
+                        if(*it == ';'){
+                                it = static_cast<const char*>(std::memchr(it, '\n', end - it));
+                                if(!it){
+                                        return nullptr;
+                                }
+                        }
+                }
+                return nullptr;
+        }
+}
+
+const char* L3::end_of_function(const char* begin, const char* end){
+        const char* close = next_close_brace(begin, end);
+        return close ? close + 1 : end;
+}
+
+std::vector<Source_Chunk> L3::chunk_functions(const char* begin,
+                                              const char* end,
+                                              std::size_t target_chunks){
+        std::vector<Source_Chunk> chunks;
+
+        std::size_t step = (end - begin) / (target_chunks ? target_chunks : 1);
+        if(step == 0){
+                step = 1;
+        }
+
+        const char* start = begin;
+        while(start != end){
+                if(std::size_t(end - start) <= step){
+                        chunks.push_back(Source_Chunk{start, end});
+                        break;
+                }
+
+                // a line never starts inside a comment, so back up to one
+                const char* line = start + step;
+                while(line != start && line[-1] != '\n'){
+                        line--;
+                }
+
+                const char* close = next_close_brace(line, end);
+                if(!close){
+                        chunks.push_back(Source_Chunk{start, end});
+                        break;
+                }
+
+                chunks.push_back(Source_Chunk{start, close + 1});
+                start = close + 1;
+        }
+
+        // trailing blanks and comments can't be parsed on their own
+        if(chunks.size() > 1 && skip_seps(chunks.back().begin, end) == end){
+                chunks.pop_back();
+                chunks.back().end = end;
+        }
+
+        return chunks;
+}
+
+#ifdef UNIT_TEST
+TEST_CASE("skipping separators"){
+        SECTION("long runs of every kind of blank"){
+                std::string src = std::string(37, ' ') + "\t\n\r\v\f" + std::string(20, '\n') + "x";
+                REQUIRE(*skip_seps(src.data(), src.data() + src.size()) == 'x');
+        }
+
+        SECTION("comments to end of line and end of file"){
+                std::string src = "  ; whatever <- call\n ;; more\n\ty ; trailing";
+                auto it = skip_seps(src.data(), src.data() + src.size());
+                REQUIRE(*it == 'y');
+                REQUIRE(skip_seps(it + 1, src.data() + src.size()) == src.data() + src.size());
+        }
+}
+
+TEST_CASE("tokenizing an instruction or two"){
+        std::string src = "define :f(a){ v <- a <= -12 ; no\n br v :t :f }";
+        auto ts = tokenize(src.data(), src.data() + src.size());
+
+        std::vector<Token::Kind> kinds;
+        for(auto& tok : ts.tokens){
+                kinds.push_back(tok.kind);
+        }
+
+        REQUIRE(kinds == (std::vector<Token::Kind>{
+                                Token::name, Token::label, Token::l_paren, Token::name,
+                                        Token::r_paren, Token::l_brace, Token::name, Token::arrow,
+                                        Token::name, Token::less_eq, Token::minus, Token::number,
+                                        Token::name, Token::name, Token::label, Token::label,
+                                        Token::r_brace, Token::eof}));
+        REQUIRE(ts.text_is(ts.tokens[1], ":f", 2));
+        REQUIRE(ts.text_is(ts.tokens[11], "12", 2));
+}
+#endif
+
+#ifdef UNIT_TEST
+TEST_CASE("label census without a parse"){
+        std::string src = "define :main(){ :loop x <- :f ; :commented\n br :loop }\n"
+                "define\n  :f(a){ call :main() return }";
+        auto census = census_labels(src.data(), src.data() + src.size());
+
+        REQUIRE(census.labels == (std::unordered_set<std::string>{"main", "loop", "f"}));
+        REQUIRE(census.function_names == (std::unordered_set<Symbol>{Symbol{std::string(":main")},
+                                                                       Symbol{std::string(":f")}}));
+}
+
+TEST_CASE("one function at a time"){
+        std::string src = "define :f(a){ ; not a } brace\n  return a\n}\n"
+                          "define :g(){\n  return\n}; the end }\n";
+        auto end = src.data() + src.size();
+
+        auto f_end = end_of_function(src.data(), end);
+        REQUIRE(std::string(src.data(), f_end) == "define :f(a){ ; not a } brace\n  return a\n}");
+        auto g_end = end_of_function(f_end, end);
+        REQUIRE(std::string(skip_seps(f_end, end), g_end) == "define :g(){\n  return\n}");
+        REQUIRE(skip_seps(g_end, end) == end);
+        REQUIRE(end_of_function(g_end, end) == end);
+}
+#endif
+
+#ifdef UNIT_TEST
+TEST_CASE("chunking at function boundaries"){
+        std::string src;
+        for(int i = 0; i < 50; i++){
+                src += "define :f" + std::to_string(i) + "(a){ ; not a } brace\n  return a\n}\n";
+        }
+        src += "; the end }\n";
+
+        for(std::size_t target : {1, 3, 7, 50, 1000}){
+                auto chunks = chunk_functions(src.data(), src.data() + src.size(), target);
+
+                REQUIRE(chunks.front().begin == src.data());
+                REQUIRE(chunks.back().end == src.data() + src.size());
+                for(std::size_t i = 0; i < chunks.size(); i++){
+                        if(i){
+                                REQUIRE(chunks[i].begin == chunks[i - 1].end);
+                        }
+                        // every piece holds at least one whole define
+                        auto first = skip_seps(chunks[i].begin, chunks[i].end);
+                        REQUIRE(std::string(first, 6) == "define");
+                        if(i + 1 < chunks.size()){
+                                REQUIRE(chunks[i].end[-1] == '}');
+                        }
+                }
+                REQUIRE(chunks.size() <= std::min<std::size_t>(target + 1, 50));
+        }
+}
+#endif
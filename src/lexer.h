@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <unordered_set>
+
+#include <symbol.h>
+
+namespace L3{
+
+/*
+  First phase of the hand-written parser backend: chop the whole source into
+  a flat array of tokens. Tokens don't own anything, they are offsets into the
+  source buffer, which has to outlive them.
+*/
+        struct Token{
+                enum Kind : uint8_t{
+                        name,
+                        label,       // ':' name, the colon is part of the token
+                        number,      // unsigned, signs are separate tokens
+                        arrow,       // <-
+                        plus,
+                        minus,
+                        star,
+                        amp,
+                        left_shift,
+                        right_shift,
+                        less,
+                        less_eq,
+                        eq,
+                        greater,
+                        greater_eq,
+                        l_paren,
+                        r_paren,
+                        l_brace,
+                        r_brace,
+                        comma,
+                        eof
+                };
+
+                uint32_t begin;
+                uint32_t end;
+                Kind kind;
+        };
+
+        struct Token_Stream{
+                const char* source;
+                std::size_t source_len;
+                std::vector<Token> tokens; // always terminated by an eof token
+
+                const char* text(const Token& tok) const { return source + tok.begin; }
+                std::size_t length(const Token& tok) const { return tok.end - tok.begin; }
+                bool text_is(const Token& tok, const char* word, std::size_t word_len) const;
+
+                // "line:col" of a byte offset, only used for error messages
+                std::string where(uint32_t offset) const;
+        };
+
+        // Skip whitespace and ';' comments. Returns the first byte that is neither.
+        const char* skip_seps(const char* it, const char* end);
+
+        Token_Stream tokenize(const char* begin, const char* end);
+
+        /*
+          Every label in a source, found without parsing it. Streaming
+          compilation needs the label prefix before the first function is
+          done, so it can't wait for the AST. Labels inside junk that won't
+          parse get counted too, which only makes the prefix more careful.
+        */
+        struct Label_Census{
+                std::unordered_set<std::string> labels; // colon stripped, like grabber_of_the_labels
+                std::unordered_set<Symbol> function_names; // colon kept, like Label::name
+        };
+
+        Label_Census census_labels(const char* begin, const char* end);
+
+        // One past the '}' closing the definition that starts at begin, or
+        // end if there isn't one. A '}' in a comment doesn't count.
+        const char* end_of_function(const char* begin, const char* end);
+
+        struct Source_Chunk{
+                const char* begin;
+                const char* end;
+        };
+
+        /*
+          Cut a source into roughly target_chunks pieces of whole function
+          definitions, for parsing them independently. Bodies never nest
+          braces, so every '}' outside a comment ends a function. The scan
+          jumps ahead chunk-sized steps and only reads from the start of the
+          line it lands in up to the next '}'.
+        */
+        std::vector<Source_Chunk> chunk_functions(const char* begin,
+                                                  const char* end,
+                                                  std::size_t target_chunks);
+}
@@ -0,0 +1,509 @@
+#include <ll_parser.h>
+#include <stdexcept>
+#include <cstring>
+
+#ifdef UNIT_TEST
+#include <catch.hpp>
+#include <l2_out.h>
+#include <parser.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#endif
+
+using namespace L3;
+
+#define WORD(w) w, sizeof(w) - 1
+
+LL_Parser::LL_Parser(const Token_Stream& ts, std::string source_name) :
+        ts(ts),
+        source_name(std::move(source_name)),
+        pos(0)
+{}
+
+bool LL_Parser::at_word(const char* word, std::size_t len) const{
+        return at(Token::name) && ts.text_is(cur(), word, len);
+}
+
+void LL_Parser::fail(const char* what) const{
+        throw std::runtime_error(source_name + ":" + ts.where(cur().begin)
+                                 + ": expected " + what);
+}
+
+const Token& LL_Parser::expect(Token::Kind kind, const char* what){
+        if(!at(kind)){
+                fail(what);
+        }
+        return ts.tokens[pos++];
+}
+
+void LL_Parser::expect_word(const char* word, std::size_t len){
+        if(!at_word(word, len)){
+                fail(word);
+        }
+        pos++;
+}
+
+L3_ptr<Var> LL_Parser::parse_var(){
+        auto& tok = expect(Token::name, "a variable");
+        return make_node<Var>(Symbol(ts.text(tok), ts.length(tok)));
+}
+
+L3_ptr<Label> LL_Parser::parse_label(){
+        auto& tok = expect(Token::label, "a label");
+        return make_node<Label>(Symbol(ts.text(tok), ts.length(tok)));
+}
+
+bool LL_Parser::at_t() const{
+        if(at(Token::name) || at(Token::number)){
+                return true;
+        }
+        // a sign only belongs to a literal when it is glued to the digits
+        return (at(Token::minus) || at(Token::plus))
+                && peek().kind == Token::number
+                && peek().begin == cur().end;
+}
+
+ast_ptr LL_Parser::parse_t(){
+        if(at(Token::name)){
+                return parse_var();
+        }
+        if(!at_t()){
+                fail("a variable or a number");
+        }
+
+        auto first = cur().begin;
+        if(!at(Token::number)){
+                pos++;
+        }
+        auto& digits = expect(Token::number, "a number");
+
+        return make_AST<Int_Literal>(decode_int64(ts.source + first, ts.source + digits.end));
+}
+
+ast_ptr LL_Parser::parse_s(){
+        if(at(Token::label)){
+                return parse_label();
+        }
+        return parse_t();
+}
+
+L3_ptr<Call> LL_Parser::parse_call(){
+        expect_word(WORD("call"));
+
+        Instruction::Operands everything;
+
+        if(at(Token::label)){
+                everything.push_back(parse_label());
+        } else if(at_word(WORD("array"))
+                  && peek().kind == Token::minus
+                  && peek().begin == cur().end
+                  && ts.tokens[pos + 2].begin == peek().end
+                  && ts.text_is(ts.tokens[pos + 2], WORD("error"))){
+                // the only name with a '-' in it. The lexer doesn't know about it.
+                pos += 3;
+                everything.push_back(make_AST<Var>(Symbol(WORD("array-error"))));
+        } else {
+                // print and allocate are plain vars as far as the AST is concerned
+                everything.push_back(parse_var());
+        }
+
+        expect(Token::l_paren, "(");
+        if(!at(Token::r_paren)){
+                everything.push_back(parse_t());
+                while(at(Token::comma)){
+                        pos++;
+                        everything.push_back(parse_t());
+                }
+        }
+        expect(Token::r_paren, ")");
+
+        return make_node<Call>(std::move(everything));
+}
+
+ast_ptr LL_Parser::parse_rhs(){
+        if(at_word(WORD("call"))){
+                return parse_call();
+        }
+        if(at_word(WORD("load"))){
+                pos++;
+                return make_AST<Load>(parse_var());
+        }
+
+        auto lhs = parse_s();
+
+        Binop::Op op;
+        bool glued_minus = false;
+        switch(cur().kind){
+        case Token::plus:        op = Binop::plus;        break;
+        case Token::minus:       op = Binop::minus;       break;
+        case Token::star:        op = Binop::mult;        break;
+        case Token::amp:         op = Binop::and_;        break;
+        case Token::left_shift:  op = Binop::left_shift;  break;
+        case Token::right_shift: op = Binop::right_shift; break;
+        case Token::less:        op = Binop::le;          break;
+        case Token::less_eq:     op = Binop::leq;         break;
+        case Token::eq:          op = Binop::eq;          break;
+        case Token::greater:     op = Binop::ge;          break;
+        case Token::greater_eq:  op = Binop::geq;         break;
+        case Token::arrow:
+                // `a <-5` is `a < -5` in here, the lexer just munched too much
+                op = Binop::le;
+                glued_minus = true;
+                break;
+        default:
+                return lhs;
+        }
+
+        ast_ptr rhs;
+        if(glued_minus){
+                auto first = cur().begin + 1;
+                pos++;
+                if(!at(Token::number) || cur().begin != first + 1){
+                        fail("a number after '<-' in a comparison");
+                }
+                rhs = make_AST<Int_Literal>(decode_int64(ts.source + first, ts.source + cur().end));
+                pos++;
+        } else {
+                pos++;
+                rhs = parse_t();
+        }
+
+        // same canonicalization as action<binop_tail>
+        if(op == Binop::ge){
+                op = Binop::le;
+                std::swap(lhs, rhs);
+        }
+        if(op == Binop::geq){
+                op = Binop::leq;
+                std::swap(lhs, rhs);
+        }
+
+        return make_AST<Binop>(op, lhs, rhs);
+}
+
+void LL_Parser::parse_instruction(Function& fun){
+        auto& is = fun.instructions;
+
+        switch(cur().kind){
+        case Token::label:
+                is.push_back(parse_label());
+                return;
+        case Token::number:
+        case Token::plus:
+        case Token::minus:
+                // a bare literal is accepted by the grammar and then dropped
+                parse_t();
+                return;
+        case Token::name:
+                break;
+        default:
+                fail("an instruction");
+        }
+
+        if(at_word(WORD("call"))){
+                is.push_back(parse_call());
+                return;
+        }
+
+        if(at_word(WORD("br"))){
+                pos++;
+                if(at(Token::label)){
+                        is.push_back(make_node<Goto>(parse_label()));
+                        return;
+                }
+                auto cond = parse_var();
+                auto t_target = parse_label();
+                auto f_target = parse_label();
+                is.push_back(make_node<Cjump>(cond, t_target, f_target));
+                return;
+        }
+
+        if(at_word(WORD("return"))){
+                pos++;
+                if(at_t()){
+                        is.push_back(make_node<Val_Return>(parse_t()));
+                } else {
+                        is.push_back(make_node<Void_Return>());
+                }
+                return;
+        }
+
+        ast_ptr lhs;
+        if(at_word(WORD("store"))){
+                pos++;
+                lhs = make_AST<Store>(parse_var());
+                if(!at(Token::arrow)){
+                        // same as above, a lonely store parses but means nothing
+                        return;
+                }
+        } else {
+                lhs = parse_var();
+        }
+
+        expect(Token::arrow, "<-");
+        is.push_back(make_node<Assignment>(lhs, parse_rhs()));
+}
+
+Program::fun_ptr LL_Parser::parse_function(){
+        expect_word(WORD("define"));
+
+        auto& name = expect(Token::label, "a label");
+        Program::fun_ptr fun{new Function{Label{Symbol(ts.text(name), ts.length(name))}}};
+
+        Arena_Scope scope{fun->arena};
+
+        expect(Token::l_paren, "(");
+        if(!at(Token::r_paren)){
+                fun->params.push_back(*parse_var());
+                while(at(Token::comma)){
+                        pos++;
+                        fun->params.push_back(*parse_var());
+                }
+        }
+        expect(Token::r_paren, ")");
+
+        expect(Token::l_brace, "{");
+        do{
+                parse_instruction(*fun);
+        } while(!at(Token::r_brace));
+        expect(Token::r_brace, "}");
+
+        return fun;
+}
+
+Program LL_Parser::parse_program(Program::Function_Sink sink){
+        Program p;
+
+        do{
+                if(sink){
+                        sink(parse_function());
+                } else {
+                        p.functions.push_back(parse_function());
+                }
+        } while(!at(Token::eof));
+
+        return p;
+}
+
+Program L3::ll_parse(const char* begin, const char* end, std::string source_name){
+        auto ts = tokenize(begin, end);
+        return LL_Parser(ts, std::move(source_name)).parse_program();
+}
+
+Program L3::ll_parse_file(std::string fileName){
+        Mapped_File source{fileName};
+        return ll_parse(source.begin(), source.end(), fileName);
+}
+
+void L3::ll_parse_file_streaming(std::string fileName, Program::Function_Sink sink){
+        Mapped_File source{fileName};
+
+        // One define's tokens at a time, so nothing here grows past the
+        // biggest function
+        const char* it = source.begin();
+        do{
+                auto stop = end_of_function(it, source.end());
+                auto ts = tokenize(it, stop);
+                auto piece_name = fileName + " (from byte " + std::to_string(it - source.begin()) + ")";
+                LL_Parser(ts, piece_name).parse_program(sink);
+                it = stop;
+        } while(skip_seps(it, source.end()) != source.end());
+}
+
+#ifdef UNIT_TEST
+namespace{
+        std::string ll_roundtrip(const std::string& src){
+                Program p = ll_parse(src.data(), src.data() + src.size(), "test");
+                Dump v;
+                p.accept(v);
+                return v.result.str();
+        }
+
+        const int bench_functions = 20000;
+
+        // Where the benches parse from. Written the first time any of them
+        // asks, so they can run in any order or on their own.
+        const std::string& bench_corpus(){
+                static const std::string path = [](){
+                        std::string path{"/tmp/L3_parser_bench.L3"};
+                        std::ofstream out(path);
+                        for(int f = 0; f < bench_functions; f++){
+                                out << "define :f" << f << "(a, b, c){\n"
+                                    << "  ; loop header\n"
+                                    << "  :head\n"
+                                    << "  i <- a + 1\n"
+                                    << "  off <- i * 8\n"
+                                    << "  addr <- b + off\n"
+                                    << "  v <- load addr\n"
+                                    << "  store addr <- c\n"
+                                    << "  cmp <- i < 100\n"
+                                    << "  br cmp :head :done\n"
+                                    << "  :done\n"
+                                    << "  r <- call :f0(v, i, -3)\n"
+                                    << "  call print(r)\n"
+                                    << "  return r\n"
+                                    << "}\n";
+                        }
+                        return path;
+                }();
+                return path;
+        }
+}
+
+TEST_CASE("LL parser gives back what it was given"){
+        std::string src =
+                "define :main(){\n"
+                "  x <- 5\n"
+                "  y <- x + -3\n"
+                "  z <- :lab\n"
+                "  :lab\n"
+                "  c <- x < y\n"
+                "  br c :lab :out\n"
+                "  br :out\n"
+                "  store y <- x\n"
+                "  w <- load y\n"
+                "  r <- call :f(x, 12, -1)\n"
+                "  call print(r)\n"
+                "  call array-error(x, y)\n"
+                "  :out\n"
+                "  return\n"
+                "}\n"
+                "\n"
+                "define :f(a, b, c){\n"
+                "  return a\n"
+                "}\n";
+
+        REQUIRE(ll_roundtrip(src) == src);
+}
+
+TEST_CASE("LL parser canonicalizes like the PEGTL actions"){
+        SECTION("greater comparisons flip"){
+                REQUIRE(ll_roundtrip("define :main(){ c <- a >= 3 return c }")
+                        == "define :main(){\n  c <- 3 <= a\n  return c\n}\n");
+        }
+
+        SECTION("comments and odd spacing"){
+                REQUIRE(ll_roundtrip(";; hi\ndefine:main( a ,b ){;x\nx<-a*b return x} ; bye")
+                        == "define :main(a, b){\n  x <- a * b\n  return x\n}\n");
+        }
+
+        SECTION("glued arrow in a comparison"){
+                REQUIRE(ll_roundtrip("define :main(){ c <- a <-5 return c }")
+                        == "define :main(){\n  c <- a < -5\n  return c\n}\n");
+        }
+
+        SECTION("garbage is rejected"){
+                REQUIRE_THROWS(ll_roundtrip("define :main(){ x <- }"));
+                REQUIRE_THROWS(ll_roundtrip("define :main(){ x <- 5 "));
+        }
+}
+
+TEST_CASE("LL streaming hands over the same functions, one define at a time"){
+        std::string src;
+        for(int f = 0; f < 20; f++){
+                src += "; function " + std::to_string(f) + " }\n"
+                        "define :f" + std::to_string(f) + "(a, p){\n"
+                        "  :top ; } not the end\n"
+                        "  v <- load p\n"
+                        "  br v :top :out\n"
+                        "  :out\n"
+                        "  return a\n"
+                        "}\n";
+        }
+        src += "; trailing }\n";
+
+        std::string path{"/tmp/L3_ll_stream_test.L3"};
+        {
+                std::ofstream out(path);
+                out << src;
+        }
+
+        Program whole = ll_parse(src.data(), src.data() + src.size(), "test");
+        std::size_t seen = 0;
+        ll_parse_file_streaming(path, [&](Program::fun_ptr fun){
+                        Dump streamed;
+                        fun->accept(streamed);
+                        Dump expected;
+                        whole.functions.at(seen++)->accept(expected);
+                        REQUIRE(streamed.result.str() == expected.result.str());
+                });
+        REQUIRE(seen == 20);
+}
+
+TEST_CASE("parser backend throughput", "[.][bench]"){
+        auto& path = bench_corpus();
+        double mb = slurp_file(path).size() / (1024.0 * 1024.0);
+
+        auto time_it = [&](Parser_Backend backend){
+                auto start = std::chrono::steady_clock::now();
+                Program p = parse_file(path, backend);
+                std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+                REQUIRE(p.functions.size() == bench_functions);
+                return mb / took.count();
+        };
+
+        std::cout << "pegtl: " << time_it(Parser_Backend::pegtl) << " MB/s\n";
+        std::cout << "ll:    " << time_it(Parser_Backend::ll) << " MB/s\n";
+}
+
+TEST_CASE("parser heap allocations", "[.][bench]"){
+        auto& path = bench_corpus();
+        double kb = slurp_file(path).size() / 1024.0;
+
+        auto count_it = [&](Parser_Backend backend){
+                auto before = heap_allocations();
+                Program p = parse_file(path, backend);
+                auto allocs = heap_allocations() - before;
+
+                std::size_t instructions = 0;
+                for(auto& fun : p.functions){
+                        instructions += fun->instructions.size();
+                }
+                REQUIRE(instructions > 0);
+
+                std::cout << allocs / kb << " allocations per KB, "
+                          << double(allocs) / instructions << " per instruction\n";
+        };
+
+        std::cout << "pegtl: ";
+        count_it(Parser_Backend::pegtl);
+        std::cout << "ll:    ";
+        count_it(Parser_Backend::ll);
+}
+
+TEST_CASE("AST allocation", "[.][bench]"){
+        auto& path = bench_corpus();
+
+        // Everything a function's nodes cost from parse to free, tiling
+        // included since that's where the nodes get walked and copied around
+        auto before = heap_allocations();
+        auto start = std::chrono::steady_clock::now();
+        std::size_t nodes = 0, chunks = 0, bytes = 0, funs = 0, instructions = 0, l2_bytes = 0;
+        {
+                Program p = parse_file(path, Parser_Backend::ll);
+                L2_Out out;
+                for(auto& fun : p.functions){
+                        nodes += fun->arena.object_count();
+                        chunks += fun->arena.chunk_count();
+                        bytes += fun->arena.bytes_reserved();
+                        instructions += fun->instructions.size();
+
+                        out.clear();
+                        fun->emit_l2(out, [](){ return std::string(":ret"); }, Tiling::dp);
+                        l2_bytes += out.size();
+                }
+                funs = p.functions.size();
+        }
+        std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+        auto allocs = heap_allocations() - before;
+
+        REQUIRE(funs == bench_functions);
+        REQUIRE(l2_bytes > 0);
+        std::cout << nodes << " nodes in " << chunks << " arena chunks ("
+                  << bytes / funs << " bytes per function)\n"
+                  << "parse + tile + free: " << allocs << " heap allocations ("
+                  << double(allocs) / instructions << " per instruction), "
+                  << took.count() << " s\n";
+}
+#endif
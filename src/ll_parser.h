@@ -0,0 +1,56 @@
+#pragma once
+
+#include <L3.h>
+#include <lexer.h>
+
+#include <string>
+
+namespace L3{
+
+/*
+  Second phase of the hand-written backend: a predictive parser over the
+  token array. Every decision is made on the current token (plus a peek at the
+  next one for signed literals and `br`), so nothing is ever scanned twice.
+  It builds exactly the same Program the PEGTL grammar in parser.h does.
+*/
+        class LL_Parser{
+        public:
+                LL_Parser(const Token_Stream& ts, std::string source_name);
+
+                // With a sink, functions are handed over as they are finished
+                // and the returned Program stays empty.
+                Program parse_program(Program::Function_Sink sink = nullptr);
+
+        private:
+                const Token_Stream& ts;
+                std::string source_name;
+                std::size_t pos;
+
+                const Token& cur() const { return ts.tokens[pos]; }
+                const Token& peek() const { return ts.tokens[pos + 1]; }
+                bool at(Token::Kind kind) const { return cur().kind == kind; }
+                bool at_word(const char* word, std::size_t len) const;
+
+                const Token& expect(Token::Kind kind, const char* what);
+                void expect_word(const char* word, std::size_t len);
+                [[noreturn]] void fail(const char* what) const;
+
+                Program::fun_ptr parse_function();
+                void parse_instruction(Function& fun);
+
+                ast_ptr parse_rhs();
+                L3_ptr<Call> parse_call();
+                ast_ptr parse_t();
+                ast_ptr parse_s();
+                bool at_t() const;
+
+                L3_ptr<Var> parse_var();
+                L3_ptr<Label> parse_label();
+        };
+
+        Program ll_parse(const char* begin, const char* end, std::string source_name);
+
+        Program ll_parse_file(std::string fileName);
+
+        void ll_parse_file_streaming(std::string fileName, Program::Function_Sink sink);
+}
@@ -1,11 +1,11 @@
 #include <memory>
-#include <deque>
+#include <vector>
 #include <string>
 #include <sstream>
 
 namespace L3{
      template <typename T>
-     using compiler_ptr = std::shared_ptr<T>;
+     using compiler_ptr = T*;
 
      template <typename T>
      class L3_Parse_Stack{
@@ -21,10 +21,28 @@ namespace L3{
 
           const T& peek() const;
 
+          // Argument frames, instead of pushing a marker node: open_frame
+          // remembers where a list starts and take_frame hands everything
+          // above that spot to each (oldest first) and drops it.
+          void open_frame();
+
+          std::size_t frame_size() const;
+
+          template<typename expected_T, typename F>
+          void take_frame(F&& each);
+
+          // Empties the stack but keeps the memory around for the next
+          // instruction.
           void NUKE();
 
      private:
-          std::deque<T> instr_elements;
+          template<typename expected_T>
+          static compiler_ptr<expected_T> downcast(T item);
+
+          [[noreturn]] static void bad_downcast(const char* expected, T item);
+
+          std::vector<T> instr_elements;
+          std::vector<std::size_t> frames;
      };
 
 }
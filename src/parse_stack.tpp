@@ -11,25 +11,31 @@ namespace L3{
      template<typename T>
      template<typename expected_T>
      compiler_ptr<expected_T> L3_Parse_Stack<T>::downcast_pop(){
-          expected_T* ptr;
+          return downcast<expected_T>(pop());
+     }
 
-          T p = pop();
-          if((ptr = dynamic_cast<expected_T*>(p.get()))){
-               //p.release();
-               return compiler_ptr<expected_T>(p, ptr);
-          }
-          else {
-               std::stringstream ss;
-               ss << std::string("bad downcast to ")
-                  <<  typeid(expected_T).name()
-                  << " from "
-                  << typeid(T).name()
-                  << " with ast dump: ";
-               Dump v;
-               p->accept(v);
-               ss << v.result.str();
-               throw std::logic_error(ss.str());
+     template<typename T>
+     template<typename expected_T>
+     compiler_ptr<expected_T> L3_Parse_Stack<T>::downcast(T item){
+          auto ptr = node_cast<expected_T>(item);
+          if(!ptr){
+               bad_downcast(typeid(expected_T).name(), item);
           }
+          return ptr;
+     }
+
+     template<typename T>
+     void L3_Parse_Stack<T>::bad_downcast(const char* expected, T item){
+          std::stringstream ss;
+          ss << std::string("bad downcast to ")
+             << expected
+             << " from "
+             << typeid(T).name()
+             << " with ast dump: ";
+          Dump v;
+          item->accept(v);
+          ss << v.result.str();
+          throw std::logic_error(ss.str());
      }
 
      template<typename T>
@@ -47,9 +53,36 @@ namespace L3{
           return instr_elements.back();
      }
 
+     template <typename T>
+     void L3_Parse_Stack<T>::open_frame(){
+          frames.push_back(instr_elements.size());
+     }
+
+     template <typename T>
+     std::size_t L3_Parse_Stack<T>::frame_size() const{
+          if(frames.empty()){
+               throw std::logic_error("no open frame on the instr stack!");
+          }
+          return instr_elements.size() - frames.back();
+     }
+
+     template <typename T>
+     template <typename expected_T, typename F>
+     void L3_Parse_Stack<T>::take_frame(F&& each){
+          auto start = instr_elements.size() - frame_size();
+
+          for(auto i = start; i < instr_elements.size(); i++){
+               each(downcast<expected_T>(std::move(instr_elements[i])));
+          }
+
+          instr_elements.resize(start);
+          frames.pop_back();
+     }
+
      template <typename T>
      void L3_Parse_Stack<T>::NUKE(){
           instr_elements.clear();
+          frames.clear();
      }
 
      template <typename T>
@@ -1,5 +1,8 @@
 #include <parser.h>
+#include <ll_parser.h>
+#include <thread_pool.h>
 #include <string>
+#include <iterator>
 
 #ifdef UNIT_TEST
 #include "catch.hpp"
@@ -15,32 +18,119 @@ void L3::curfun_instr_push(Program& p, L3_ptr<Instruction> inst){
 }
 
 
-Program L3::parse_file (std::string fileName){
+namespace{
+        void pegtl_parse(const char* begin,
+                         const char* end,
+                         const std::string& source_name,
+                         Program& p){
+                L3_Parse_Stack<L3_ptr<AST_Item>> the_stack;
+                std::vector<Binop::Op> op_stack;
+                std::vector<Runtime_Fun::Fun> fun_stack;
+
+                // Function names and anything else parsed between functions
+                // lands in here. function_head switches over to the new
+                // function's own arena.
+                Arena scratch;
+                Arena_Scope scope{scratch};
+
+                pegtl::parse< L3::grammar, L3::action >(begin,
+                                                        end,
+                                                        source_name.c_str(),
+                                                        p,
+                                                        the_stack,
+                                                        op_stack,
+                                                        fun_stack);
+        }
+
+        void pegtl_parse(const std::string& fileName, Program& p){
+
+                /*
+                 * Check the grammar for some possible issues.
+                 */
+                pegtl::analyze< L3::grammar >();
+
+                /*
+                 * Parse.
+                 */
+
+                // Parse straight out of the page cache. The mapping only has to
+                // outlive the parse: every node copies out the bytes it keeps.
+                Mapped_File source{fileName};
+
+                pegtl_parse(source.begin(), source.end(), fileName, p);
+        }
+}
+
+Program L3::parse_file (std::string fileName, Parser_Backend backend){
+
+        if(backend == Parser_Backend::ll){
+                return ll_parse_file(fileName);
+        }
+
+        Program p;
+        pegtl_parse(fileName, p);
+        return p;
+}
+
+Program L3::parse_file_parallel (std::string fileName,
+                                 unsigned jobs,
+                                 Parser_Backend backend){
+
+        if(backend == Parser_Backend::pegtl){
+                pegtl::analyze< L3::grammar >();
+        }
 
-        /*
-         * Check the grammar for some possible issues.
-         */
-        pegtl::analyze< L3::grammar >();
+        Mapped_File source{fileName};
+        Thread_Pool pool(jobs);
 
-        /*
-         * Parse.
-         */
+        // a few pieces per worker, so one huge function doesn't leave
+        // everybody else waiting on it
+        auto chunks = chunk_functions(source.begin(), source.end(), pool.size() * 4);
+
+        std::vector<Program> pieces(chunks.size());
+
+        parallel_for(pool, chunks.size(), [&](std::size_t i){
+                        auto piece_name = fileName + " (from byte "
+                                + std::to_string(chunks[i].begin - source.begin()) + ")";
+
+                        if(backend == Parser_Backend::ll){
+                                pieces[i] = ll_parse(chunks[i].begin, chunks[i].end, piece_name);
+                        } else {
+                                pegtl_parse(chunks[i].begin, chunks[i].end, piece_name, pieces[i]);
+                        }
+                });
 
         Program p;
-        L3_Parse_Stack<L3_ptr<AST_Item>> the_stack;
-        std::vector<Binop::Op> op_stack;
-        std::vector<Runtime_Fun::Fun> fun_stack;
 
+        std::size_t total = 0;
+        for(auto& piece : pieces){
+                total += piece.functions.size();
+        }
+        p.functions.reserve(total);
 
-        pegtl::file_parser(fileName).parse< L3::grammar, L3::action
-                                            >(p,
-                                                                     the_stack,
-                                                                     op_stack,
-                                                                     fun_stack);
+        for(auto& piece : pieces){
+                std::move(piece.functions.begin(),
+                          piece.functions.end(),
+                          std::back_inserter(p.functions));
+        }
 
         return p;
 }
 
+void L3::parse_file_streaming (std::string fileName,
+                               Program::Function_Sink sink,
+                               Parser_Backend backend){
+
+        if(backend == Parser_Backend::ll){
+                ll_parse_file_streaming(fileName, sink);
+                return;
+        }
+
+        Program p;
+        p.function_sink = sink;
+        pegtl_parse(fileName, p);
+}
+
 
 #ifdef UNIT_TEST
 
@@ -174,7 +264,7 @@ TEST_CASE("Name Grabber"){
         std::string ptest10 = ptestdir + "ptest10.L3";
         Program p = parse_file(ptest10);
 
-        auto first_fun = p.functions[0];
+        auto& first_fun = p.functions[0];
 
         auto names = first_fun->grabber_of_the_vars();
 
@@ -189,14 +279,18 @@ TEST_CASE("Name Grabber"){
                                                               "mlorp",
                                                               "mlerp",
                                                               "no"};
-        REQUIRE(names == expected_names);
+        std::unordered_set<Symbol> expected_symbols;
+        for(auto& n : expected_names){
+                expected_symbols.insert(Symbol{n});
+        }
+        REQUIRE(names == expected_symbols);
 }
 
 TEST_CASE("labelgrabber"){
         std::string ptest10 = ptestdir + "ptest10.L3";
         Program p = parse_file(ptest10);
 
-        auto first_fun = p.functions[0];
+        auto& first_fun = p.functions[0];
 
         auto names = first_fun->grabber_of_the_labels();
 
@@ -210,7 +304,7 @@ TEST_CASE("prefixFinder"){
         std::string ptest10 = ptestdir + "ptest10.L3";
         Program p = parse_file(ptest10);
 
-        auto first_fun = p.functions[0];
+        auto& first_fun = p.functions[0];
 
         auto names = first_fun->grabber_of_the_labels();
 
@@ -234,7 +328,7 @@ TEST_CASE("please. please. please.", "[!mayfail]"){
         std::string ptest10 = ptestdir + "ptest10.L3";
         Program p = parse_file(ptest10);
 
-        auto first_fun = p.functions[0];
+        auto& first_fun = p.functions[0];
 
         auto the_prefix = std::string("some_prefix");
 
@@ -455,7 +455,7 @@ namespace L3{
                 L3_Parse_Stack<L3_ptr<AST_Item>> &the_stack,  \
                 std::vector<Binop::Op> &op_stack,             \
                 std::vector<Runtime_Fun::Fun> &fun_stack){    \
-                the_stack.push(L3_ptr<AST_Item>{new Var{in.string()}}); \
+                the_stack.push(make_AST<Var>(Symbol(in.begin(), in.size()))); \
 }                                                             \
 };
         RT_FUN_ACTION(print);
@@ -469,7 +469,7 @@ namespace L3{
                 L3_Parse_Stack<L3_ptr<AST_Item>> &the_stack,
                 std::vector<Binop::Op> &op_stack,
                 std::vector<Runtime_Fun::Fun> &fun_stack){
-        the_stack.push(L3_ptr<AST_Item>{new Int_Literal{stoll(in.string())}});
+        the_stack.push(make_AST<Int_Literal>(decode_int64(in.begin(), in.end())));
 }
 };
 
@@ -479,7 +479,7 @@ namespace L3{
                 L3_Parse_Stack<L3_ptr<AST_Item>> &the_stack,
                 std::vector<Binop::Op> &op_stack,
                 std::vector<Runtime_Fun::Fun> &fun_stack){
-        the_stack.push(L3_ptr<AST_Item>{new Var{in.string()}});
+        the_stack.push(make_AST<Var>(Symbol(in.begin(), in.size())));
 }
 };
 
@@ -491,7 +491,7 @@ namespace L3{
                 std::vector<Binop::Op> &op_stack,
                 std::vector<Runtime_Fun::Fun> &fun_stack){
 
-        the_stack.push(L3_ptr<AST_Item>{new Label{in.string()}});
+        the_stack.push(make_AST<Label>(Symbol(in.begin(), in.size())));
 }
 };
 
@@ -508,7 +508,7 @@ namespace L3{
                 L3_Parse_Stack<L3_ptr<AST_Item>> &the_stack,
                 std::vector<Binop::Op> &op_stack,
                 std::vector<Runtime_Fun::Fun> &fun_stack){
-        the_stack.push(ast_ptr{new Store(the_stack.pop())});
+        the_stack.push(make_AST<Store>(the_stack.pop()));
 }
 };
 
@@ -518,7 +518,7 @@ namespace L3{
                 L3_Parse_Stack<L3_ptr<AST_Item>> &the_stack,
                 std::vector<Binop::Op> &op_stack,
                 std::vector<Runtime_Fun::Fun> &fun_stack){
-        the_stack.push(ast_ptr{new Load(the_stack.pop())});
+        the_stack.push(make_AST<Load>(the_stack.pop()));
 }
 };
 
@@ -529,7 +529,7 @@ namespace L3{
                 L3_Parse_Stack<L3_ptr<AST_Item>> &the_stack,
                 std::vector<Binop::Op> &op_stack,
                 std::vector<Runtime_Fun::Fun> &fun_stack){
-        the_stack.push(ast_ptr{new STAHP()});
+        the_stack.open_frame();
 }
 };
 
@@ -541,14 +541,11 @@ namespace L3{
                 std::vector<Binop::Op> &op_stack,
                 std::vector<Runtime_Fun::Fun> &fun_stack){
 
-        std::vector<ast_ptr> everything;
-        while(! dynamic_cast<STAHP*>(the_stack.peek().get())){
-        everything.insert(everything.begin(), the_stack.downcast_pop<AST_Item>());
-}
-
-        the_stack.pop(); // clear STAHP
+        Instruction::Operands everything;
+        everything.reserve(the_stack.frame_size());
+        the_stack.take_frame<AST_Item>([&](ast_ptr item){ everything.push_back(item); });
 
-        the_stack.push(L3_ptr<AST_Item>{new Call(everything)});
+        the_stack.push(make_AST<Call>(std::move(everything)));
 
         }
         };
@@ -575,8 +572,7 @@ namespace L3{
                         auto true_target = the_stack.downcast_pop<Label>();
                         auto cond = the_stack.downcast_pop<Var>();
 
-                        curfun_instr_push(p, L3_ptr<Instruction>{
-                                        new Cjump{cond, true_target, false_target}});
+                        curfun_instr_push(p, make_node<Cjump>(cond, true_target, false_target));
                 }
         };
 
@@ -588,8 +584,7 @@ namespace L3{
                                   std::vector<Binop::Op> &op_stack,
                                   std::vector<Runtime_Fun::Fun> &fun_stack){
 
-                        curfun_instr_push(p, L3_ptr<Instruction>{
-                                        new Label{in.string()}});
+                        curfun_instr_push(p, make_node<Label>(Symbol(in.begin(), in.size())));
                 }
         };
 
@@ -600,9 +595,7 @@ namespace L3{
                                   L3_Parse_Stack<L3_ptr<AST_Item>> &the_stack,
                                   std::vector<Binop::Op> &op_stack,
                                   std::vector<Runtime_Fun::Fun> &fun_stack){
-                        curfun_instr_push(p, L3_ptr<Instruction>{new Goto{
-                                                the_stack.downcast_pop<Label>()
-                                                        }});
+                        curfun_instr_push(p, make_node<Goto>(the_stack.downcast_pop<Label>()));
 
                         the_stack.NUKE();
                 }
@@ -628,9 +621,7 @@ namespace L3{
                                 op = Binop::Op::leq;
                                 std::swap(lhs, rhs);
                         }
-                        the_stack.push(L3_ptr<AST_Item>{new Binop{op,
-                                                        lhs,
-                                                        rhs}});
+                        the_stack.push(make_AST<Binop>(op, lhs, rhs));
 
                         op_stack.pop_back();
                 }
@@ -645,8 +636,7 @@ namespace L3{
                                   std::vector<Runtime_Fun::Fun> &fun_stack){
                         auto rhs = the_stack.downcast_pop<AST_Item>();
                         auto lhs = the_stack.downcast_pop<AST_Item>();
-                        curfun_instr_push(p, L3_ptr<Instruction>{new
-                                                Assignment{lhs, rhs}});
+                        curfun_instr_push(p, make_node<Assignment>(lhs, rhs));
                 }
         };
 
@@ -658,8 +648,7 @@ namespace L3{
                                   std::vector<Binop::Op> &op_stack,
                                   std::vector<Runtime_Fun::Fun> &fun_stack){
 
-                        curfun_instr_push(p, L3_ptr<Instruction>{new
-                                                Val_Return{the_stack.downcast_pop<AST_Item>()}});
+                        curfun_instr_push(p, make_node<Val_Return>(the_stack.downcast_pop<AST_Item>()));
 
                         the_stack.NUKE();
                 }
@@ -671,7 +660,7 @@ namespace L3{
                                   L3_Parse_Stack<L3_ptr<AST_Item>> &the_stack,
                                   std::vector<Binop::Op> &op_stack,
                                   std::vector<Runtime_Fun::Fun> &fun_stack){
-                        curfun_instr_push(p, L3_ptr<Instruction>{new Void_Return{}});
+                        curfun_instr_push(p, make_node<Void_Return>());
                 }
         };
 
@@ -684,9 +673,13 @@ namespace L3{
 
                         auto name = the_stack.downcast_pop<Label>();
 
-                        p.functions.push_back(std::make_shared<Function>(*name));
+                        p.functions.emplace_back(new Function{*name});
+
+                        // everything up to the closing brace belongs to it
+                        Arena::push_current(p.functions.back()->arena);
 
                         the_stack.NUKE();
+                        the_stack.open_frame(); // for the params
                 }
         };
 
@@ -697,15 +690,48 @@ namespace L3{
                                   L3_Parse_Stack<L3_ptr<AST_Item>> &the_stack,
                                   std::vector<Binop::Op> &op_stack,
                                   std::vector<Runtime_Fun::Fun> &fun_stack){
-                        auto curf = p.functions.back();
+                        auto& curf = p.functions.back();
+
+                        curf->params.reserve(the_stack.frame_size());
+                        the_stack.take_frame<Var>([&](Var* param){ curf->params.push_back(*param); });
+                }
+        };
+
+        template<> struct action<function>{
+                static void apply(const pegtl::input &in,
+                                  Program &p,
+                                  L3_Parse_Stack<L3_ptr<AST_Item>> &the_stack,
+                                  std::vector<Binop::Op> &op_stack,
+                                  std::vector<Runtime_Fun::Fun> &fun_stack){
+                        Arena::pop_current();
 
-                        while(!the_stack.is_empty()){
-                                curf->params.insert(curf->params.begin(),
-                                                    *the_stack.downcast_pop<Var>());
+                        if(p.function_sink){
+                                auto done = std::move(p.functions.back());
+                                p.functions.pop_back();
+                                p.function_sink(std::move(done));
                         }
                 }
         };
 
-        Program parse_file (std::string fileName);
+        enum class Parser_Backend{
+                pegtl, // the grammar above
+                ll     // tokenize, then predictive parse. See ll_parser.h
+        };
+
+        Program parse_file (std::string fileName,
+                            Parser_Backend backend = Parser_Backend::pegtl);
+
+        // Cut the source at function boundaries and parse the pieces on
+        // jobs threads (0 means one per core), each with its own stacks.
+        // Functions come out in source order.
+        Program parse_file_parallel (std::string fileName,
+                                     unsigned jobs,
+                                     Parser_Backend backend = Parser_Backend::pegtl);
+
+        // Same parse, but each function goes to sink the moment it's complete
+        // and nothing is kept around afterwards.
+        void parse_file_streaming (std::string fileName,
+                                   Program::Function_Sink sink,
+                                   Parser_Backend backend = Parser_Backend::pegtl);
         Function parse_function_file (std::string fileName);
 }
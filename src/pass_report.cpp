@@ -0,0 +1,14 @@
+#include <pass_report.h>
+
+using namespace L3;
+
+void Pass_Report::print_totals(std::ostream& out, const char* pass, const char* unit) const{
+        int64_t b = before;
+        int64_t a = after;
+        out << pass << ": " << b << " " << unit << " in, " << a << " out, "
+            << b - a << " removed";
+        if(b){
+                out << " (" << 100.0 * (b - a) / b << "%)";
+        }
+        out << "\n";
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <ostream>
+
+namespace L3{
+
+        // What a pass did, summed over however many functions and threads
+        // ran it. Each pass's report adds its own counters on top.
+        struct Pass_Report{
+                std::atomic<int64_t> before{0}; // instructions in
+                std::atomic<int64_t> after{0};  // and out
+
+        protected:
+                // "<pass>: N <unit> in, M out, K removed (P%)", and a newline
+                void print_totals(std::ostream& out, const char* pass, const char* unit) const;
+        };
+}
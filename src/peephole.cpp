@@ -0,0 +1,419 @@
+#include <peephole.h>
+
+#ifdef UNIT_TEST
+#include <catch.hpp>
+#include <ll_parser.h>
+#include <iostream>
+#include <sstream>
+#endif
+
+using namespace L3;
+
+namespace{
+        using Op = L2_Inst::Op;
+        using Operand_Kind = L2_Operand::Kind;
+
+        // How far back already_there looks for the same move
+        const std::size_t lookback = 8;
+
+        L2_Inst& nth_newest(L2_Insts& done, std::size_t n){
+                return done[done.size() - 1 - n];
+        }
+
+        // Drops the instruction before the newest one
+        void drop_second_newest(L2_Insts& done){
+                nth_newest(done, 1) = done.back();
+                done.pop_back();
+        }
+
+        // (x <- x)
+        bool self_move(L2_Insts& done){
+                auto& last = done.back();
+                if(last.op == Op::move && last.dst == last.x){
+                        done.pop_back();
+                        return true;
+                }
+                return false;
+        }
+
+        bool is_identity(Binop::Op how, int64_t num){
+                switch(how){
+                case(Binop::plus):
+                case(Binop::minus):
+                case(Binop::left_shift):
+                case(Binop::right_shift):
+                        return num == 0;
+                case(Binop::mult):
+                        return num == 1;
+                case(Binop::and_):
+                        return num == -1;
+                default:
+                        return false;
+                }
+        }
+
+        // (x += 0), (x *= 1) and friends
+        bool do_nothing_arith(L2_Insts& done){
+                auto& last = done.back();
+                if(last.op == Op::arith && last.x.kind == Operand_Kind::num && is_identity(last.how, last.x.num)){
+                        done.pop_back();
+                        return true;
+                }
+                return false;
+        }
+
+        // (goto :l) right before :l
+        bool goto_next(L2_Insts& done){
+                auto& jump = nth_newest(done, 1);
+                auto& label = done.back();
+                if(jump.op == Op::goto_ && label.op == Op::label && jump.t == label.t){
+                        drop_second_newest(done);
+                        return true;
+                }
+                return false;
+        }
+
+        // (a <- b) (b <- a): b has it already
+        bool move_back(L2_Insts& done){
+                auto& first = nth_newest(done, 1);
+                auto& last = done.back();
+                if(first.op != Op::move || last.op != Op::move
+                   || last.dst != first.x || last.x != first.dst){
+                        return false;
+                }
+                // (x <- (mem x 0)) moved what the mem means
+                if(first.dst.kind == Operand_Kind::name && first.x.mentions(first.dst.name)){
+                        return false;
+                }
+                done.pop_back();
+                return true;
+        }
+
+        // (a <- s) right before something that sets a without reading it
+        bool overwritten_move(L2_Insts& done){
+                auto& first = nth_newest(done, 1);
+                auto& last = done.back();
+                // loads stay, they could fault
+                if(first.op != Op::move || first.dst.kind != Operand_Kind::name || first.x.kind == Operand_Kind::mem){
+                        return false;
+                }
+
+                auto a = first.dst.name;
+                bool sets = (last.op == Op::move || last.op == Op::compare || last.op == Op::lea)
+                        && last.dst.is_name(a);
+                if(!sets || last.reads(a)){
+                        return false;
+                }
+                drop_second_newest(done);
+                return true;
+        }
+
+        // (a <- N) (a op= M) is just (a <- N op M)
+        bool constant_arith(L2_Insts& done){
+                auto& first = nth_newest(done, 1);
+                auto& last = done.back();
+                if(first.op != Op::move || first.dst.kind != Operand_Kind::name
+                   || first.x.kind != Operand_Kind::num || last.dst != first.dst){
+                        return false;
+                }
+
+                int64_t result;
+                if(last.op == Op::arith && last.x.kind == Operand_Kind::num){
+                        result = evaluate(last.how, first.x.num, last.x.num);
+                } else if(last.op == Op::inc){
+                        result = evaluate(Binop::plus, first.x.num, 1);
+                } else if(last.op == Op::dec){
+                        result = evaluate(Binop::minus, first.x.num, 1);
+                } else {
+                        return false;
+                }
+
+                first.x.num = result;
+                done.pop_back();
+                return true;
+        }
+
+        // (d <- s) when d got s a few instructions back and neither has
+        // changed since, or s got d.
+        bool already_there(L2_Insts& done){
+                auto& last = done.back();
+                if(last.op != Op::move || last.dst.kind != Operand_Kind::name || last.x.kind == Operand_Kind::mem){
+                        return false;
+                }
+
+                auto d = last.dst.name;
+                bool s_is_name = last.x.kind == Operand_Kind::name;
+                for(std::size_t n = 1; n <= lookback && n < done.size(); n++){
+                        auto& inst = nth_newest(done, n);
+                        if(inst.op == Op::move
+                           && ((inst.dst == last.dst && inst.x == last.x)
+                               || (inst.dst == last.x && inst.x == last.dst))){
+                                done.pop_back();
+                                return true;
+                        }
+
+                        // control can come in or go out here, and calls
+                        // clobber registers
+                        if(inst.op == Op::label || inst.op == Op::call || inst.op == Op::goto_
+                           || inst.op == Op::cjump || inst.op == Op::return_){
+                                return false;
+                        }
+                        if(inst.writes(d) || (s_is_name && inst.writes(last.x.name))){
+                                return false;
+                        }
+                }
+                return false;
+        }
+}
+
+const std::vector<Peephole_Rule>& L3::peephole_rules(){
+        static const std::vector<Peephole_Rule> rules{
+                {"self move",        1, self_move},
+                {"do-nothing arith", 1, do_nothing_arith},
+                {"goto next",        2, goto_next},
+                {"move back",        2, move_back},
+                {"overwritten move", 2, overwritten_move},
+                {"constant arith",   2, constant_arith},
+                {"already there",    2, already_there},
+        };
+        return rules;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                  Running                                  //
+///////////////////////////////////////////////////////////////////////////////
+
+Peephole_Report::Peephole_Report(const std::vector<Peephole_Rule>& rules) :
+        fired(rules.size())
+{
+        for(auto& rule : rules){
+                names.push_back(rule.name);
+        }
+}
+
+void Peephole_Report::print(std::ostream& out) const{
+        print_totals(out, "peephole", "L2 instructions");
+        for(std::size_t r = 0; r < names.size(); r++){
+                out << "  " << names[r] << ": " << fired[r] << "\n";
+        }
+}
+
+Peephole::Peephole(const std::vector<Peephole_Rule>& rules) :
+        rules(rules)
+{}
+
+void Peephole::run(L2_Insts& insts, Peephole_Report* report) const{
+        L2_Insts done;
+        done.reserve(insts.size());
+
+        for(auto& inst : insts){
+                done.push_back(inst);
+
+                // Every firing leaves fewer instructions, so this stops
+                bool again = true;
+                while(again){
+                        again = false;
+                        for(std::size_t r = 0; r < rules.size(); r++){
+                                if(done.size() >= rules[r].window && rules[r].apply(done)){
+                                        if(report){
+                                                report->fired[r]++;
+                                        }
+                                        again = !done.empty();
+                                        break;
+                                }
+                        }
+                }
+        }
+
+        if(report){
+                report->before += insts.size();
+                report->after += done.size();
+        }
+        insts.swap(done);
+}
+
+#ifdef UNIT_TEST
+namespace{
+        L2_Operand v(const char* name){
+                return L2_Operand::var(Symbol{std::string(name)});
+        }
+
+        L2_Operand n(int64_t num){
+                return L2_Operand::number(num);
+        }
+
+        Symbol l(const char* name){
+                return Symbol{std::string(name)};
+        }
+
+        std::string peep(L2_Insts insts, Peephole_Report* report = nullptr){
+                Peephole{}.run(insts, report);
+                L2_Out out;
+                print(insts, out);
+                return out.str();
+        }
+}
+
+TEST_CASE("the peephole drops what it can prove does nothing"){
+        SECTION("self moves and identities"){
+                REQUIRE(peep({L2_Inst::move(v("x"), v("x")),
+                              L2_Inst::arith(v("x"), Binop::plus, n(0)),
+                              L2_Inst::arith(v("x"), Binop::mult, n(1)),
+                              L2_Inst::arith(v("x"), Binop::mult, n(2)),
+                              L2_Inst::return_()}) ==
+                        "(x *= 2)\n"
+                        "(return)\n");
+        }
+
+        SECTION("gotos to the next instruction"){
+                REQUIRE(peep({L2_Inst::goto_(l(":next")),
+                              L2_Inst::label(l(":next")),
+                              L2_Inst::goto_(l(":elsewhere")),
+                              L2_Inst::label(l(":next2"))}) ==
+                        ":next\n"
+                        "(goto :elsewhere)\n"
+                        ":next2\n");
+        }
+
+        SECTION("moving a value back where it came from"){
+                REQUIRE(peep({L2_Inst::move(v("r"), v("rax")),
+                              L2_Inst::move(v("rax"), v("r")),
+                              L2_Inst::move(v("p"), L2_Operand::mem(l("p"), 0)),
+                              L2_Inst::move(L2_Operand::mem(l("p"), 0), v("p")),
+                              L2_Inst::return_()}) ==
+                        "(r <- rax)\n"
+                        "(p <- (mem p 0))\n"
+                        "((mem p 0) <- p)\n"
+                        "(return)\n");
+        }
+
+        SECTION("moves overwritten right away, but not loads or ones that get read"){
+                REQUIRE(peep({L2_Inst::move(v("x"), v("a")),
+                              L2_Inst::move(v("x"), v("b")),
+                              L2_Inst::move(v("y"), v("a")),
+                              L2_Inst::compare(v("y"), v("y"), Binop::le, v("b")),
+                              L2_Inst::move(v("z"), L2_Operand::mem(l("a"), 0)),
+                              L2_Inst::move(v("z"), n(1)),
+                              L2_Inst::return_()}) ==
+                        "(x <- b)\n"
+                        "(y <- a)\n"
+                        "(y <- y < b)\n"
+                        "(z <- (mem a 0))\n"
+                        "(z <- 1)\n"
+                        "(return)\n");
+        }
+
+        SECTION("constants fold, and that can set up more folding"){
+                REQUIRE(peep({L2_Inst::move(v("x"), n(5)),
+                              L2_Inst::arith(v("x"), Binop::mult, n(8)),
+                              L2_Inst::arith(v("x"), Binop::plus, n(1)),
+                              L2_Inst::inc(v("x")),
+                              L2_Inst::move(v("y"), n(1)),
+                              L2_Inst::arith(v("y"), Binop::left_shift, n(63)),
+                              L2_Inst::arith(v("y"), Binop::minus, n(1)),
+                              L2_Inst::return_()}) ==
+                        "(x <- 42)\n"
+                        "(y <- 9223372036854775807)\n"
+                        "(return)\n");
+        }
+
+        SECTION("args that are already where they need to be"){
+                REQUIRE(peep({L2_Inst::move(v("rdi"), v("a")),
+                              L2_Inst::call(v("print"), 1),
+                              L2_Inst::move(v("rdi"), v("a")),
+                              L2_Inst::move(v("rsi"), v("b")),
+                              L2_Inst::move(v("rdi"), v("a")),
+                              L2_Inst::move(v("b"), v("rsi")),
+                              L2_Inst::arith(v("a"), Binop::plus, n(2)),
+                              L2_Inst::move(v("rdi"), v("a")),
+                              L2_Inst::return_()}) ==
+                        "(rdi <- a)\n"
+                        "(call print 1)\n"
+                        "(rdi <- a)\n"
+                        "(rsi <- b)\n"
+                        "(a += 2)\n"
+                        "(rdi <- a)\n"
+                        "(return)\n");
+        }
+}
+
+TEST_CASE("peephole rules are pluggable and get counted"){
+        std::vector<Peephole_Rule> just_gotos{peephole_rules()[2]};
+        Peephole only_gotos{just_gotos};
+        Peephole_Report report{just_gotos};
+
+        L2_Insts insts{L2_Inst::move(v("x"), v("x")),
+                       L2_Inst::goto_(l(":next")),
+                       L2_Inst::label(l(":next"))};
+        only_gotos.run(insts, &report);
+
+        REQUIRE(insts.size() == 2);
+        REQUIRE(report.before == 3);
+        REQUIRE(report.after == 2);
+        REQUIRE(report.fired[0] == 1);
+
+        std::stringstream ss;
+        report.print(ss);
+        REQUIRE(ss.str() ==
+                "peephole: 3 L2 instructions in, 2 out, 1 removed (33.3333%)\n"
+                "  goto next: 1\n");
+}
+
+TEST_CASE("a function's L2 skips the peephole when asked to"){
+        std::string src = "define :f(){\n"
+                          "  br :next\n"
+                          "  :next\n"
+                          "  return\n"
+                          "}\n";
+        Program p = ll_parse(src.data(), src.data() + src.size(), "test");
+        auto emitted = [&](bool peephole){
+                L2_Out out;
+                p.functions[0]->emit_l2(out, [](){return std::string(":ret");}, Tiling::munch,
+                                        Label_Names{}, nullptr, peephole);
+                return out.str();
+        };
+
+        REQUIRE(emitted(false).find("(goto :next)") != std::string::npos);
+        REQUIRE(emitted(true).find("(goto :next)") == std::string::npos);
+}
+
+TEST_CASE("peephole on the bench programs", "[.][bench]"){
+        std::string src;
+        for(int f = 0; f < 5000; f++){
+                auto n = std::to_string(f);
+                src += "define :f" + n + "(a, b, p){\n"
+                        "  :top\n"
+                        "  t1 <- a + b\n"
+                        "  t2 <- t1 * 8\n"
+                        "  t3 <- p + t2\n"
+                        "  v <- load t3\n"
+                        "  w <- v + 1\n"
+                        "  store t3 <- w\n"
+                        "  a <- a - 1\n"
+                        "  c <- 0 < a\n"
+                        "  br c :top :out\n"
+                        "  :out\n"
+                        "  k <- 5\n"
+                        "  k <- k * 8\n"
+                        "  s <- b - a\n"
+                        "  call print(s)\n"
+                        "  r <- call :f0(a, b, p)\n"
+                        "  r <- r + a\n"
+                        "  br :done\n"
+                        "  :done\n"
+                        "  return r\n"
+                        "}\n";
+        }
+        Program p = ll_parse(src.data(), src.data() + src.size(), "bench");
+
+        for(auto tiling : {Tiling::munch, Tiling::dp}){
+                Peephole_Report report{peephole_rules()};
+                L2_Out out;
+                for(auto& fun : p.functions){
+                        fun->emit_l2(out, [](){return std::string(":ret");}, tiling, Label_Names{}, &report);
+                }
+                std::cout << (tiling == Tiling::munch ? "munch " : "dp ");
+                report.print(std::cout);
+        }
+}
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <l2.h>
+#include <pass_report.h>
+
+#include <atomic>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+namespace L3{
+
+/*
+  Cleanup over a function's L2 instructions after tiling, before any text
+  gets written. Instructions go onto the output one at a time and after
+  each one every rule gets a look at the newest few. A rule that fires
+  rewrites that tail in place (always leaving fewer instructions), and then
+  all the rules get another go, so one rewrite can set up the next. That
+  keeps the whole thing linear however many rules there are.
+
+  Rules only know what the instructions themselves say: no liveness, so
+  nothing that writes a var or memory goes unless it's overwritten or
+  repeated right there.
+*/
+        struct Peephole_Rule{
+                const char* name;
+                std::size_t window; // how many of the newest instructions it looks at
+
+                // Rewrites the end of done if it can. True if it did.
+                bool (*apply)(L2_Insts& done);
+        };
+
+        // The stock set, see peephole.cpp
+        const std::vector<Peephole_Rule>& peephole_rules();
+
+        // L2 instructions in and out, and how often each rule fired
+        class Peephole_Report :
+                public Pass_Report{
+        public:
+                explicit Peephole_Report(const std::vector<Peephole_Rule>& rules);
+
+                void print(std::ostream& out) const;
+
+                std::vector<std::atomic<int64_t>> fired; // by rule
+
+        private:
+                std::vector<const char*> names;
+        };
+
+        class Peephole{
+        public:
+                explicit Peephole(const std::vector<Peephole_Rule>& rules = peephole_rules());
+
+                void run(L2_Insts& insts, Peephole_Report* report = nullptr) const;
+
+                std::vector<Peephole_Rule> rules;
+        };
+}
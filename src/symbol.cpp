@@ -0,0 +1,165 @@
+#include <symbol.h>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef UNIT_TEST
+#include <catch.hpp>
+#include <thread>
+#include <unordered_set>
+#endif
+
+using namespace L3;
+
+namespace{
+        // FNV-1a, names are short so anything fancier doesn't pay off
+        uint32_t hash_name(const char* begin, std::size_t len){
+                uint32_t h = 2166136261u;
+                for(std::size_t i = 0; i < len; i++){
+                        h ^= static_cast<unsigned char>(begin[i]);
+                        h *= 16777619u;
+                }
+                return h;
+        }
+}
+
+Symbol_Table& Symbol_Table::global(){
+        static Symbol_Table table;
+        return table;
+}
+
+Symbol_Table::Symbol_Table() :
+        slots(1024, 0)
+{
+        // id 0 is the empty name, so a default Symbol is always valid
+        insert_new("", 0, hash_name("", 0));
+}
+
+std::size_t Symbol_Table::size() const{
+        std::lock_guard<std::mutex> guard(lock);
+        return count;
+}
+
+uint32_t Symbol_Table::intern(const char* begin, std::size_t len){
+        uint32_t h = hash_name(begin, len);
+
+        std::lock_guard<std::mutex> guard(lock);
+
+        std::size_t mask = slots.size() - 1;
+        for(std::size_t i = h & mask; ; i = (i + 1) & mask){
+                uint32_t slot = slots[i];
+                if(!slot){
+                        break;
+                }
+                uint32_t id = slot - 1;
+                const std::string& known = text(id);
+                if(hashes[id] == h
+                   && known.size() == len
+                   && !std::memcmp(known.data(), begin, len)){
+                        return id;
+                }
+        }
+
+        return insert_new(begin, len, h);
+}
+
+uint32_t Symbol_Table::insert_new(const char* begin, std::size_t len, uint32_t hash){
+        uint32_t id = count;
+
+        if((id >> chunk_bits) >= max_chunks){
+                throw std::length_error("symbol table is full");
+        }
+        if(!(id & chunk_mask)){
+                chunks[id >> chunk_bits].reset(new std::string[chunk_mask + 1]);
+        }
+        chunks[id >> chunk_bits][id & chunk_mask].assign(begin, len);
+        hashes.push_back(hash);
+        count++;
+
+        // keep the load factor under a half
+        if(2 * count > slots.size()){
+                grow_index();
+        } else {
+                std::size_t mask = slots.size() - 1;
+                std::size_t i = hash & mask;
+                while(slots[i]){
+                        i = (i + 1) & mask;
+                }
+                slots[i] = id + 1;
+        }
+
+        return id;
+}
+
+void Symbol_Table::grow_index(){
+        std::vector<uint32_t> bigger(slots.size() * 2, 0);
+        std::size_t mask = bigger.size() - 1;
+
+        for(uint32_t id = 0; id < count; id++){
+                std::size_t i = hashes[id] & mask;
+                while(bigger[i]){
+                        i = (i + 1) & mask;
+                }
+                bigger[i] = id + 1;
+        }
+
+        slots.swap(bigger);
+}
+
+Symbol::Symbol() :
+        ident(0)
+{}
+
+Symbol::Symbol(const std::string& name) :
+        ident(Symbol_Table::global().intern(name.data(), name.size()))
+{}
+
+Symbol::Symbol(const char* begin, std::size_t len) :
+        ident(Symbol_Table::global().intern(begin, len))
+{}
+
+const std::string& Symbol::str() const{
+        return Symbol_Table::global().text(ident);
+}
+
+std::ostream& L3::operator<<(std::ostream& out, Symbol sym){
+        return out << sym.str();
+}
+
+#ifdef UNIT_TEST
+TEST_CASE("interning names"){
+        SECTION("same spelling, same symbol"){
+                Symbol a{std::string("some_var")};
+                std::string buf = "xxsome_varxx";
+                Symbol b{buf.data() + 2, 8};
+
+                REQUIRE(a == b);
+                REQUIRE(a.str() == "some_var");
+                REQUIRE(a != Symbol{std::string("some_var2")});
+                REQUIRE(Symbol().str() == "");
+        }
+
+        SECTION("lots of names from lots of threads"){
+                std::vector<std::thread> threads;
+                std::vector<std::vector<Symbol>> seen(4);
+
+                for(int t = 0; t < 4; t++){
+                        threads.emplace_back([t, &seen](){
+                                        for(int i = 0; i < 20000; i++){
+                                                seen[t].push_back(Symbol{"v" + std::to_string(i)});
+                                        }
+                                });
+                }
+                for(auto& t : threads){
+                        t.join();
+                }
+
+                for(int i = 0; i < 20000; i++){
+                        REQUIRE(seen[0][i] == seen[3][i]);
+                        REQUIRE(seen[1][i].str() == "v" + std::to_string(i));
+                }
+
+                std::unordered_set<Symbol> distinct(seen[2].begin(), seen[2].end());
+                REQUIRE(distinct.size() == 20000);
+        }
+}
+#endif
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace L3{
+
+/*
+  An interned name. Every distinct Var/Label spelling is stored once in the
+  Symbol_Table and nodes only carry its 32 bit id, so comparing, hashing and
+  set membership are integer operations. Ids are handed out in interning
+  order, which is not stable across parallel parses: never sort output by
+  them.
+*/
+        class Symbol{
+        public:
+                Symbol(); // the empty name
+                explicit Symbol(const std::string& name);
+                Symbol(const char* begin, std::size_t len);
+
+                const std::string& str() const;
+                uint32_t id() const { return ident; }
+
+                bool operator==(Symbol other) const { return ident == other.ident; }
+                bool operator!=(Symbol other) const { return ident != other.ident; }
+                bool operator<(Symbol other) const { return ident < other.ident; }
+
+        private:
+                uint32_t ident;
+        };
+
+        std::ostream& operator<<(std::ostream& out, Symbol sym);
+
+/*
+  The one string pool for a compilation. Interning takes a lock, reading a
+  name back out doesn't: strings live in fixed size chunks that never move,
+  so a name is readable by anyone who was handed its id.
+*/
+        class Symbol_Table{
+        public:
+                static Symbol_Table& global();
+
+                uint32_t intern(const char* begin, std::size_t len);
+
+                const std::string& text(uint32_t id) const{
+                        return chunks[id >> chunk_bits][id & chunk_mask];
+                }
+
+                std::size_t size() const;
+
+        private:
+                Symbol_Table();
+
+                static const unsigned chunk_bits = 12;
+                static const uint32_t chunk_mask = (1u << chunk_bits) - 1;
+                static const std::size_t max_chunks = 1u << 16;
+
+                uint32_t insert_new(const char* begin, std::size_t len, uint32_t hash);
+                void grow_index();
+
+                mutable std::mutex lock;
+                uint32_t count{0};
+
+                std::unique_ptr<std::string[]> chunks[max_chunks];
+
+                // open addressing, slots hold id + 1 so 0 can mean empty
+                std::vector<uint32_t> slots;
+                std::vector<uint32_t> hashes; // by id, so growing doesn't rehash strings
+        };
+}
+
+namespace std{
+        template<>
+        struct hash<L3::Symbol>{
+                std::size_t operator()(L3::Symbol sym) const{
+                        return sym.id();
+                }
+        };
+}
@@ -0,0 +1,124 @@
+#include <thread_pool.h>
+
+#ifdef UNIT_TEST
+#include <catch.hpp>
+#include <atomic>
+#include <stdexcept>
+#endif
+
+using namespace L3;
+
+Thread_Pool::Thread_Pool(unsigned workers){
+        if(workers == 0){
+                workers = std::thread::hardware_concurrency();
+        }
+        if(workers == 0){
+                workers = 1;
+        }
+
+        threads.reserve(workers);
+        for(unsigned i = 0; i < workers; i++){
+                threads.emplace_back([this](){ work(); });
+        }
+}
+
+Thread_Pool::~Thread_Pool(){
+        {
+                std::lock_guard<std::mutex> guard(lock);
+                shutting_down = true;
+        }
+        job_ready.notify_all();
+
+        for(auto& t : threads){
+                t.join();
+        }
+}
+
+void Thread_Pool::submit(std::function<void()> job){
+        {
+                std::lock_guard<std::mutex> guard(lock);
+                jobs.push_back(std::move(job));
+                unfinished++;
+        }
+        job_ready.notify_one();
+}
+
+void Thread_Pool::wait(){
+        std::unique_lock<std::mutex> guard(lock);
+        all_done.wait(guard, [this](){ return unfinished == 0; });
+
+        if(first_failure){
+                auto failure = first_failure;
+                first_failure = nullptr;
+                std::rethrow_exception(failure);
+        }
+}
+
+void Thread_Pool::work(){
+        while(true){
+                std::function<void()> job;
+                {
+                        std::unique_lock<std::mutex> guard(lock);
+                        job_ready.wait(guard, [this](){ return shutting_down || !jobs.empty(); });
+
+                        if(jobs.empty()){
+                                return;
+                        }
+                        job = std::move(jobs.front());
+                        jobs.pop_front();
+                }
+
+                std::exception_ptr failure;
+                try{
+                        job();
+                } catch(...){
+                        failure = std::current_exception();
+                }
+
+                std::lock_guard<std::mutex> guard(lock);
+                if(failure && !first_failure){
+                        first_failure = failure;
+                }
+                if(--unfinished == 0){
+                        all_done.notify_all();
+                }
+        }
+}
+
+void L3::parallel_for(Thread_Pool& pool, std::size_t n, std::function<void(std::size_t)> body){
+        for(std::size_t i = 0; i < n; i++){
+                pool.submit([&body, i](){ body(i); });
+        }
+        pool.wait();
+}
+
+#ifdef UNIT_TEST
+TEST_CASE("thread pool runs everything and reports failures"){
+        Thread_Pool pool(4);
+
+        SECTION("every index exactly once"){
+                std::vector<std::atomic<int>> hits(1000);
+                for(auto& h : hits){
+                        h = 0;
+                }
+                parallel_for(pool, hits.size(), [&](std::size_t i){ hits[i]++; });
+
+                for(auto& h : hits){
+                        REQUIRE(h == 1);
+                }
+        }
+
+        SECTION("exceptions come back out of wait"){
+                REQUIRE_THROWS_AS(parallel_for(pool, 10, [](std::size_t i){
+                                        if(i == 7){
+                                                throw std::runtime_error("nope");
+                                        }
+                                }), std::runtime_error);
+
+                // and the pool is still usable afterwards
+                std::atomic<int> count{0};
+                parallel_for(pool, 10, [&](std::size_t){ count++; });
+                REQUIRE(count == 10);
+        }
+}
+#endif
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace L3{
+
+/*
+  A fixed set of worker threads pulling jobs off one queue. wait() blocks
+  until every submitted job is done and rethrows the first exception any of
+  them threw.
+*/
+        class Thread_Pool{
+        public:
+                // 0 means one worker per hardware thread
+                explicit Thread_Pool(unsigned workers = 0);
+                ~Thread_Pool();
+
+                Thread_Pool(const Thread_Pool&) = delete;
+                Thread_Pool& operator=(const Thread_Pool&) = delete;
+
+                void submit(std::function<void()> job);
+
+                void wait();
+
+                unsigned size() const { return threads.size(); }
+
+        private:
+                void work();
+
+                std::vector<std::thread> threads;
+                std::deque<std::function<void()>> jobs;
+
+                std::mutex lock;
+                std::condition_variable job_ready;
+                std::condition_variable all_done;
+
+                std::size_t unfinished{0};
+                bool shutting_down{false};
+                std::exception_ptr first_failure;
+        };
+
+        // Run body(i) for every i in [0, n) on the pool and wait for all of them.
+        void parallel_for(Thread_Pool& pool, std::size_t n, std::function<void(std::size_t)> body);
+}
@@ -0,0 +1,1282 @@
+#include <tile_o_tron_4000.h>
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <stdexcept>
+
+#ifdef UNIT_TEST
+#include <catch.hpp>
+#include <ll_parser.h>
+#include <label_scoping.h>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#endif
+
+using namespace L3;
+
+namespace{
+        const int64_t never = std::numeric_limits<int64_t>::max();
+
+        // (d += 1) and (d -= 1) go out as (d++) and (d--)
+        L2_Inst update(L2_Operand dest, Binop::Op how, L2_Operand by){
+                if(dest.kind == L2_Operand::Kind::name && by.kind == L2_Operand::Kind::num
+                   && (how == Binop::plus || how == Binop::minus) && (by.num == 1 || by.num == -1)){
+                        bool up = (how == Binop::plus) == (by.num == 1);
+                        return up ? L2_Inst::inc(dest) : L2_Inst::dec(dest);
+                }
+                return L2_Inst::arith(dest, how, by);
+        }
+
+        const Symbol& rax(){
+                static const Symbol it{std::string("rax")};
+                return it;
+        }
+
+        const Symbol& rsp(){
+                static const Symbol it{std::string("rsp")};
+                return it;
+        }
+
+        const std::array<Symbol, 6>& arg_regs(){
+                static const std::array<Symbol, 6> them = {Symbol{std::string("rdi")},
+                                                           Symbol{std::string("rsi")},
+                                                           Symbol{std::string("rdx")},
+                                                           Symbol{std::string("rcx")},
+                                                           Symbol{std::string("r8")},
+                                                           Symbol{std::string("r9")}};
+                return them;
+        }
+
+        bool is_var_named(ast_ptr item, Symbol name){
+                auto var = node_cast<Var>(item);
+                return var && var->name == name;
+        }
+}
+
+Tile_O_Tron_4000::Tile_O_Tron_4000(Function& fun,
+                                   std::function<std::string()> name_gen,
+                                   const Label_Names& labels,
+                                   L2_Insts& result) :
+        fun(fun),
+        name_gen(name_gen),
+        labels(labels),
+        result(result)
+{}
+
+void Tile_O_Tron_4000::tile(){
+        find_trees();
+        fun.accept(*this);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                               Finding trees                               //
+///////////////////////////////////////////////////////////////////////////////
+
+void Tile_O_Tron_4000::find_trees(){
+        auto& insts = fun.instructions;
+        const int64_t n = insts.size();
+
+        struct Use{
+                ast_ptr operand;
+                Slot slot;
+                int64_t at;
+        };
+
+        std::vector<int64_t> block(n);
+        std::vector<int64_t> next_barrier(n, never);
+        std::unordered_map<Symbol, std::vector<int64_t>> defs;
+        std::unordered_map<Symbol, std::vector<Use>> uses;
+
+        auto use = [&](ast_ptr operand, Slot slot, int64_t at){
+                auto var = node_cast<Var>(operand);
+                if(!var || is_runtime_fun_name(var->name)){
+                        return;
+                }
+                uses[var->name].push_back(Use{operand, slot, at});
+        };
+
+        auto use_call = [&](Call* call, int64_t at){
+                use(call->get_callee(), Slot::callee, at);
+                for(auto arg : call->get_args()){
+                        use(arg, Slot::value, at);
+                }
+        };
+
+        // Stores and calls are what a load can't move past
+        auto is_barrier = [](ast_ptr inst){
+                if(auto assign = node_cast<Assignment>(inst)){
+                        return is_one_of<Store>(assign->get_lhs()) || is_one_of<Call>(assign->get_rhs());
+                }
+                return is_one_of<Call>(inst);
+        };
+
+        int64_t cur_block = 0;
+        for(int64_t i = 0; i < n; i++){
+                auto inst = insts[i];
+
+                if(is_one_of<Label>(inst)){
+                        cur_block++;
+                }
+                block[i] = cur_block;
+
+                if(auto assign = node_cast<Assignment>(inst)){
+                        auto lhs = assign->get_lhs();
+                        auto rhs = assign->get_rhs();
+
+                        if(auto var = node_cast<Var>(lhs)){
+                                defs[var->name].push_back(i);
+                        } else if(auto store = node_cast<Store>(lhs)){
+                                use(store->get_storee(), Slot::address, i);
+                        }
+
+                        if(auto binop = node_cast<Binop>(rhs)){
+                                use(binop->get_lhs(), Slot::arith, i);
+                                use(binop->get_rhs(), Slot::arith, i);
+                        } else if(auto load = node_cast<Load>(rhs)){
+                                use(load->get_loadee(), Slot::address, i);
+                        } else if(auto call = node_cast<Call>(rhs)){
+                                use_call(call, i);
+                        } else {
+                                use(rhs, Slot::value, i);
+                        }
+                } else if(auto call = node_cast<Call>(inst)){
+                        use_call(call, i);
+                } else if(auto cjump = node_cast<Cjump>(inst)){
+                        use(cjump->get_cond(), Slot::cond, i);
+                } else if(auto ret = node_cast<Val_Return>(inst)){
+                        use(ret->get_result(), Slot::value, i);
+                }
+
+                if(is_one_of<Goto, Cjump, Val_Return, Void_Return>(inst)){
+                        cur_block++;
+                }
+        }
+
+        for(int64_t i = n - 2; i >= 0; i--){
+                next_barrier[i] = is_barrier(insts[i + 1]) ? i + 1 : next_barrier[i + 1];
+        }
+
+        auto next_def = [&](Symbol name, int64_t after){
+                auto found = defs.find(name);
+                if(found == defs.end()){
+                        return never;
+                }
+                auto it = std::upper_bound(found->second.begin(), found->second.end(), after);
+                return it == found->second.end() ? never : *it;
+        };
+
+        // How far down the value of operand, as read at instruction i, stays put
+        auto good_until = [&](ast_ptr operand, int64_t i){
+                auto node = expand(operand);
+                if(is_tree(node)){
+                        return trees[node].good_until;
+                }
+                if(auto var = node_cast<Var>(node)){
+                        return next_def(var->name, i);
+                }
+                return never;
+        };
+
+        std::unordered_set<Symbol> params;
+        for(auto& param : fun.params){
+                params.insert(param.name);
+        }
+
+        // A base + 8k temp that only ever gets loaded from or stored to
+        // is free to rebuild at every one of those, so each use becomes
+        // (mem base 8k) and the base is what they read now. The base stays
+        // a var of its own, since it has more than one reader by then.
+        for(int64_t i = 0; i < n; i++){
+                auto assign = node_cast<Assignment>(insts[i]);
+                auto var = assign ? node_cast<Var>(assign->get_lhs()) : nullptr;
+                auto binop = assign ? node_cast<Binop>(assign->get_rhs()) : nullptr;
+                if(!var || !binop || params.count(var->name) || defs[var->name].size() != 1){
+                        continue;
+                }
+
+                auto found = uses.find(var->name);
+                auto base = node_cast<Var>(address_of(binop).base);
+                if(found == uses.end() || found->second.size() < 2 || !base || base->name == var->name){
+                        continue;
+                }
+
+                int64_t last = i;
+                bool only_addresses = true;
+                for(auto& u : found->second){
+                        only_addresses = only_addresses && u.slot == Slot::address && u.at > i && block[u.at] == block[i];
+                        last = std::max(last, u.at);
+                }
+                auto until = next_def(base->name, i);
+                if(!only_addresses || until < last){
+                        continue;
+                }
+
+                trees[binop] = Tree{var->name, until};
+                auto& base_uses = uses[base->name];
+                base_uses.erase(std::remove_if(base_uses.begin(), base_uses.end(),
+                                               [&](const Use& u){ return u.operand == base; }),
+                                base_uses.end());
+                for(auto& u : found->second){
+                        folded[u.operand] = binop;
+                        base_uses.push_back(Use{base, Slot::address, u.at});
+                }
+                swallowed.insert(insts[i]);
+        }
+
+        // Defs come before their use, so by the time a def is looked at
+        // everything feeding it has already been folded in.
+        for(int64_t i = 0; i < n; i++){
+                auto assign = node_cast<Assignment>(insts[i]);
+                auto var = assign ? node_cast<Var>(assign->get_lhs()) : nullptr;
+                if(!var || params.count(var->name)){
+                        continue;
+                }
+
+                auto rhs = assign->get_rhs();
+                if(is_one_of<Call>(rhs) || defs[var->name].size() != 1){
+                        continue;
+                }
+
+                auto found = uses.find(var->name);
+                if(found == uses.end() || found->second.size() != 1){
+                        continue;
+                }
+                auto& the_use = found->second.front();
+                if(the_use.at <= i || block[the_use.at] != block[i]){
+                        continue;
+                }
+
+                ast_ptr folds_to = rhs;
+                int64_t until;
+                if(auto binop = node_cast<Binop>(rhs)){
+                        until = std::min(good_until(binop->get_lhs(), i), good_until(binop->get_rhs(), i));
+                } else if(auto load = node_cast<Load>(rhs)){
+                        until = std::min(good_until(load->get_loadee(), i), next_barrier[i]);
+                } else {
+                        folds_to = expand(rhs);
+                        until = good_until(rhs, i);
+                }
+
+                if(until < the_use.at || !fits(folds_to, the_use.slot)){
+                        continue;
+                }
+
+                if(folds_to == rhs && is_tree(rhs)){
+                        trees[rhs] = Tree{var->name, until};
+                }
+                folded[the_use.operand] = folds_to;
+                swallowed.insert(insts[i]);
+        }
+}
+
+bool Tile_O_Tron_4000::fits(ast_ptr rhs, Slot slot){
+        switch(rhs->kind){
+        case Kind::binop:
+        case Kind::load:
+                return slot != Slot::callee;
+        case Kind::var:
+                return true;
+        case Kind::int_literal:
+                return slot == Slot::value || slot == Slot::arith;
+        case Kind::label:
+                return slot == Slot::value || slot == Slot::callee;
+        default:
+                return false;
+        }
+}
+
+ast_ptr Tile_O_Tron_4000::expand(ast_ptr operand){
+        auto found = folded.find(operand);
+        return found == folded.end() ? operand : found->second;
+}
+
+bool Tile_O_Tron_4000::is_tree(ast_ptr node){
+        return is_one_of<Binop, Load>(node);
+}
+
+Symbol Tile_O_Tron_4000::own_name(ast_ptr node){
+        auto found = trees.find(node);
+        if(found == trees.end()){
+                throw std::logic_error("only folded trees have a temp of their own");
+        }
+        return found->second.own;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                 Covering                                  //
+///////////////////////////////////////////////////////////////////////////////
+
+Tile_O_Tron_4000::Choice Tile_O_Tron_4000::best(ast_ptr node, Symbol dest){
+        auto found = memo.find(Key{node, dest});
+        if(found != memo.end()){
+                return found->second;
+        }
+
+        Choice pick{never, Cover::via_temp, Symbol{}};
+        auto consider = [&](int64_t cost, Cover cover, Symbol temp){
+                if(cost < pick.cost){
+                        pick = Choice{cost, cover, temp};
+                }
+        };
+
+        if(auto binop = node_cast<Binop>(node)){
+                auto a = expand(binop->get_lhs());
+                auto b = expand(binop->get_rhs());
+
+                // a goes into dest first, b gets read after. That's only
+                // wrong when b is dest itself and a isn't. A b that's read
+                // straight from memory reads its address then.
+                auto in_place_ok = [&](ast_ptr a, ast_ptr b){
+                        if(from_memory(b, binop->op)){
+                                Scaled_Sum sum;
+                                auto addr = expand(node_cast<Load>(b)->get_loadee());
+                                b = offset_sum(addr, sum) ? b : address_of(addr).base;
+                        }
+                        return !is_var_named(b, dest) || is_var_named(a, dest);
+                };
+
+                bool swappable = false;
+                switch(binop->op){
+                case(Binop::plus):
+                case(Binop::mult):
+                case(Binop::and_):
+                        swappable = true;
+                        // fall through
+                case(Binop::minus):
+                case(Binop::left_shift):
+                case(Binop::right_shift):
+                        if(in_place_ok(a, b)){
+                                consider(cost_operand(b, binop->op) + cost_into(a, dest) + 1, Cover::in_place, Symbol{});
+                        }
+                        if(swappable && in_place_ok(b, a)){
+                                consider(cost_operand(a, binop->op) + cost_into(b, dest) + 1, Cover::swapped, Symbol{});
+                        }
+                        break;
+                case(Binop::le):
+                case(Binop::leq):
+                case(Binop::eq):
+                case(Binop::ge):
+                case(Binop::geq):
+                        consider(cost_atom(a) + cost_atom(b) + 1, Cover::compare, Symbol{});
+                        break;
+                }
+
+                // Only when it's actually shorter, (d += b) reads better
+                Scaled_Sum sum;
+                if(as_scaled_sum(node, sum)){
+                        consider(cost_atom(sum.base) + cost_atom(sum.index) + 1 + (sum.offset != 0),
+                                 Cover::lea, Symbol{});
+                }
+        } else if(auto load = node_cast<Load>(node)){
+                consider(cost_address(expand(load->get_loadee())) + 1, Cover::load, Symbol{});
+        } else {
+                throw std::logic_error("only binops and loads make trees");
+        }
+
+        // Going through a temp is always possible, it's just never cheaper
+        // than doing it in place. The scratch var is only for when there's
+        // nothing else.
+        auto tree = trees.find(node);
+        if(tree != trees.end() && tree->second.own != dest){
+                consider(cost_into(node, tree->second.own) + 1, Cover::via_temp, tree->second.own);
+        }
+        if(pick.cost == never && scratch() != dest){
+                consider(cost_into(node, scratch()) + 1, Cover::via_temp, scratch());
+        }
+
+        memo.emplace(Key{node, dest}, pick);
+        return pick;
+}
+
+int64_t Tile_O_Tron_4000::cost_into(ast_ptr node, Symbol dest){
+        if(is_tree(node)){
+                return best(node, dest).cost;
+        }
+        return is_var_named(node, dest) ? 0 : 1;
+}
+
+int64_t Tile_O_Tron_4000::cost_atom(ast_ptr node){
+        return is_tree(node) ? cost_into(node, own_name(node)) : 0;
+}
+
+// L2 can add and subtract (mem x M) without loading it first
+bool Tile_O_Tron_4000::from_memory(ast_ptr node, Binop::Op op){
+        return (op == Binop::plus || op == Binop::minus) && is_one_of<Load>(node);
+}
+
+int64_t Tile_O_Tron_4000::cost_operand(ast_ptr node, Binop::Op op){
+        if(from_memory(node, op)){
+                return cost_address(expand(node_cast<Load>(node)->get_loadee()));
+        }
+        return cost_atom(node);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                 Emitting                                  //
+///////////////////////////////////////////////////////////////////////////////
+
+void Tile_O_Tron_4000::emit_into(ast_ptr node, Symbol dest){
+        if(!is_tree(node)){
+                if(!is_var_named(node, dest)){
+                        result.push_back(L2_Inst::move(L2_Operand::var(dest), text(node)));
+                }
+                return;
+        }
+
+        auto choice = best(node, dest);
+        switch(choice.cover){
+        case(Cover::in_place):
+        case(Cover::swapped):{
+                auto binop = node_cast<Binop>(node);
+                auto a = expand(binop->get_lhs());
+                auto b = expand(binop->get_rhs());
+                if(choice.cover == Cover::swapped){
+                        std::swap(a, b);
+                }
+
+                auto b_operand = emit_operand(b, binop->op);
+                emit_into(a, dest);
+                result.push_back(update(L2_Operand::var(dest), binop->op, b_operand));
+                break;
+        }
+        case(Cover::compare):{
+                auto binop = node_cast<Binop>(node);
+                auto a_operand = emit_atom(expand(binop->get_lhs()));
+                auto b_operand = emit_atom(expand(binop->get_rhs()));
+                result.push_back(L2_Inst::compare(L2_Operand::var(dest), a_operand, binop->op, b_operand));
+                break;
+        }
+        case(Cover::load):
+                result.push_back(L2_Inst::move(L2_Operand::var(dest),
+                                               emit_address(expand(node_cast<Load>(node)->get_loadee()))));
+                break;
+        case(Cover::lea):{
+                Scaled_Sum sum;
+                as_scaled_sum(node, sum);
+                auto base = emit_atom(sum.base);
+                auto index = emit_atom(sum.index);
+                result.push_back(L2_Inst::lea(L2_Operand::var(dest), base, index, sum.scale));
+                if(sum.offset != 0){
+                        result.push_back(L2_Inst::arith(L2_Operand::var(dest), Binop::plus,
+                                                        L2_Operand::number(sum.offset)));
+                }
+                break;
+        }
+        case(Cover::via_temp):
+                emit_into(node, choice.temp);
+                result.push_back(L2_Inst::move(L2_Operand::var(dest), L2_Operand::var(choice.temp)));
+                break;
+        }
+}
+
+L2_Operand Tile_O_Tron_4000::emit_operand(ast_ptr node, Binop::Op op){
+        if(from_memory(node, op)){
+                return emit_address(expand(node_cast<Load>(node)->get_loadee()));
+        }
+        return emit_atom(node);
+}
+
+L2_Operand Tile_O_Tron_4000::emit_atom(ast_ptr node){
+        if(is_tree(node)){
+                auto own = own_name(node);
+                emit_into(node, own);
+                return L2_Operand::var(own);
+        }
+        return text(node);
+}
+
+// store a <- (load a) + t, or - t, is ((mem a 0) += t). The load has
+// been folded in, so nothing can have changed a or the memory in between.
+bool Tile_O_Tron_4000::updates_memory(ast_ptr value, ast_ptr addr, Binop*& binop, ast_ptr& by){
+        binop = node_cast<Binop>(value);
+        if(!binop || !(binop->op == Binop::plus || binop->op == Binop::minus)){
+                return false;
+        }
+
+        auto same_place = [&](ast_ptr node){
+                auto load = node_cast<Load>(node);
+                if(!load){
+                        return false;
+                }
+                auto here = address_of(addr);
+                auto there = address_of(expand(load->get_loadee()));
+                auto here_var = node_cast<Var>(here.base);
+                auto there_var = node_cast<Var>(there.base);
+                return here_var && there_var && here_var->name == there_var->name && here.offset == there.offset;
+        };
+
+        auto a = expand(binop->get_lhs());
+        auto b = expand(binop->get_rhs());
+        if(same_place(a)){
+                by = b;
+                return true;
+        }
+        if(binop->op == Binop::plus && same_place(b)){
+                by = a;
+                return true;
+        }
+        return false;
+}
+
+Tile_O_Tron_4000::Address Tile_O_Tron_4000::address_of(ast_ptr addr){
+        Address found{addr, 0};
+        Address at{addr, 0};
+
+        // Peel constants off as long as what's left is something mem can
+        // take as a base. Every step has to land on a multiple of 8 to
+        // count, the ones in between don't.
+        while(auto binop = node_cast<Binop>(at.base)){
+                auto a = expand(binop->get_lhs());
+                auto b = expand(binop->get_rhs());
+                if(binop->op == Binop::plus && is_one_of<Int_Literal>(a)){
+                        std::swap(a, b);
+                }
+
+                auto num = node_cast<Int_Literal>(b);
+                if(!num || !(binop->op == Binop::plus || binop->op == Binop::minus)
+                   || !(is_one_of<Var>(a) || is_tree(a))){
+                        break;
+                }
+
+                int64_t step = num->val;
+                if(binop->op == Binop::minus){
+                        if(step == std::numeric_limits<int64_t>::min()){
+                                break;
+                        }
+                        step = -step;
+                }
+                if((step > 0 && at.offset > std::numeric_limits<int64_t>::max() - step)
+                   || (step < 0 && at.offset < std::numeric_limits<int64_t>::min() - step)){
+                        break;
+                }
+
+                at = Address{a, at.offset + step};
+                if(at.offset % 8 == 0){
+                        found = at;
+                }
+        }
+        return found;
+}
+
+// An @ whose constant is a multiple of 8 leaves that to the mem
+bool Tile_O_Tron_4000::offset_sum(ast_ptr addr, Scaled_Sum& sum){
+        return is_tree(addr) && as_scaled_sum(addr, sum) && sum.offset != 0 && sum.offset % 8 == 0;
+}
+
+int64_t Tile_O_Tron_4000::cost_address(ast_ptr addr){
+        Scaled_Sum sum;
+        if(offset_sum(addr, sum)){
+                return cost_atom(sum.base) + cost_atom(sum.index) + 1;
+        }
+        return cost_atom(address_of(addr).base);
+}
+
+L2_Operand Tile_O_Tron_4000::emit_address(ast_ptr addr){
+        Scaled_Sum sum;
+        if(offset_sum(addr, sum)){
+                auto own = own_name(addr);
+                auto base = emit_atom(sum.base);
+                auto index = emit_atom(sum.index);
+                result.push_back(L2_Inst::lea(L2_Operand::var(own), base, index, sum.scale));
+                return L2_Operand::mem(own, sum.offset);
+        }
+
+        auto where = address_of(addr);
+        return L2_Operand::mem(emit_atom(where.base).name, where.offset);
+}
+
+bool Tile_O_Tron_4000::as_scaled_sum(ast_ptr node, Scaled_Sum& sum){
+        auto top = node_cast<Binop>(node);
+        if(!top || top->op != Binop::plus){
+                return false;
+        }
+
+        // Flatten the + nodes. Two things to add up and maybe a constant
+        // is all one @ can do, so give up on anything bigger.
+        std::array<ast_ptr, 3> terms;
+        std::size_t count = 0;
+        std::array<ast_ptr, 3> todo{{node}};
+        std::size_t pending = 1;
+        while(pending){
+                auto term = todo[--pending];
+                auto binop = node_cast<Binop>(term);
+                if(binop && binop->op == Binop::plus && pending + count < 2){
+                        todo[pending++] = expand(binop->get_rhs());
+                        todo[pending++] = expand(binop->get_lhs());
+                        continue;
+                }
+                if(count == terms.size()){
+                        return false;
+                }
+                terms[count++] = term;
+        }
+
+        sum = Scaled_Sum{nullptr, nullptr, 1, 0};
+        std::array<ast_ptr, 2> regs;
+        std::size_t reg_count = 0;
+        bool have_offset = false;
+        for(std::size_t i = 0; i < count; i++){
+                if(auto num = node_cast<Int_Literal>(terms[i])){
+                        if(have_offset){
+                                return false;
+                        }
+                        sum.offset = num->val;
+                        have_offset = true;
+                } else if(reg_count < regs.size() && is_register(terms[i])){
+                        regs[reg_count++] = terms[i];
+                } else {
+                        return false;
+                }
+        }
+        if(reg_count != 2){
+                return false;
+        }
+
+        // The scaled one is the index if there is one, else it's just a + b
+        for(std::size_t i = 0; i < 2; i++){
+                if(as_scaled(regs[i], sum.index, sum.scale)){
+                        sum.base = regs[1 - i];
+                        return true;
+                }
+        }
+        sum.base = regs[0];
+        sum.index = regs[1];
+        return true;
+}
+
+bool Tile_O_Tron_4000::as_scaled(ast_ptr term, ast_ptr& index, int64_t& scale){
+        auto binop = node_cast<Binop>(term);
+        if(!binop){
+                return false;
+        }
+        auto a = expand(binop->get_lhs());
+        auto b = expand(binop->get_rhs());
+        if(binop->op == Binop::mult && is_one_of<Int_Literal>(a)){
+                std::swap(a, b);
+        }
+
+        auto num = node_cast<Int_Literal>(b);
+        if(!num || !is_register(a)){
+                return false;
+        }
+
+        if(binop->op == Binop::mult && (num->val == 1 || num->val == 2 || num->val == 4 || num->val == 8)){
+                scale = num->val;
+        } else if(binop->op == Binop::left_shift && num->val >= 0 && num->val <= 3){
+                scale = int64_t(1) << num->val;
+        } else {
+                return false;
+        }
+        index = a;
+        return true;
+}
+
+bool Tile_O_Tron_4000::is_register(ast_ptr node){
+        return is_one_of<Var>(node) || is_tree(node);
+}
+
+L2_Operand Tile_O_Tron_4000::text(ast_ptr atom){
+        if(!is_one_of<Var, L3::Label, Int_Literal>(atom)){
+                throw std::logic_error("that's not an atom");
+        }
+        return L2_Operand::of(atom, &labels);
+}
+
+bool Tile_O_Tron_4000::has_var_shift(ast_ptr node){
+        if(auto binop = node_cast<Binop>(node)){
+                auto b = expand(binop->get_rhs());
+                if((binop->op == Binop::left_shift || binop->op == Binop::right_shift)
+                   && !is_one_of<Int_Literal>(b)){
+                        return true;
+                }
+                return has_var_shift(expand(binop->get_lhs())) || has_var_shift(b);
+        }
+        if(auto load = node_cast<Load>(node)){
+                return has_var_shift(expand(load->get_loadee()));
+        }
+        return false;
+}
+
+bool Tile_O_Tron_4000::reads_arg_reg(ast_ptr node){
+        if(auto var = node_cast<Var>(node)){
+                return std::find(arg_regs().begin(), arg_regs().end(), var->name) != arg_regs().end();
+        }
+        if(auto binop = node_cast<Binop>(node)){
+                return reads_arg_reg(expand(binop->get_lhs())) || reads_arg_reg(expand(binop->get_rhs()));
+        }
+        if(auto load = node_cast<Load>(node)){
+                return reads_arg_reg(expand(load->get_loadee()));
+        }
+        return false;
+}
+
+Symbol Tile_O_Tron_4000::scratch(){
+        if(!have_scratch){
+                std::unordered_set<Symbol> names;
+                for(auto& param : fun.params){
+                        names.insert(param.name);
+                }
+                for(auto inst : fun.instructions){
+                        fun.walk_for_names<Var, L3::Label>(inst, names);
+                }
+
+                std::string name{"scratch"};
+                for(int64_t n = 0; names.count(Symbol{name}); n++){
+                        name = "scratch" + std::to_string(n);
+                }
+                the_scratch = Symbol{name};
+                have_scratch = true;
+        }
+        return the_scratch;
+}
+
+void Tile_O_Tron_4000::emit_call(Call* item){
+        auto args = item->get_args();
+
+        // Anything that can't be built right in its spot gets built first,
+        // before any argument register is holding something. Shifting by a
+        // var wants rcx, which might be one of them, and a var named like
+        // one has to be read before it gets overwritten.
+        std::vector<L2_Operand> ready(args.size());
+        for(std::size_t i = 0; i < args.size(); i++){
+                auto arg = expand(args[i]);
+                if(is_tree(arg) && (i >= arg_regs().size() || has_var_shift(arg) || reads_arg_reg(arg))){
+                        ready[i] = emit_atom(arg);
+                }
+        }
+
+        // Everything that's already sitting somewhere moves at once, then
+        // the rest gets built in its register
+        std::vector<L2_Move> moves;
+        for(std::size_t i = 0; i < args.size(); i++){
+                auto arg = expand(args[i]);
+                bool built = ready[i].kind != L2_Operand::Kind::none;
+                if(is_tree(arg) && !built){
+                        continue;
+                }
+                auto to = i < arg_regs().size()
+                        ? L2_Operand::var(arg_regs()[i])
+                        : L2_Operand::mem(rsp(), -16 - 8 * int64_t(i - arg_regs().size()));
+                moves.push_back(L2_Move{to, built ? ready[i] : text(arg)});
+        }
+        parallel_move(moves, rax(), result);
+
+        for(std::size_t i = 0; i < args.size() && i < arg_regs().size(); i++){
+                auto arg = expand(args[i]);
+                if(is_tree(arg) && ready[i].kind == L2_Operand::Kind::none){
+                        emit_into(arg, arg_regs()[i]);
+                }
+        }
+
+        auto callee = expand(item->get_callee());
+        if(is_runtime_call(callee)){
+                result.push_back(L2_Inst::call(text(callee), args.size()));
+                return;
+        }
+
+        auto retlab = Symbol{name_gen()};
+        result.push_back(L2_Inst::move(L2_Operand::mem(rsp(), -8), L2_Operand::label(retlab)));
+        result.push_back(L2_Inst::call(text(callee), args.size()));
+        result.push_back(L2_Inst::label(retlab));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                              Tree roots                                   //
+///////////////////////////////////////////////////////////////////////////////
+
+void Tile_O_Tron_4000::visit(Function* item){
+        for(auto inst : item->instructions){
+                if(!swallowed.count(inst)){
+                        inst->accept(*this);
+                }
+        }
+}
+
+void Tile_O_Tron_4000::visit(Assignment* item){
+        auto lhs = item->get_lhs();
+        auto rhs = item->get_rhs();
+
+        if(auto store = node_cast<Store>(lhs)){
+                auto addr = expand(store->get_storee());
+                Binop* update_in_place;
+                ast_ptr by;
+                if(updates_memory(expand(rhs), addr, update_in_place, by)){
+                        auto by_operand = emit_atom(by);
+                        result.push_back(L2_Inst::arith(emit_address(addr), update_in_place->op, by_operand));
+                        return;
+                }
+
+                auto value = emit_atom(expand(rhs));
+                result.push_back(L2_Inst::move(emit_address(addr), value));
+                return;
+        }
+
+        auto dest = node_cast<Var>(lhs)->name;
+        if(auto call = node_cast<Call>(rhs)){
+                emit_call(call);
+                result.push_back(L2_Inst::move(L2_Operand::var(dest), L2_Operand::var(rax())));
+                return;
+        }
+
+        emit_into(expand(rhs), dest);
+}
+
+void Tile_O_Tron_4000::visit(Goto* item){
+        result.push_back(L2_Inst::goto_(text(item->get_target()).name));
+}
+
+void Tile_O_Tron_4000::visit(Cjump* item){
+        auto t = text(item->get_true_target()).name;
+        auto f = text(item->get_false_target()).name;
+
+        // A compare that got folded in is only here for the branch, so
+        // L2's cjump does the comparing and the 0/1 never gets made.
+        auto cond = expand(item->get_cond());
+        auto binop = node_cast<Binop>(cond);
+        if(binop && is_comparison(binop->op)){
+                auto a = emit_atom(expand(binop->get_lhs()));
+                auto b = emit_atom(expand(binop->get_rhs()));
+                result.push_back(L2_Inst::cjump(a, binop->op, b, t, f));
+                return;
+        }
+
+        result.push_back(L2_Inst::cjump(L2_Operand::number(0), Binop::le, emit_atom(cond), t, f));
+}
+
+void Tile_O_Tron_4000::visit(Call* item){
+        emit_call(item);
+}
+
+void Tile_O_Tron_4000::visit(Val_Return* item){
+        emit_into(expand(item->get_result()), rax());
+        result.push_back(L2_Inst::return_());
+}
+
+void Tile_O_Tron_4000::visit(Void_Return* item){
+        result.push_back(L2_Inst::return_());
+}
+
+void Tile_O_Tron_4000::visit(Label* item){
+        result.push_back(L2_Inst::label(labels(item->name)));
+}
+
+// Only ever reached through the instruction they're part of
+void Tile_O_Tron_4000::visit(Program* item){
+        throw std::logic_error("tile one function at a time");
+}
+void Tile_O_Tron_4000::visit(Binop* item){}
+void Tile_O_Tron_4000::visit(Load* item){}
+void Tile_O_Tron_4000::visit(Store* item){}
+void Tile_O_Tron_4000::visit(Var* item){}
+void Tile_O_Tron_4000::visit(Int_Literal* item){}
+void Tile_O_Tron_4000::visit(Runtime_Fun* item){}
+
+int64_t L3::count_l2_instructions(const std::string& l2){
+        int64_t count = 0;
+        std::size_t at = 0;
+        while(at < l2.size()){
+                auto end = l2.find('\n', at);
+                if(end == std::string::npos){
+                        end = l2.size();
+                }
+
+                auto start = l2.find_first_not_of(" \t", at);
+                if(start < end){
+                        bool header = l2.compare(start, 2, "(:") == 0;
+                        if(!header && (l2[start] == '(' || l2[start] == ':')){
+                                count++;
+                        }
+                }
+                at = end + 1;
+        }
+        return count;
+}
+
+#ifdef UNIT_TEST
+namespace{
+        std::string tile_body(const std::string& src){
+                Program p = ll_parse(src.data(), src.data() + src.size(), "test");
+                Label_Names no_renames;
+                L2_Insts insts;
+                Tile_O_Tron_4000 tron{*p.functions[0], [](){return std::string(":ret");}, no_renames, insts};
+                tron.tile();
+
+                L2_Out out;
+                print(insts, out);
+                return out.str();
+        }
+
+        int64_t count_for(const std::string& src, Tiling tiling){
+                Program p = ll_parse(src.data(), src.data() + src.size(), "test");
+                int64_t count = 0;
+                for(auto& fun : p.functions){
+                        count += count_l2_instructions(fun->enstringify_l2ishly([](){return std::string(":ret");},
+                                                                                 tiling));
+                }
+                return count;
+        }
+}
+
+TEST_CASE("the tile o tron covers whole trees"){
+        SECTION("temps fold into their one use, but not past a redefinition"){
+                REQUIRE(tile_body("define :f(x, y){\n"
+                                  "  t1 <- x + y\n"
+                                  "  t2 <- t1 * 4\n"
+                                  "  y <- 1 - y\n"
+                                  "  t3 <- t2 - y\n"
+                                  "  return t3\n"
+                                  "}\n") ==
+                        "(t2 @ x y 1)\n"
+                        "(t2 *= 4)\n"
+                        "(scratch <- 1)\n"
+                        "(scratch -= y)\n"
+                        "(y <- scratch)\n"
+                        "(rax <- t2)\n"
+                        "(rax -= y)\n"
+                        "(return)\n");
+        }
+
+        SECTION("commutative ops get swapped when the dest is on the right"){
+                REQUIRE(tile_body("define :f(x, y){\n"
+                                  "  x <- y + x\n"
+                                  "  y <- 3 * y\n"
+                                  "  return\n"
+                                  "}\n") ==
+                        "(x += y)\n"
+                        "(y *= 3)\n"
+                        "(return)\n");
+        }
+
+        SECTION("loads don't move past stores, and args get built in place"){
+                REQUIRE(tile_body("define :f(p, q){\n"
+                                  "  v <- load p\n"
+                                  "  store q <- 5\n"
+                                  "  w <- load p\n"
+                                  "  s <- v + w\n"
+                                  "  call print(s)\n"
+                                  "  return\n"
+                                  "}\n") ==
+                        "(v <- (mem p 0))\n"
+                        "((mem q 0) <- 5)\n"
+                        "(rdi <- v)\n"
+                        "(rdi += (mem p 0))\n"
+                        "(call print 1)\n"
+                        "(return)\n");
+        }
+
+        SECTION("a compare only there for a branch goes into the cjump"){
+                REQUIRE(tile_body("define :f(x, p){\n"
+                                  "  :top\n"
+                                  "  x <- x - 1\n"
+                                  "  c <- x >= 3\n"
+                                  "  br c :top :next\n"
+                                  "  :next\n"
+                                  "  v <- load p\n"
+                                  "  d <- v < x\n"
+                                  "  br d :top :out\n"
+                                  "  :out\n"
+                                  "  e <- x = 0\n"
+                                  "  br e :top :done\n"
+                                  "  :done\n"
+                                  "  return e\n"
+                                  "}\n") ==
+                        ":top\n"
+                        "(x--)\n"
+                        "(cjump 3 <= x :top :next)\n"
+                        ":next\n"
+                        "(v <- (mem p 0))\n"
+                        "(cjump v < x :top :out)\n"
+                        ":out\n"
+                        "(e <- x = 0)\n"
+                        "(cjump 0 < e :top :done)\n"
+                        ":done\n"
+                        "(rax <- e)\n"
+                        "(return)\n");
+        }
+
+        SECTION("constant offsets that are a multiple of 8 go in the mem"){
+                REQUIRE(tile_body("define :f(p, i){\n"
+                                  "  a1 <- p + 16\n"
+                                  "  v <- load a1\n"
+                                  "  a2 <- 8 + p\n"
+                                  "  a3 <- a2 - 24\n"
+                                  "  store a3 <- v\n"
+                                  "  a4 <- p + 4\n"
+                                  "  a5 <- a4 + 4\n"
+                                  "  w <- load a5\n"
+                                  "  a6 <- p + 12\n"
+                                  "  x <- load a6\n"
+                                  "  o <- i * 8\n"
+                                  "  a7 <- p + o\n"
+                                  "  a8 <- a7 + 8\n"
+                                  "  store a8 <- x\n"
+                                  "  return w\n"
+                                  "}\n") ==
+                        "(v <- (mem p 16))\n"
+                        "((mem p -16) <- v)\n"
+                        "(w <- (mem p 8))\n"
+                        "(a6 <- p)\n"
+                        "(a6 += 12)\n"
+                        "(x <- (mem a6 0))\n"
+                        "(a8 @ p i 8)\n"
+                        "((mem a8 8) <- x)\n"
+                        "(rax <- w)\n"
+                        "(return)\n");
+        }
+
+        SECTION("an address temp every load and store reads goes into all of them"){
+                REQUIRE(tile_body("define :f(arr, x, i){\n"
+                                  "  a <- arr + 16\n"
+                                  "  v <- load a\n"
+                                  "  v2 <- v + x\n"
+                                  "  store a <- v2\n"
+                                  "  t <- i * 8\n"
+                                  "  addr <- arr + t\n"
+                                  "  at <- addr + 8\n"
+                                  "  w <- load at\n"
+                                  "  w2 <- w * x\n"
+                                  "  store at <- w2\n"
+                                  "  b <- arr - 8\n"
+                                  "  store b <- 1\n"
+                                  "  arr <- arr + 1\n"   // not the same b anymore
+                                  "  store b <- 2\n"
+                                  "  return\n"
+                                  "}\n") ==
+                        "((mem arr 16) += x)\n"
+                        "(addr @ arr i 8)\n"
+                        "(w2 <- (mem addr 8))\n"
+                        "(w2 *= x)\n"
+                        "((mem addr 8) <- w2)\n"
+                        "(b <- arr)\n"
+                        "(b -= 8)\n"
+                        "((mem b 0) <- 1)\n"
+                        "(arr++)\n"
+                        "((mem b 0) <- 2)\n"
+                        "(return)\n");
+        }
+
+        SECTION("base + index * scale + constant is an @"){
+                REQUIRE(tile_body("define :f(arr, i, j){\n"
+                                  "  off <- i * 8\n"
+                                  "  off2 <- off + 8\n"
+                                  "  addr <- arr + off2\n"
+                                  "  v <- load addr\n"
+                                  "  s <- j << 2\n"
+                                  "  k <- s + i\n"
+                                  "  m <- 3 * j\n"
+                                  "  n <- arr + m\n"
+                                  "  i <- i + j\n"
+                                  "  t <- 16 + i\n"
+                                  "  u <- t + v\n"
+                                  "  call print(k)\n"
+                                  "  call print(n)\n"
+                                  "  return u\n"
+                                  "}\n") ==
+                        "(addr @ arr i 8)\n"
+                        "(v <- (mem addr 8))\n"
+                        "(k @ i j 4)\n"
+                        "(i += j)\n"
+                        "(rdi <- k)\n"
+                        "(call print 1)\n"
+                        "(rdi <- 3)\n"
+                        "(rdi *= j)\n"
+                        "(rdi += arr)\n"
+                        "(call print 1)\n"
+                        "(rax @ i v 1)\n"
+                        "(rax += 16)\n"
+                        "(return)\n");
+        }
+
+        SECTION("load, add, store back is one instruction, and so is +1"){
+                REQUIRE(tile_body("define :f(counts, i, k){\n"
+                                  "  a <- counts + 8\n"
+                                  "  c <- load a\n"
+                                  "  c2 <- c + 1\n"
+                                  "  store a <- c2\n"
+                                  "  v <- load counts\n"
+                                  "  v2 <- k - v\n"
+                                  "  v3 <- v2 - i\n"
+                                  "  store counts <- v3\n"
+                                  "  w <- load counts\n"
+                                  "  w2 <- w - i\n"
+                                  "  store counts <- w2\n"
+                                  "  i <- 1 + i\n"
+                                  "  k <- k - 1\n"
+                                  "  s <- load counts\n"
+                                  "  s2 <- k - s\n"
+                                  "  return s2\n"
+                                  "}\n") ==
+                        "((mem counts 8) += 1)\n"
+                        "(v3 <- k)\n"
+                        "(v3 -= (mem counts 0))\n"
+                        "(v3 -= i)\n"
+                        "((mem counts 0) <- v3)\n"
+                        "((mem counts 0) -= i)\n"
+                        "(i++)\n"
+                        "(k--)\n"
+                        "(rax <- k)\n"
+                        "(rax -= (mem counts 0))\n"
+                        "(return)\n");
+        }
+
+        SECTION("args move all at once, and the runtime needs no return label"){
+                REQUIRE(tile_body("define :f(rdi, rsi, x){\n"
+                                  "  t <- rdi + 1\n"
+                                  "  r <- call :g(rsi, rdi, t, x)\n"
+                                  "  a <- call allocate(r, 1)\n"
+                                  "  return a\n"
+                                  "}\n") ==
+                        "(t <- rdi)\n"
+                        "(t++)\n"
+                        "(rdx <- t)\n"
+                        "(rcx <- x)\n"
+                        "(rax <- rdi)\n"
+                        "(rdi <- rsi)\n"
+                        "(rsi <- rax)\n"
+                        "((mem rsp -8) <- :ret)\n"
+                        "(call :g 4)\n"
+                        ":ret\n"
+                        "(r <- rax)\n"
+                        "(rdi <- r)\n"
+                        "(rsi <- 1)\n"
+                        "(call allocate 2)\n"
+                        "(a <- rax)\n"
+                        "(rax <- a)\n"
+                        "(return)\n");
+        }
+
+        SECTION("never more instructions than munching"){
+                std::string src =
+                        "define :main(){\n"
+                        "  a <- call allocate(21, 1)\n"
+                        "  i <- 0\n"
+                        "  :loop\n"
+                        "  off <- i * 8\n"
+                        "  off8 <- off + 8\n"
+                        "  addr <- a + off8\n"
+                        "  v <- load addr\n"
+                        "  v2 <- v + i\n"
+                        "  store addr <- v2\n"
+                        "  i <- i + 1\n"
+                        "  more <- i < 10\n"
+                        "  br more :loop :done\n"
+                        "  :done\n"
+                        "  r <- call :g(a, i)\n"
+                        "  call print(r)\n"
+                        "  return\n"
+                        "}\n"
+                        "define :g(a, n){\n"
+                        "  x <- n * n\n"
+                        "  y <- x - 1\n"
+                        "  z <- y & 7\n"
+                        "  return z\n"
+                        "}\n";
+
+                REQUIRE(count_for(src, Tiling::dp) < count_for(src, Tiling::munch));
+        }
+}
+
+TEST_CASE("tiling leaves the AST alone, so it can happen again and all at once"){
+        std::string src =
+                "define :main(){\n"
+                "  i <- 3\n"
+                "  :loop\n"
+                "  t <- i * 8\n"
+                "  r <- call :f(t)\n"
+                "  i <- i - 1\n"
+                "  c <- 0 < i\n"
+                "  br c :loop :done\n"
+                "  :done\n"
+                "  return\n"
+                "}\n"
+                "define :f(x){\n"
+                "  :loop\n"
+                "  y <- x + 1\n"
+                "  return y\n"
+                "}\n";
+        Program p = ll_parse(src.data(), src.data() + src.size(), "test");
+
+        Label_Scoping scoping;
+        for(auto& fun : p.functions){
+                scoping.collect(*fun);
+        }
+        scoping.prefix();
+
+        auto compile = [&](Tiling tiling){
+                std::string out;
+                for(std::size_t i = 0; i < p.functions.size(); i++){
+                        int64_t n = 0;
+                        auto labels = scoping.scopify(*p.functions[i], i);
+                        out += p.functions[i]->enstringify_l2ishly([i, &n](){
+                                        return ":r" + std::to_string(i) + "_" + std::to_string(n++);
+                                }, tiling, labels);
+                }
+                return out;
+        };
+
+        auto munched = compile(Tiling::munch);
+        auto dp = compile(Tiling::dp);
+        REQUIRE(munched.find(":z0_loop") != std::string::npos);
+        REQUIRE(dp.find(":z1_loop") != std::string::npos);
+
+        REQUIRE(compile(Tiling::munch) == munched);
+        REQUIRE(compile(Tiling::dp) == dp);
+
+        std::vector<std::string> seen(8);
+        std::vector<std::thread> threads;
+        for(std::size_t t = 0; t < seen.size(); t++){
+                threads.emplace_back([&, t](){
+                                seen[t] = compile(t % 2 ? Tiling::dp : Tiling::munch);
+                        });
+        }
+        for(auto& thread : threads){
+                thread.join();
+        }
+        for(std::size_t t = 0; t < seen.size(); t++){
+                REQUIRE(seen[t] == (t % 2 ? dp : munched));
+        }
+}
+
+TEST_CASE("tiling instruction counts", "[.][bench]"){
+        // Roughly the shape of the L3 tests: address math, loads and stores,
+        // a loop, calls, and a few temps that only live for one instruction.
+        std::string src;
+        for(int f = 0; f < 5000; f++){
+                auto n = std::to_string(f);
+                src += "define :f" + n + "(a, b, p){\n"
+                        "  :top\n"
+                        "  t1 <- a + b\n"
+                        "  t2 <- t1 * 8\n"
+                        "  t3 <- p + t2\n"
+                        "  v <- load t3\n"
+                        "  w <- v + 1\n"
+                        "  store t3 <- w\n"
+                        "  a <- a - 1\n"
+                        "  c <- 0 < a\n"
+                        "  br c :top :out\n"
+                        "  :out\n"
+                        "  s <- b - a\n"
+                        "  call print(s)\n"
+                        "  r <- call :f0(a, b, p)\n"
+                        "  r <- r + a\n"
+                        "  return r\n"
+                        "}\n";
+        }
+
+        for(auto tiling : {Tiling::munch, Tiling::dp}){
+                Program p = ll_parse(src.data(), src.data() + src.size(), "bench");
+
+                auto start = std::chrono::steady_clock::now();
+                std::string out;
+                for(auto& fun : p.functions){
+                        out += fun->enstringify_l2ishly([](){return std::string(":ret");}, tiling);
+                }
+                std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+
+                std::cout << (tiling == Tiling::munch ? "munch: " : "dp:    ")
+                          << count_l2_instructions(out) << " L2 instructions, "
+                          << took.count() << " s\n";
+        }
+}
+#endif
@@ -1,17 +1,41 @@
 #pragma once
 
 #include <L3.h>
-#include <ostream>
-
-namespace Tile{
-        class Tile;
-}
+#include <l2.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace L3{
 
+/*
+  Instruction selection that looks past one L3 instruction at a time.
+
+  Inside a basic block, a temp with one def and one use gets its def folded
+  into the use (as long as nothing it reads is redefined in between, and a
+  load doesn't move past a store or call), and a base + 8k temp that only
+  loads and stores read goes into each of their addresses. That turns the
+  block into expression trees. Every tree node then has a handful of
+  candidate covers (copy, op= into the destination, the commutative swap,
+  a compare, a load, or going through its own temp first), and the
+  cheapest cover of each (node, destination) pair is found bottom up and
+  memoized. Cost is L2 instructions, so the pick is always the shortest
+  code.
+
+  Matching one instruction at a time (match_tile) is still around as the
+  fast mode, see Tiling.
+*/
         class Tile_O_Tron_4000 :
                 public AST_Item_Visitor{
         public:
+                Tile_O_Tron_4000(Function& fun,
+                                 std::function<std::string()> name_gen,
+                                 const Label_Names& labels,
+                                 L2_Insts& result);
+
+                // L2 for the whole body, params not included, into result
+                void tile();
+
                 void visit(Program* item)     override;
                 void visit(Function* item)    override;
                 void visit(Assignment* item)  override;
@@ -29,10 +53,121 @@ namespace L3{
                 void visit(Int_Literal* item) override;
                 void visit(Runtime_Fun* item) override;
 
-                void print_l2_fun(std::ostream out);
+                // The covers a tree node can get, with the L2 they turn into.
+                // Leaves are always just (d <- a).
+                enum class Cover : uint8_t{
+                        in_place, // (d <- a) (d op= b), the first one skipped when a is d.
+                                  // b can be a (mem x M) for + and -, 1 makes it ++ or --
+                        swapped,  // same thing with a and b traded, for + * &
+                        compare,  // (d <- a cmp b)
+                        load,     // (d <- (mem a M)), see Address
+                        lea,      // (d @ a b E) (d += N), see Scaled_Sum
+                        via_temp  // the node into a temp, then (d <- temp)
+                };
+
+        private:
+                // Where an operand gets read, which decides what may be folded into it
+                enum class Slot : uint8_t{
+                        value,   // anything goes
+                        arith,   // binop operands, no labels
+                        address, // load and store addresses, vars and trees
+                        callee,  // vars and labels
+                        cond     // cjump, vars and trees
+                };
+
+                struct Choice{
+                        int64_t cost;
+                        Cover cover;
+                        Symbol temp; // for via_temp
+                };
+
+                // What (mem base offset) reads. Adding a multiple of 8 to
+                // an address is free in L2, so a base + 8k tree feeding a
+                // load or store never gets built.
+                struct Address{
+                        ast_ptr base;
+                        int64_t offset;
+                };
+
+                // base + index * scale + offset, which is one @ (plus an
+                // add when offset isn't 0). scale is 1, 2, 4 or 8.
+                struct Scaled_Sum{
+                        ast_ptr base;
+                        ast_ptr index;
+                        int64_t scale;
+                        int64_t offset;
+                };
+
+                struct Key{
+                        ast_ptr node;
+                        Symbol dest;
 
-                std::vector<std::shared_ptr<Tile::Tile>> possible_tiles;
+                        bool operator==(const Key& other) const{
+                                return node == other.node && dest == other.dest;
+                        }
+                };
 
-                std::vector<std::shared_ptr<Tile::Tile>> tiled_floor;
+                struct Key_Hash{
+                        std::size_t operator()(const Key& key) const{
+                                return std::hash<ast_ptr>()(key.node) * 31 + key.dest.id();
+                        }
+                };
+
+                // A folded def: the temp it used to go in, and the last
+                // instruction it can still be evaluated at
+                struct Tree{
+                        Symbol own;
+                        int64_t good_until;
+                };
+
+                void find_trees();
+                bool fits(ast_ptr rhs, Slot slot);
+
+                // The operand with any folded tree swapped in
+                ast_ptr expand(ast_ptr operand);
+                bool is_tree(ast_ptr node);
+                Symbol own_name(ast_ptr node);
+
+                Choice best(ast_ptr node, Symbol dest);
+                int64_t cost_into(ast_ptr node, Symbol dest);
+                int64_t cost_atom(ast_ptr node); // 0 unless it's a tree
+                bool from_memory(ast_ptr node, Binop::Op op);
+                int64_t cost_operand(ast_ptr node, Binop::Op op); // the b in (d op= b)
+
+                void emit_into(ast_ptr node, Symbol dest);
+                L2_Operand emit_atom(ast_ptr node); // trees go in their own temp
+                L2_Operand emit_operand(ast_ptr node, Binop::Op op);
+                bool updates_memory(ast_ptr value, ast_ptr addr, Binop*& binop, ast_ptr& by);
+                Address address_of(ast_ptr addr);
+                bool as_scaled_sum(ast_ptr node, Scaled_Sum& sum);
+                bool as_scaled(ast_ptr term, ast_ptr& index, int64_t& scale);
+                bool is_register(ast_ptr node); // something @ can read: a var or a tree
+                bool offset_sum(ast_ptr addr, Scaled_Sum& sum);
+                int64_t cost_address(ast_ptr addr);
+                L2_Operand emit_address(ast_ptr addr); // the (mem x M) to read or write
+                void emit_call(Call* item);
+                L2_Operand text(ast_ptr atom);
+
+                bool has_var_shift(ast_ptr node);
+                bool reads_arg_reg(ast_ptr node);
+                Symbol scratch();
+
+                Function& fun;
+                std::function<std::string()> name_gen;
+                const Label_Names& labels;
+
+                std::unordered_map<ast_ptr, Tree> trees;     // by rhs
+                std::unordered_map<ast_ptr, ast_ptr> folded; // operand -> rhs it stands for
+                std::unordered_set<ast_ptr> swallowed;      // defs emitted at their use
+                std::unordered_map<Key, Choice, Key_Hash> memo;
+
+                Symbol the_scratch;
+                bool have_scratch{false};
+
+                L2_Insts& result;
         };
+
+        // Instructions in L2 text: every parenthesized instruction and label
+        // inside a function, not counting the function headers.
+        int64_t count_l2_instructions(const std::string& l2);
 }
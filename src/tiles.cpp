@@ -2,12 +2,32 @@
 #include <exception>
 #ifdef UNIT_TEST
 #include <catch.hpp>
+#include <ll_parser.h>
+#include <chrono>
 #endif
 #include <memory>
 #include <array>
 #include <cassert>
 
 using namespace L3::Tile;
+using L3::L2_Inst;
+using L3::L2_Operand;
+
+namespace{
+        L2_Operand reg(const char* name){
+                return L2_Operand::var(L3::Symbol{std::string(name)});
+        }
+
+        const L2_Operand& rax(){
+                static const L2_Operand it = reg("rax");
+                return it;
+        }
+
+        // Runtime calls don't use one, so they don't use up a name either
+        L3::Label return_label(L3::ast_ptr callee, const std::function<std::string()>& name_gen){
+                return L3::Label{L3::is_runtime_call(callee) ? std::string() : name_gen()};
+        }
+}
 
 template<typename T, typename... Args>
 tile_ptr make_tile(Args&&... args){
@@ -15,6 +35,22 @@ tile_ptr make_tile(Args&&... args){
 }
 
 
+std::string Tile::to_L2(){
+        L3::L2_Insts insts;
+        emit(insts);
+
+        L3::L2_Out out;
+        print(insts, out);
+        return out.str();
+}
+
+void Tile::name_labels(const L3::Label_Names* names){
+        labels = names;
+        for(auto& child : children){
+                child->name_labels(names);
+        }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //                                Atom Assign                                //
 ///////////////////////////////////////////////////////////////////////////////
@@ -34,50 +70,33 @@ Atom_Assignment::Atom_Assignment(L3_ptr<L3::AST_Item> lhs,
         }
         }
 
-std::string Atom_Assignment::to_L2() {
-        std::stringstream ss;
-
-        ss << "(";
-
-        L3::Dump v;
-        lhs->accept(v);
-        ss << v.result.str();
-
-        ss << " <- ";
-
-        L3::Dump v2;
-        rhs_atom->accept(v2);
-
-        ss << v2.result.str();
-
-        ss << ")";
-        return ss.str();
+void Atom_Assignment::emit(L3::L2_Insts& out){
+        out.push_back(L2_Inst::move(L2_Operand::of(lhs, labels),
+                                    L2_Operand::of(rhs_atom, labels)));
 }
 
 #ifdef UNIT_TEST
 TEST_CASE("L2ization of atomic assignment"){
         SECTION("var to var"){
-                Atom_Assignment no{L3::ast_ptr {new L3::Var{"hi_mom"} },
-                                L3::L3_ptr<L3::AST_Item>{new L3::Var{"mork"}}};
-                REQUIRE(no.to_L2() == "(hi_mom <- mork)");
+                Atom_Assignment no{L3::make_AST<L3::Var>("hi_mom"),
+                                L3::make_AST<L3::Var>("mork")};
+                REQUIRE(no.to_L2() == "(hi_mom <- mork)\n");
         }
 
         SECTION("int to var"){
-                Atom_Assignment no{L3::ast_ptr{new L3::Var{"hi_mom"} },
-                                L3::L3_ptr<L3::AST_Item>{new L3::Int_Literal{3}}};
-                REQUIRE(no.to_L2() == "(hi_mom <- 3)");
+                Atom_Assignment no{L3::make_AST<L3::Var>("hi_mom"),
+                                L3::make_AST<L3::Int_Literal>(3)};
+                REQUIRE(no.to_L2() == "(hi_mom <- 3)\n");
         }
         SECTION("label to var"){
-                Atom_Assignment no{L3::ast_ptr {new L3::Var{"hi_mom"}}, L3::L3_ptr<L3::AST_Item>{new
-                                                                                        L3::Label{":sad"}}};
-                REQUIRE(no.to_L2() == "(hi_mom <- :sad)");
+                Atom_Assignment no{L3::make_AST<L3::Var>("hi_mom"), L3::make_AST<L3::Label>(":sad")};
+                REQUIRE(no.to_L2() == "(hi_mom <- :sad)\n");
         }
 
         SECTION("bad use of a binop here"){
-                REQUIRE_THROWS((Atom_Assignment{L3::ast_ptr{new L3::Var{"hi_mom"}}, L3::L3_ptr<L3::AST_Item>{
-                                                new L3::Binop{L3::Binop::Op::plus,
-                                                                L3::ast_ptr{new L3::Var{"hi"}},
-                                                                L3::ast_ptr{new L3::Var{"mom"}}}}}));
+                REQUIRE_THROWS((Atom_Assignment{L3::make_AST<L3::Var>("hi_mom"), L3::make_AST<L3::Binop>(L3::Binop::Op::plus,
+                                                                L3::make_AST<L3::Var>("hi"),
+                                                                L3::make_AST<L3::Var>("mom"))}));
         }
 }
 #endif
@@ -103,25 +122,12 @@ Load_Assignment::Load_Assignment(ast_ptr lhs, ast_ptr rhs) :
 
 // Dicks
 
-std::string Load_Assignment::to_L2(){
-        std::stringstream ss;
-
-        Dump v;
-        lhs->accept(v);
+void Load_Assignment::emit(L3::L2_Insts& out){
+        auto load_ptr = L3::node_cast<L3::Load>(rhs);
+        auto addr = L2_Operand::of(load_ptr->get_loadee(), labels);
 
-        ss << "(" << v.result.str();
-
-        ss << " <- ";
-
-        auto load_ptr = dynamic_cast<Load*>(rhs.get());
-
-        Dump v2;
-        load_ptr->get_loadee()->accept(v2);
-
-        ss << "(mem " << v2.result.str() << " " << "0" << ")";
-        ss << ")";
-
-        return ss.str();
+        out.push_back(L2_Inst::move(L2_Operand::of(lhs, labels),
+                                    L2_Operand::mem(addr.name, 0)));
 }
 
 
@@ -132,16 +138,14 @@ TEST_CASE("assigning from a load"){
                         L3::make_AST<L3::Var>("hi"),
                         L3::make_AST<L3::Load>(
                                 L3::make_AST<L3::Var>("load_me")));
-                REQUIRE(a_load.to_L2() == "(hi <- (mem load_me 0))");
+                REQUIRE(a_load.to_L2() == "(hi <- (mem load_me 0))\n");
         }
 
         SECTION("Constructor guards work"){
-                REQUIRE_THROWS(Load_Assignment(L3::ast_ptr
-                                               {new L3::Int_Literal{5}},
-                                               L3::ast_ptr {new L3::Load{L3::ast_ptr{new L3::Var{"load_me"}}}}));
-                REQUIRE_THROWS(Load_Assignment(L3::ast_ptr{new L3::Int_Literal{5}},
-                                               L3::ast_ptr{new L3::Store{L3::ast_ptr{new
-                                                                               L3::Var{"load_me"}}}}));
+                REQUIRE_THROWS(Load_Assignment(L3::make_AST<L3::Int_Literal>(5),
+                                               L3::make_AST<L3::Load>(L3::make_AST<L3::Var>("load_me"))));
+                REQUIRE_THROWS(Load_Assignment(L3::make_AST<L3::Int_Literal>(5),
+                                               L3::make_AST<L3::Store>(L3::make_AST<L3::Var>("load_me"))));
         }
 }
 #endif
@@ -156,21 +160,12 @@ Store_Assignment::Store_Assignment(L3::ast_ptr lhs,
 {}
 
 
-std::string Store_Assignment::to_L2(){
-        std::stringstream ss;
+void Store_Assignment::emit(L3::L2_Insts& out){
+        auto store_ptr = L3::node_cast<L3::Store>(lhs);
+        auto addr = L2_Operand::of(store_ptr->get_storee(), labels);
 
-        Dump v;
-        auto store_ptr = dynamic_cast<Store*>(lhs.get());
-        store_ptr->get_storee()->accept(v);
-
-        ss << "(" << "(mem "  << v.result.str() << " " << "0" << ")";
-        ss << " " << "<-" << " ";
-
-        Dump v2;
-        rhs->accept(v2);
-        ss << v2.result.str() << ")";
-
-        return ss.str();
+        out.push_back(L2_Inst::move(L2_Operand::mem(addr.name, 0),
+                                    L2_Operand::of(rhs, labels)));
 }
 
 #ifdef UNIT_TEST
@@ -180,7 +175,7 @@ TEST_CASE("assigning to a store"){
                         L3::make_AST<L3::Store>(
                                 L3::make_AST<L3::Var>("store_at_me")),
                         L3::make_AST<L3::Var>("hi"));
-                REQUIRE(a_store.to_L2() == "((mem store_at_me 0) <- hi)");
+                REQUIRE(a_store.to_L2() == "((mem store_at_me 0) <- hi)\n");
         }
 }
 #endif
@@ -194,10 +189,10 @@ Call_Assignment::Call_Assignment(L3::ast_ptr lhs,
         rhs(rhs)
 {
 
-        auto call_ptr = std::dynamic_pointer_cast<L3::Call>(rhs);
+        auto call_ptr = L3::node_cast<L3::Call>(rhs);
 
         children.push_back(
-                make_tile<Call>(call_ptr->get_callee(), call_ptr->get_args(), L3::Label{name_gen()})
+                make_tile<Call>(call_ptr->get_callee(), call_ptr->get_args(), return_label(call_ptr->get_callee(), name_gen))
                 );
 
         if(!L3::is_one_of<L3::Var>(lhs)){
@@ -209,19 +204,11 @@ Call_Assignment::Call_Assignment(L3::ast_ptr lhs,
 }
 
 // Delegate to call tile
-std::string Call_Assignment::to_L2(){
-        Dump v;
-
+void Call_Assignment::emit(L3::L2_Insts& out){
         assert(children.size() == 1);
-        v.result << children[0]->to_L2();
-
-        v.result << "(";
-
-        lhs->accept(v);
+        children[0]->emit(out);
 
-        v.result << " <- rax)\n";
-
-        return v.result.str();
+        out.push_back(L2_Inst::move(L2_Operand::of(lhs, labels), rax()));
 }
 
 #ifdef UNIT_TEST
@@ -262,24 +249,12 @@ Binop_Assignment::Binop_Assignment(L3::ast_ptr lhs,
         }
 
 // This is bad m'kay?
-std::string Binop_Assignment::to_L2(){
-        std::stringstream ss;
-
-        auto binop_ptr = dynamic_cast<L3::Binop*>(rhs.get());
-
-        Dump v;
-
-        lhs->accept(v);
-        auto bas_lhs_var = v.result.str();
-
-        Dump v2;
-        binop_ptr->get_lhs()->accept(v2);
-
-        Dump v3;
-        binop_ptr->get_rhs()->accept(v3);
+void Binop_Assignment::emit(L3::L2_Insts& out){
+        auto binop_ptr = L3::node_cast<L3::Binop>(rhs);
 
-        auto binop_lhs = v2.result.str();
-        auto binop_rhs = v3.result.str();
+        auto bas_lhs_var = L2_Operand::of(lhs, labels);
+        auto binop_lhs = L2_Operand::of(binop_ptr->get_lhs(), labels);
+        auto binop_rhs = L2_Operand::of(binop_ptr->get_rhs(), labels);
 
         switch(binop_ptr->op){
         case(L3::Binop::plus):
@@ -290,44 +265,21 @@ std::string Binop_Assignment::to_L2(){
         case(L3::Binop::right_shift):
 
         if(bas_lhs_var != binop_rhs){
-                ss << "(";
-                ss << bas_lhs_var;
-                ss << " <- ";
-                ss << binop_lhs;
-                ss << ")\n";
+                out.push_back(L2_Inst::move(bas_lhs_var, binop_lhs));
         } else {
                 binop_rhs = binop_lhs;
         }
 
-        ss << "(";
-        ss << bas_lhs_var;
-        ss << " ";
-        ss << binop_ptr->dump_op(binop_ptr->op);
-        ss << "=";
-        ss << " ";
-        ss << binop_rhs;
-        ss << ")\n";
+        out.push_back(L2_Inst::arith(bas_lhs_var, binop_ptr->op, binop_rhs));
         break;
         case(L3::Binop::le):
         case(L3::Binop::leq):
         case(L3::Binop::eq):
-                ss << "(";
-        ss << bas_lhs_var;
-        ss << " <- ";
-        ss << binop_lhs;
-        ss << " ";
-        ss << binop_ptr->dump_op(binop_ptr->op);
-        ss << " ";
-        ss << binop_rhs;
-        ss << ")\n";
-        break;
         case(L3::Binop::ge):
         case(L3::Binop::geq):
-                throw std::logic_error("How did a greater comparison get past the parser???");
+        out.push_back(L2_Inst::compare(bas_lhs_var, binop_lhs, binop_ptr->op, binop_rhs));
         break;
         }
-
-        return ss.str();
 }
 
 
@@ -352,13 +304,90 @@ TEST_CASE("a binop tile"){
                 REQUIRE(ba.to_L2() == "(sad_face <- 6 < no)\n");
         }
 
-        SECTION("U can't do this SAD"){
+        SECTION("greater than gets turned around"){
                 Binop_Assignment ba(L3::make_AST<L3::Var>("sad_face"),
                                     L3::make_AST<L3::Binop>(L3::Binop::ge,
                                                             L3::make_AST<L3::Int_Literal>(6),
                                                             L3::make_AST<L3::Var>("no")));
 
-                REQUIRE_THROWS(ba.to_L2());
+                REQUIRE(ba.to_L2() == "(sad_face <- no < 6)\n");
+        }
+}
+#endif
+///////////////////////////////////////////////////////////////////////////////
+//                                Step Assign                                 //
+///////////////////////////////////////////////////////////////////////////////
+
+Step_Assignment::Step_Assignment(L3::ast_ptr lhs,
+                                 L3::ast_ptr rhs) :
+        rhs(rhs),
+        lhs(lhs){
+        if(!step(lhs, rhs)){
+                throw std::logic_error("that's not a +1 or a -1, go get a binop tile");
+        }
+}
+
+int64_t Step_Assignment::step(L3::ast_ptr lhs, L3::ast_ptr rhs){
+        auto var = L3::node_cast<L3::Var>(lhs);
+        auto binop_ptr = L3::node_cast<L3::Binop>(rhs);
+        if(!var || !binop_ptr){
+                return 0;
+        }
+
+        auto a = binop_ptr->get_lhs();
+        auto b = binop_ptr->get_rhs();
+        if(binop_ptr->op == L3::Binop::plus && L3::is_one_of<L3::Int_Literal>(a)){
+                std::swap(a, b);
+        }
+
+        auto a_var = L3::node_cast<L3::Var>(a);
+        auto num = L3::node_cast<L3::Int_Literal>(b);
+        if(!a_var || a_var->name != var->name || !num){
+                return 0;
+        }
+
+        int64_t by = 0;
+        if(binop_ptr->op == L3::Binop::plus){
+                by = num->val;
+        } else if(binop_ptr->op == L3::Binop::minus){
+                by = -num->val;
+        }
+        return by == 1 || by == -1 ? by : 0;
+}
+
+bool Step_Assignment::covers(L3::ast_ptr item){
+        auto assign = L3::node_cast<L3::Assignment>(item);
+        return assign && step(assign->get_lhs(), assign->get_rhs()) != 0;
+}
+
+void Step_Assignment::emit(L3::L2_Insts& out){
+        auto var = L2_Operand::of(lhs, labels);
+        out.push_back(step(lhs, rhs) > 0 ? L2_Inst::inc(var) : L2_Inst::dec(var));
+}
+
+#ifdef UNIT_TEST
+TEST_CASE("one step at a time"){
+        auto x = L3::make_AST<L3::Var>("x");
+        auto one = L3::make_AST<L3::Int_Literal>(1);
+
+        REQUIRE(Step_Assignment(x, L3::make_AST<L3::Binop>(L3::Binop::plus, x, one)).to_L2() == "(x++)\n");
+        REQUIRE(Step_Assignment(x, L3::make_AST<L3::Binop>(L3::Binop::plus, one, x)).to_L2() == "(x++)\n");
+        REQUIRE(Step_Assignment(x, L3::make_AST<L3::Binop>(L3::Binop::minus, x, one)).to_L2() == "(x--)\n");
+        REQUIRE(Step_Assignment(x, L3::make_AST<L3::Binop>(L3::Binop::plus, x,
+                                                          L3::make_AST<L3::Int_Literal>(-1))).to_L2() == "(x--)\n");
+
+        SECTION("only into the same var"){
+                auto y = L3::make_AST<L3::Var>("y");
+                REQUIRE_THROWS(Step_Assignment(y, L3::make_AST<L3::Binop>(L3::Binop::plus, x, one)));
+                REQUIRE_THROWS(Step_Assignment(x, L3::make_AST<L3::Binop>(L3::Binop::minus, one, x)));
+                REQUIRE_THROWS(Step_Assignment(x, L3::make_AST<L3::Binop>(L3::Binop::mult, x, one)));
+        }
+
+        SECTION("and the matchers pick it"){
+                auto inc = L3::make_AST<L3::Assignment>(x, L3::make_AST<L3::Binop>(L3::Binop::plus, x, one));
+                auto gen = [](){ return std::string(":ret"); };
+                REQUIRE(match_me_bro(inc, gen)->to_L2() == "(x++)\n");
+                REQUIRE(match_tile(inc, gen)->to_L2() == "(x++)\n");
         }
 }
 #endif
@@ -376,24 +405,15 @@ Goto::Goto(ast_ptr target) :
 }
 
 
-std::string Goto::to_L2(){
-        std::stringstream ss;
-
-        Dump v;
-
-        v.result << "(";
-        v.result << "goto";
-        v.result << " ";
-        target->accept(v);
-        v.result << ")";
-        return v.result.str();
+void Goto::emit(L3::L2_Insts& out){
+        out.push_back(L2_Inst::goto_(L2_Operand::of(target, labels).name));
 }
 
 #ifdef UNIT_TEST
 TEST_CASE("Going to the going to place"){
         SECTION("Going there"){
                 Goto gt(L3::make_AST<L3::Label>(":there"));
-                REQUIRE(gt.to_L2() == "(goto :there)");
+                REQUIRE(gt.to_L2() == "(goto :there)\n");
         }
 }
 #endif
@@ -408,20 +428,12 @@ Cjump::Cjump(ast_ptr cmp_result, ast_ptr t_target, ast_ptr f_target) :
 {}
 
 
-std::string Cjump::to_L2(){
-        Dump v;
-
-        v.result << "(";
-        v.result << "cjump";
-        v.result << " ";
-        v.result << "0" << " < "; cmp_result->accept(v);
-        v.result << " ";
-        t_target->accept(v);
-        v.result << " ";
-        f_target->accept(v);
-        v.result << ")\n";
-
-        return v.result.str();
+void Cjump::emit(L3::L2_Insts& out){
+        out.push_back(L2_Inst::cjump(L2_Operand::number(0),
+                                     L3::Binop::le,
+                                     L2_Operand::of(cmp_result, labels),
+                                     L2_Operand::of(t_target, labels).name,
+                                     L2_Operand::of(f_target, labels).name));
 }
 
 #ifdef UNIT_TEST
@@ -440,19 +452,10 @@ Val_Return::Val_Return(ast_ptr result) :
         result(result)
 {}
 
-std::string Val_Return::to_L2(){
-        Dump v;
-
-        v.result << "(";
-        v.result << "rax";
-        v.result << " <- ";
-        result->accept(v); // This isn't confusing at all. Great job Brotato.
-        v.result << ")\n";
-        v.result << "(";
-        v.result << "return";
-        v.result << ")\n";
-
-        return v.result.str();
+void Val_Return::emit(L3::L2_Insts& out){
+        // This isn't confusing at all. Great job Brotato.
+        out.push_back(L2_Inst::move(rax(), L2_Operand::of(result, labels)));
+        out.push_back(L2_Inst::return_());
 }
 
 #ifdef UNIT_TEST
@@ -470,14 +473,8 @@ TEST_CASE("returning a value"){
 Void_Return::Void_Return()
 {}
 
-std::string Void_Return::to_L2(){
-        Dump v;
-
-        v.result << "(";
-        v.result << "return";
-        v.result << ")\n";
-
-        return v.result.str();
+void Void_Return::emit(L3::L2_Insts& out){
+        out.push_back(L2_Inst::return_());
 }
 
 #ifdef UNIT_TEST
@@ -498,51 +495,38 @@ Call::Call(ast_ptr target, std::vector<ast_ptr> args, L3::Label retlab) :
         retlab(retlab)
 {}
 
-std::string Call::to_L2(){
-        static std::array<char*, 6> arg_reg_str = {"rdi",
-                                                   "rsi",
-                                                   "rdx",
-                                                   "rcx",
-                                                   "r8",
-                                                   "r9"};
-
-
-        Dump v;
-
-        for(int i = 0; i < args.size(); i++){
+void Call::emit(L3::L2_Insts& out){
+        static std::array<L2_Operand, 6> arg_regs = {reg("rdi"),
+                                                     reg("rsi"),
+                                                     reg("rdx"),
+                                                     reg("rcx"),
+                                                     reg("r8"),
+                                                     reg("r9")};
+        static auto rsp = Symbol{std::string("rsp")};
+
+        // All at once, so an arg that's sitting in an arg register gets
+        // read before it's overwritten. rax is free until the call.
+        std::vector<L2_Move> moves;
+        for(std::size_t i = 0; i < args.size(); i++){
                 if(i < 6){
-                        v.result << "(";
-                        v.result << arg_reg_str[i];
-                        v.result << " <- ";
-                        args[i]->accept(v);
-                        v.result << ")\n";
+                        moves.push_back(L2_Move{arg_regs[i], L2_Operand::of(args[i], labels)});
                 } else{
-                        v.result << "(";
-                        v.result << "(";
-                        v.result << "mem rsp ";
-                        v.result << -16 - (8 *(i - 6));
-                        v.result << ")";
-
-                        v.result << " <- ";
-                        args[i]->accept(v);
-                        v.result << ")\n";
+                        moves.push_back(L2_Move{L2_Operand::mem(rsp, -16 - 8 * int64_t(i - 6)),
+                                                L2_Operand::of(args[i], labels)});
                 }
         }
+        parallel_move(moves, rax().name, out);
 
+        // The runtime comes straight back, no return address needed
+        if(L3::is_runtime_call(target)){
+                out.push_back(L2_Inst::call(L2_Operand::of(target, labels), args.size()));
+                return;
+        }
 
-        v.result << "((mem rsp -8) <- ";
-        retlab.accept(v);
-        v.result << ")\n";
-        v.result << "(call";
-        v.result << " ";
-        target->accept(v);
-        v.result << " ";
-        v.result << args.size();
-        v.result << ")\n";
-        retlab.accept(v);
-        v.result << "\n";
-
-        return v.result.str();
+        auto ret = L2_Operand::of(&retlab, labels);
+        out.push_back(L2_Inst::move(L2_Operand::mem(rsp, -8), ret));
+        out.push_back(L2_Inst::call(L2_Operand::of(target, labels), args.size()));
+        out.push_back(L2_Inst::label(ret.name));
 }
 
 #ifdef UNIT_TEST
@@ -559,6 +543,27 @@ TEST_CASE("Call me baby"){
                         "(call :call_me_please_im_so_alone 2)\n"
                         ":rett\n");
         }
+        SECTION("The runtime doesn't need to be told where to come back to"){
+                Call a_call(L3::make_AST<L3::Var>("print"),
+                            {L3::make_AST<L3::Var>("Hi")},
+                            L3::Label(""));
+                REQUIRE(a_call.to_L2() ==
+                        "(rdi <- Hi)\n"
+                        "(call print 1)\n");
+        }
+        SECTION("Args already in each other's registers"){
+                Call a_call(L3::make_AST<L3::Label>(":swap"),
+                            {L3::make_AST<L3::Var>("rsi"),
+                                            L3::make_AST<L3::Var>("rdi")},
+                            L3::Label(":rett"));
+                REQUIRE(a_call.to_L2() ==
+                        "(rax <- rdi)\n"
+                        "(rdi <- rsi)\n"
+                        "(rsi <- rax)\n"
+                        "((mem rsp -8) <- :rett)\n"
+                        "(call :swap 2)\n"
+                        ":rett\n");
+        }
         SECTION("Calling you too many times. Now you're blocked (spilled)"){
                 Call a_call(L3::make_AST<L3::Label>(":call_me_please_im_so_alone"),
                             {L3::make_AST<L3::Var>("Hi"),
@@ -600,14 +605,14 @@ Label::Label(ast_ptr lab) :
         assert(is_one_of<L3::Label>(lab));
 }
 
-std::string Label::to_L2(){
-        Dump v;
-
-        lab->accept(v);
-
-        return v.result.str();
+void Label::emit(L3::L2_Insts& out){
+        out.push_back(L2_Inst::label(L2_Operand::of(lab, labels).name));
 }
 
+#ifdef UNIT_TEST
+// The old ladder of ifs. match_tile is what the compiler uses, this is
+// what it gets checked and timed against.
+
 /////////////////////////////////////////////////////////////////////////////////////////
 // Matchmaker matchmaker make me a match. Because I created you. I AM YOUR GOD. BOW TO ME.
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -624,10 +629,6 @@ tile_ptr L3::Tile::match_me_bro(L3::ast_ptr item, std::function<std::string()> n
         L3::Assignment* assignement_ptr = nullptr;
 
 
-        // Whelp this is ugly.... SAD Eventually this will have recursive calls and
-        // I can strip out the visited flag
-
-
         // FORTRAN CODE STARTS HERE
         if(L3::is_one_of<L3::Assignment>(item)){
                 // of course we need a goto, if this is FORTRAN
@@ -635,115 +636,64 @@ tile_ptr L3::Tile::match_me_bro(L3::ast_ptr item, std::function<std::string()> n
                 goto SAD;
         SAD:
 
-                auto assgn_ptr = std::dynamic_pointer_cast<L3::Assignment>(item);
+                auto assgn_ptr = L3::node_cast<L3::Assignment>(item);
 
                 if(L3::is_one_of<L3::Var>(assgn_ptr->get_lhs())){
-                        assgn_ptr->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-                        assgn_ptr->
-                                get_lhs()->
-                                has_already_been_tiled_why_are_you_still_here_question_mark = true;
-                        assgn_ptr->
-                                get_rhs()->
-                                has_already_been_tiled_why_are_you_still_here_question_mark = true;
-
                         if(is_s(assgn_ptr->get_rhs()) && L3::is_one_of<L3::Var>(assgn_ptr->get_lhs())){
                                 return make_tile<Atom_Assignment>(assgn_ptr->get_lhs(), assgn_ptr->get_rhs());
                         }
 
                         if(L3::is_one_of<L3::Load>(assgn_ptr->get_rhs())){
-                                auto load_ptr = std::dynamic_pointer_cast<L3::Load>(assgn_ptr->get_rhs());
-
-                                load_ptr->get_loadee()->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-
                                 return make_tile<Load_Assignment>(assgn_ptr->get_lhs(), assgn_ptr->get_rhs());
                         }
 
+                        if(Step_Assignment::covers(item)){
+                                return make_tile<Step_Assignment>(assgn_ptr->get_lhs(), assgn_ptr->get_rhs());
+                        }
+
                         if(L3::is_one_of<L3::Binop>(assgn_ptr->get_rhs())
                            && L3::is_one_of<L3::Var>(assgn_ptr->get_lhs())){
-                                auto binop_ptr = std::dynamic_pointer_cast<L3::Binop>(assgn_ptr->get_rhs());
-
-                                binop_ptr->get_lhs()->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-                                binop_ptr->get_rhs()->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-
                                 return make_tile<Binop_Assignment>(assgn_ptr->get_lhs(), assgn_ptr->get_rhs());
                         }
 
                         if(L3::is_one_of<L3::Call>(assgn_ptr->get_rhs())){
-
-                                assgn_ptr->get_lhs()->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-
-                                auto call_ptr = std::dynamic_pointer_cast<L3::Call>(assgn_ptr->get_rhs());
-                                item->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-                                call_ptr->get_callee()->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-                                for(auto thing : call_ptr->get_args()){
-                                        thing->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-                                }
-
                                 return make_tile<Call_Assignment>(assgn_ptr->get_lhs(), assgn_ptr->get_rhs(), name_gen);
                         }
                 }
 
                 if(L3::is_one_of<L3::Store>(assgn_ptr->get_lhs())
                    && L3::is_s(assgn_ptr->get_rhs())){
-
-                        auto store_ptr = std::dynamic_pointer_cast<L3::Store>(assgn_ptr->get_lhs());
-
-                        store_ptr->get_storee()->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-
                         return make_tile<Store_Assignment>(assgn_ptr->get_lhs(), assgn_ptr->get_rhs());
                 }
         }
 
         if (L3::is_one_of<L3::Goto>(item)){
-                auto goto_ptr = std::dynamic_pointer_cast<L3::Goto>(item);
-                item->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-                goto_ptr->get_target()->has_already_been_tiled_why_are_you_still_here_question_mark = true;
+                auto goto_ptr = L3::node_cast<L3::Goto>(item);
                 return make_tile<Goto>(goto_ptr->get_target());
         }
 
         if (L3::is_one_of<L3::Cjump>(item)){
-                auto cjump_ptr = std::dynamic_pointer_cast<L3::Cjump>(item);
-                item->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-                cjump_ptr->get_cond()->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-                cjump_ptr->get_true_target()->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-                cjump_ptr->get_false_target()->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-
+                auto cjump_ptr = L3::node_cast<L3::Cjump>(item);
                 return make_tile<Cjump>(cjump_ptr->get_cond(),
                                         cjump_ptr->get_true_target(),
                                         cjump_ptr->get_false_target());
         }
 
         if (L3::is_one_of<L3::Call>(item)){
-                auto call_ptr = std::dynamic_pointer_cast<L3::Call>(item);
-                item->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-
-                call_ptr->get_callee()->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-
-                for(auto thing : call_ptr->get_args()){
-                        thing->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-                }
-
-                return make_tile<Call>(call_ptr->get_callee(), call_ptr->get_args(), L3::Label{name_gen()});
+                auto call_ptr = L3::node_cast<L3::Call>(item);
+                return make_tile<Call>(call_ptr->get_callee(), call_ptr->get_args(), return_label(call_ptr->get_callee(), name_gen));
         }
 
         if(L3::is_one_of<L3::Val_Return>(item)){
-                auto r_ptr = std::dynamic_pointer_cast<L3::Val_Return>(item);
-
-                item->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-                r_ptr->get_result()->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-
+                auto r_ptr = L3::node_cast<L3::Val_Return>(item);
                 return make_tile<Val_Return>(r_ptr->get_result());
         }
 
         if(L3::is_one_of<L3::Void_Return>(item)){
-                item->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-
                 return make_tile<Void_Return>();
         }
 
         if(L3::is_one_of<L3::Label>(item)){
-                item->has_already_been_tiled_why_are_you_still_here_question_mark = true;
-
                 return make_tile<Label>(item);
         }
 
@@ -755,8 +705,166 @@ tile_ptr L3::Tile::match_me_bro(L3::ast_ptr item, std::function<std::string()> n
 
         throw std::logic_error("This impossible. Go home manny, you're drunk");
 }
+#endif
 
 
+///////////////////////////////////////////////////////////////////////////////
+//                              The tile table                               //
+///////////////////////////////////////////////////////////////////////////////
+
+namespace{
+        using name_gen_t = std::function<std::string()>;
+
+        const Kind_Set s_kinds = kinds(L3::Kind::var, L3::Kind::int_literal, L3::Kind::label);
+
+        L3::Assignment* as_assignment(L3::ast_ptr item){
+                return L3::node_cast<L3::Assignment>(item);
+        }
+}
+
+const std::vector<Tile_Spec>& L3::Tile::tile_specs(){
+        static const std::vector<Tile_Spec> specs = {
+                {L3::Kind::assignment, kinds(L3::Kind::var), s_kinds,
+                 [](L3::ast_ptr item, const name_gen_t&){
+                         auto a = as_assignment(item);
+                         return make_tile<Atom_Assignment>(a->get_lhs(), a->get_rhs());
+                 }},
+                {L3::Kind::assignment, kinds(L3::Kind::var), kinds(L3::Kind::load),
+                 [](L3::ast_ptr item, const name_gen_t&){
+                         auto a = as_assignment(item);
+                         return make_tile<Load_Assignment>(a->get_lhs(), a->get_rhs());
+                 }},
+                {L3::Kind::assignment, kinds(L3::Kind::var), kinds(L3::Kind::binop),
+                 [](L3::ast_ptr item, const name_gen_t&){
+                         auto a = as_assignment(item);
+                         return make_tile<Step_Assignment>(a->get_lhs(), a->get_rhs());
+                 },
+                 Step_Assignment::covers},
+                {L3::Kind::assignment, kinds(L3::Kind::var), kinds(L3::Kind::binop),
+                 [](L3::ast_ptr item, const name_gen_t&){
+                         auto a = as_assignment(item);
+                         return make_tile<Binop_Assignment>(a->get_lhs(), a->get_rhs());
+                 }},
+                {L3::Kind::assignment, kinds(L3::Kind::var), kinds(L3::Kind::call),
+                 [](L3::ast_ptr item, const name_gen_t& name_gen){
+                         auto a = as_assignment(item);
+                         return make_tile<Call_Assignment>(a->get_lhs(), a->get_rhs(), name_gen);
+                 }},
+                {L3::Kind::assignment, kinds(L3::Kind::store), s_kinds,
+                 [](L3::ast_ptr item, const name_gen_t&){
+                         auto a = as_assignment(item);
+                         return make_tile<Store_Assignment>(a->get_lhs(), a->get_rhs());
+                 }},
+                {L3::Kind::goto_, any_kind, any_kind,
+                 [](L3::ast_ptr item, const name_gen_t&){
+                         return make_tile<Goto>(L3::node_cast<L3::Goto>(item)->get_target());
+                 }},
+                {L3::Kind::cjump, any_kind, any_kind,
+                 [](L3::ast_ptr item, const name_gen_t&){
+                         auto cjump_ptr = L3::node_cast<L3::Cjump>(item);
+                         return make_tile<Cjump>(cjump_ptr->get_cond(),
+                                                 cjump_ptr->get_true_target(),
+                                                 cjump_ptr->get_false_target());
+                 }},
+                {L3::Kind::call, any_kind, any_kind,
+                 [](L3::ast_ptr item, const name_gen_t& name_gen){
+                         auto call_ptr = L3::node_cast<L3::Call>(item);
+                         return make_tile<Call>(call_ptr->get_callee(), call_ptr->get_args(), return_label(call_ptr->get_callee(), name_gen));
+                 }},
+                {L3::Kind::val_return, any_kind, any_kind,
+                 [](L3::ast_ptr item, const name_gen_t&){
+                         return make_tile<Val_Return>(L3::node_cast<L3::Val_Return>(item)->get_result());
+                 }},
+                {L3::Kind::void_return, any_kind, any_kind,
+                 [](L3::ast_ptr item, const name_gen_t&){
+                         return make_tile<Void_Return>();
+                 }},
+                {L3::Kind::label, any_kind, any_kind,
+                 [](L3::ast_ptr item, const name_gen_t&){
+                         return make_tile<Label>(item);
+                 }},
+        };
+        return specs;
+}
+
+namespace{
+        // Kinds fit in 4 bits, with the last value left over for "no operand"
+        const unsigned kind_bits = 4;
+        const unsigned no_operand = (1u << kind_bits) - 1;
+        static_assert(static_cast<unsigned>(L3::Kind::runtime_fun) < no_operand,
+                      "too many node kinds for the tile table");
+
+        unsigned state_of(unsigned root, unsigned first, unsigned second){
+                return (root << (2 * kind_bits)) | (first << kind_bits) | second;
+        }
+
+        unsigned operand_kind(L3::Instruction* inst, std::size_t i){
+                return i < inst->operands.size()
+                     ? static_cast<unsigned>(inst->operands[i]->kind)
+                     : no_operand;
+        }
+
+        // Which specs might cover each (root, first, second), in the order
+        // they get tried: state's are specs[begin[state]] up to
+        // specs[begin[state + 1]]. Nothing after one without a guard
+        // could ever win, so that's where each list stops.
+        struct State_Table{
+                static const unsigned states = 1u << (3 * kind_bits);
+
+                std::array<uint16_t, states + 1> begin;
+                std::vector<int16_t> specs;
+
+                explicit State_Table(const std::vector<Tile_Spec>& all){
+                        for(unsigned root = 0; root < no_operand; root++){
+                                for(unsigned first = 0; first <= no_operand; first++){
+                                        for(unsigned second = 0; second <= no_operand; second++){
+                                                begin[state_of(root, first, second)] = specs.size();
+                                                for(std::size_t s = 0; s < all.size(); s++){
+                                                        if(static_cast<unsigned>(all[s].root) == root
+                                                           && (all[s].first >> first & 1)
+                                                           && (all[s].second >> second & 1)){
+                                                                specs.push_back(s);
+                                                                if(!all[s].guard){
+                                                                        break;
+                                                                }
+                                                        }
+                                                }
+                                        }
+                                }
+                        }
+                        // no_operand roots don't exist, but still need a begin
+                        for(unsigned state = state_of(no_operand, 0, 0); state <= states; state++){
+                                begin[state] = specs.size();
+                        }
+                }
+        };
+
+        const State_Table& state_table(){
+                static const State_Table table{tile_specs()};
+                return table;
+        }
+}
+
+tile_ptr L3::Tile::match_tile(L3::ast_ptr item, std::function<std::string()> name_gen){
+        auto inst = L3::node_cast<L3::Instruction>(item);
+        if(inst){
+                auto& table = state_table();
+                auto state = state_of(static_cast<unsigned>(inst->kind),
+                                      operand_kind(inst, 0),
+                                      operand_kind(inst, 1));
+                for(auto s = table.begin[state]; s < table.begin[state + 1]; s++){
+                        auto& spec = tile_specs()[table.specs[s]];
+                        if(!spec.guard || spec.guard(item)){
+                                return spec.make(item, name_gen);
+                        }
+                }
+        }
+
+        Dump v;
+        item->accept(v);
+        throw std::logic_error("no tile for " + v.result.str());
+}
+
 #ifdef UNIT_TEST
 TEST_CASE("The tile matcher can match things"){
         SECTION("Assignment"){
@@ -766,8 +874,8 @@ TEST_CASE("The tile matcher can match things"){
 
                         auto some_tile = match_me_bro(my_downfall, [](){ return ":rett";});
 
-                        Atom_Assignment no{L3::ast_ptr {new L3::Var{"hi_mom"} },
-                                        L3::L3_ptr<L3::AST_Item>{new L3::Var{"mork"}}};
+                        Atom_Assignment no{L3::make_AST<L3::Var>("hi_mom"),
+                                        L3::make_AST<L3::Var>("mork")};
 
                         REQUIRE(some_tile->to_L2() == no.to_L2());
                 }
@@ -778,8 +886,8 @@ TEST_CASE("The tile matcher can match things"){
 
                         auto some_tile = match_me_bro(my_downfall, [](){ return ":rett";});
 
-                        Load_Assignment no{L3::ast_ptr {new L3::Var{"hi_mom"} },
-                                        L3::make_AST<L3::Load>(L3::L3_ptr<L3::AST_Item>{new L3::Var{"mork"}})};
+                        Load_Assignment no{L3::make_AST<L3::Var>("hi_mom"),
+                                        L3::make_AST<L3::Load>(L3::make_AST<L3::Var>("mork"))};
 
                         REQUIRE(some_tile->to_L2() == no.to_L2());
                 }
@@ -794,8 +902,8 @@ TEST_CASE("The tile matcher can match things"){
                         auto some_tile = match_me_bro(my_downfall, [](){ return ":rett";});
 
                         Store_Assignment no{
-                                L3::make_AST<L3::Store>(L3::L3_ptr<L3::AST_Item>{new L3::Var{"mork"}}),
-                                        L3::ast_ptr {new L3::Var{"hi_mom"} }};
+                                L3::make_AST<L3::Store>(L3::make_AST<L3::Var>("mork")),
+                                        L3::make_AST<L3::Var>("hi_mom")};
 
                         REQUIRE(some_tile->to_L2() == no.to_L2());
                 }
@@ -811,7 +919,7 @@ TEST_CASE("The tile matcher can match things"){
                         auto some_tile = match_me_bro(my_downfall, [](){ return ":rett";});
 
                         Binop_Assignment no{
-                                L3::ast_ptr {new L3::Var{"hi_mom"} },
+                                L3::make_AST<L3::Var>("hi_mom"),
                                         L3::make_AST<L3::Binop>(L3::Binop::plus,
                                                                 L3::make_AST<L3::Var>("lhs"),
                                                                 L3::make_AST<L3::Var>("rhs"))
@@ -821,7 +929,7 @@ TEST_CASE("The tile matcher can match things"){
                 }
 
                 SECTION("Goto"){
-                        auto why_bother = L3::make_AST<L3::Goto>(std::make_shared<L3::Label>(":nope"));
+                        auto why_bother = L3::make_AST<L3::Goto>(L3::make_node<L3::Label>(":nope"));
 
                         auto stop_in_the_name_of_love = match_me_bro(why_bother, [](){ return ":rett";});
 
@@ -831,9 +939,9 @@ TEST_CASE("The tile matcher can match things"){
                 }
 
                 SECTION("cjump"){
-                        auto why_bother = L3::make_AST<L3::Cjump>(std::make_shared<L3::Var>("stahp"),
-                                                                  std::make_shared<L3::Label>(":yup"),
-                                                                  std::make_shared<L3::Label>(":nope"));
+                        auto why_bother = L3::make_AST<L3::Cjump>(L3::make_node<L3::Var>("stahp"),
+                                                                  L3::make_node<L3::Label>(":yup"),
+                                                                  L3::make_node<L3::Label>(":nope"));
 
                         auto stop_in_the_name_of_love = match_me_bro(why_bother, [](){ return ":rett";});
 
@@ -911,3 +1019,82 @@ TEST_CASE("The tile matcher can match things"){
         }
 }
 #endif
+
+#ifdef UNIT_TEST
+namespace{
+     const char* every_kind_of_instruction =
+          "define :main(){\n"
+          "  x <- 5\n"
+          "  y <- :main\n"
+          "  z <- x\n"
+          "  a <- call allocate(x, 1)\n"
+          "  v <- load a\n"
+          "  store a <- z\n"
+          "  store a <- 7\n"
+          "  w <- v + x\n"
+          "  w <- 1 + w\n"
+          "  w <- w - 1\n"
+          "  x <- w - 1\n"
+          "  c <- v < x\n"
+          "  call print(w)\n"
+          "  r <- call :f(a, x, y, z, v, w, c, 1)\n"
+          "  br c :yes :no\n"
+          "  :yes\n"
+          "  br :no\n"
+          "  :no\n"
+          "  return\n"
+          "}\n"
+          "define :f(a, b, c, d, e, f, g, h){\n"
+          "  return a\n"
+          "}\n";
+}
+
+TEST_CASE("the tile table picks what match_me_bro picks"){
+     std::string src{every_kind_of_instruction};
+     L3::Program p = L3::ll_parse(src.data(), src.data() + src.size(), "test");
+
+     for(auto& fun : p.functions){
+          for(auto inst : fun->instructions){
+               auto table_tile = match_tile(inst, [](){ return ":rett";});
+               auto ladder_tile = match_me_bro(inst, [](){ return ":rett";});
+               REQUIRE(table_tile->to_L2() == ladder_tile->to_L2());
+          }
+     }
+
+     SECTION("and finds nothing where there's nothing to find"){
+          auto nope = L3::make_AST<L3::Assignment>(L3::make_AST<L3::Store>(L3::make_AST<L3::Var>("a")),
+                                                   L3::make_AST<L3::Load>(L3::make_AST<L3::Var>("b")));
+          REQUIRE_THROWS(match_tile(nope, [](){ return ":rett";}));
+          REQUIRE_THROWS(match_tile(L3::make_AST<L3::Var>("a"), [](){ return ":rett";}));
+     }
+}
+
+TEST_CASE("tile matcher throughput", "[.][bench]"){
+     std::string src;
+     for(int i = 0; i < 2000; i++){
+          src += every_kind_of_instruction;
+     }
+     L3::Program p = L3::ll_parse(src.data(), src.data() + src.size(), "bench");
+
+     std::vector<L3::ast_ptr> insts;
+     for(auto& fun : p.functions){
+          insts.insert(insts.end(), fun->instructions.begin(), fun->instructions.end());
+     }
+
+     auto time = [&](const char* what, tile_ptr (*matcher)(L3::ast_ptr, std::function<std::string()>)){
+          std::function<std::string()> name_gen = [](){ return ":rett";};
+          auto start = std::chrono::steady_clock::now();
+          std::size_t matched = 0;
+          for(int round = 0; round < 10; round++){
+               for(auto inst : insts){
+                    matched += matcher(inst, name_gen) != nullptr;
+               }
+          }
+          std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+          std::cout << what << matched / took.count() / 1e6 << " M instructions/s\n";
+     };
+
+     time("match_me_bro: ", match_me_bro);
+     time("match_tile:   ", match_tile);
+}
+#endif
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <L3.h>
+#include <l2.h>
 
 #include <boost/optional/optional.hpp>
 
@@ -15,7 +16,15 @@ struct Tile{
      using tile_ptr = std::shared_ptr<Tile>;
 
      std::vector<std::shared_ptr<Tile>> children;
-     virtual std::string to_L2() = 0;
+
+     // Appends this tile's L2 instructions to out
+     virtual void emit(L3::L2_Insts& out) = 0;
+     std::string to_L2(); // emit and print, handy in tests
+
+     // What labels are called in L2, for this tile and its children.
+     // Without one they keep their L3 names.
+     void name_labels(const L3::Label_Names* names);
+     const L3::Label_Names* labels{nullptr};
 };
 
 
@@ -33,7 +42,7 @@ struct Atom_Assignment:
      ast_ptr lhs;
      L3_ptr<L3::AST_Item> rhs_atom; // Must be: Var | Label | Int Literal
 
-     std::string to_L2() override;
+     void emit(L3::L2_Insts& out) override;
 
 };
 
@@ -49,7 +58,7 @@ struct Load_Assignment:
      ast_ptr  rhs; // must be load!
 
 
-     std::string to_L2() override;
+     void emit(L3::L2_Insts& out) override;
 };
 
 struct Store_Assignment:
@@ -61,7 +70,7 @@ struct Store_Assignment:
      ast_ptr rhs;
 
 
-     std::string to_L2() override;
+     void emit(L3::L2_Insts& out) override;
 };
 
 struct Binop_Assignment
@@ -73,7 +82,25 @@ struct Binop_Assignment
      L3_ptr<L3::AST_Item> rhs;
      L3_ptr<L3::AST_Item> lhs;
 
-     std::string to_L2() override;
+     void emit(L3::L2_Insts& out) override;
+};
+
+// x <- x + 1 and x <- x - 1, as (x++) and (x--)
+struct Step_Assignment
+     : public Tile {
+
+     Step_Assignment(L3::ast_ptr lhs, L3::ast_ptr rhs);
+     const static int size = 5;
+
+     // Is lhs <- rhs one of these? How far it goes, 0 if it isn't.
+     static int64_t step(L3::ast_ptr lhs, L3::ast_ptr rhs);
+     // Same question about a whole instruction, for the tile table
+     static bool covers(L3::ast_ptr item);
+
+     L3_ptr<L3::AST_Item> rhs;
+     L3_ptr<L3::AST_Item> lhs;
+
+     void emit(L3::L2_Insts& out) override;
 };
 
 struct Call_Assignment
@@ -88,7 +115,7 @@ struct Call_Assignment
      L3_ptr<L3::AST_Item> rhs;
      L3_ptr<L3::AST_Item> lhs;
 
-     std::string to_L2() override;
+     void emit(L3::L2_Insts& out) override;
 };
 
 
@@ -100,7 +127,7 @@ struct Goto
      const static int size = 1;
      L3_ptr<L3::AST_Item> target;
 
-     std::string to_L2() override;
+     void emit(L3::L2_Insts& out) override;
 };
 
 struct Cjump
@@ -113,20 +140,20 @@ struct Cjump
      ast_ptr t_target;
      ast_ptr f_target;
 
-     std::string to_L2() override;
+     void emit(L3::L2_Insts& out) override;
 };
 
 struct Val_Return
      : public Tile{
      Val_Return(ast_ptr result);
      L3_ptr<AST_Item> result;
-     std::string to_L2() override;
+     void emit(L3::L2_Insts& out) override;
 };
 
 struct Void_Return
      : public Tile{
      Void_Return();
-     std::string to_L2() override;
+     void emit(L3::L2_Insts& out) override;
 };
 
 struct Call
@@ -139,7 +166,7 @@ struct Call
      std::vector<L3_ptr<L3::AST_Item>> args;
      L3::Label retlab;
 
-     std::string to_L2() override;
+     void emit(L3::L2_Insts& out) override;
 };
 
 // Atom tiles :
@@ -152,7 +179,7 @@ struct Label
 
      Label(ast_ptr lab);
 
-     std::string to_L2() override;
+     void emit(L3::L2_Insts& out) override;
 
      ast_ptr lab;
 };
@@ -168,8 +195,46 @@ struct Runtime_Fun
 };
 
 
-
+#ifdef UNIT_TEST
+// The hand-written matcher match_tile replaced, for the tests to compare with
 tile_ptr match_me_bro(L3::ast_ptr item, std::function<std::string()> name_gen);
+#endif
+
+
+/*
+  The tile set, written down as data. A spec names the instruction kind it
+  covers and the kinds its first two operands may have, plus a guard when
+  the kinds alone don't say enough. All the specs get folded into one state
+  table indexed by those three kinds, so matching is a single lookup however
+  many tiles there are, and then a guard call or two. Earlier specs win.
+
+  Adding a tile is adding a line to tile_specs() in tiles.cpp.
+*/
+using Kind_Set = uint32_t;
+
+constexpr Kind_Set any_kind = ~Kind_Set{0};
+
+constexpr Kind_Set kinds(){
+     return 0;
+}
+
+template<typename... More>
+constexpr Kind_Set kinds(L3::Kind kind, More... more){
+     return (Kind_Set{1} << static_cast<unsigned>(kind)) | kinds(more...);
+}
+
+struct Tile_Spec{
+     L3::Kind root;
+     Kind_Set first;  // operands[0], or no operand at all
+     Kind_Set second; // operands[1], same deal
+     tile_ptr (*make)(L3::ast_ptr item, const std::function<std::string()>& name_gen);
+     bool (*guard)(L3::ast_ptr item);  // left out, it always fits
+};
+
+const std::vector<Tile_Spec>& tile_specs();
+
+// The tile for item, off the state table
+tile_ptr match_tile(L3::ast_ptr item, std::function<std::string()> name_gen);
 
 }
 }
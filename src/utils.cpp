@@ -1,15 +1,133 @@
 #include <utils.h>
-#include <fstream>
-#include <sstream>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef UNIT_TEST
+#include <catch.hpp>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#endif
 
 using namespace L3;
 
 std::string L3::slurp_file(std::string filename){
-        std::stringstream ss;
+        Mapped_File f{filename};
+
+        return std::string(f.begin(), f.end());
+}
+
+// an empty file still needs a valid (empty) range, mmap refuses length 0
+static const char empty_file[1] = {'\0'};
+
+Mapped_File::Mapped_File(const std::string& filename) :
+        data(empty_file),
+        len(0)
+{
+        int fd = open(filename.c_str(), O_RDONLY);
+        if(fd < 0){
+                throw std::runtime_error("can't open " + filename);
+        }
+
+        struct stat st;
+        if(fstat(fd, &st) < 0){
+                close(fd);
+                throw std::runtime_error("can't stat " + filename);
+        }
+
+        if(st.st_size > 0){
+                void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(mapped == MAP_FAILED){
+                        close(fd);
+                        throw std::runtime_error("can't mmap " + filename);
+                }
+                madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+
+                data = static_cast<const char*>(mapped);
+                len = st.st_size;
+        }
+
+        // the mapping keeps the file alive on its own
+        close(fd);
+}
+
+Mapped_File::~Mapped_File(){
+        if(len){
+                munmap(const_cast<char*>(data), len);
+        }
+}
+
+int64_t L3::decode_int64(const char* begin, const char* end){
+        const char* it = begin;
+        bool negative = false;
+
+        if(it != end && (*it == '-' || *it == '+')){
+                negative = *it == '-';
+                it++;
+        }
 
-        std::ifstream f{filename};
+        if(it == end){
+                throw std::invalid_argument("decode_int64: no digits");
+        }
+
+        // accumulate the magnitude unsigned so INT64_MIN still fits
+        const uint64_t limit = negative ? uint64_t(INT64_MAX) + 1 : uint64_t(INT64_MAX);
+        uint64_t magnitude = 0;
+
+        for(; it != end; it++){
+                if(*it < '0' || *it > '9'){
+                        throw std::invalid_argument("decode_int64: not a digit");
+                }
+                uint64_t digit = *it - '0';
+                if(magnitude > (limit - digit) / 10){
+                        throw std::out_of_range("decode_int64: " + std::string(begin, end));
+                }
+                magnitude = magnitude * 10 + digit;
+        }
+
+        return negative ? int64_t(0 - magnitude) : int64_t(magnitude);
+}
+
+#ifdef UNIT_TEST
+// Test builds count every trip to the heap, so benches can report it
+namespace{
+        std::atomic<std::size_t> allocations{0};
+}
+
+std::size_t L3::heap_allocations(){
+        return allocations.load(std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size){
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        if(void* p = std::malloc(size ? size : 1)){
+                return p;
+        }
+        throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept{
+        std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept{
+        std::free(p);
+}
 
-        ss << f.rdbuf();
+TEST_CASE("decoding literals straight out of the source buffer"){
+        std::string src{"12 -7 +3 9223372036854775807 -9223372036854775808 9223372036854775808"};
+        const char* b = src.data();
 
-        return ss.str();
+        REQUIRE(decode_int64(b, b + 2) == 12);
+        REQUIRE(decode_int64(b + 3, b + 5) == -7);
+        REQUIRE(decode_int64(b + 6, b + 8) == 3);
+        REQUIRE(decode_int64(b + 9, b + 28) == INT64_MAX);
+        REQUIRE(decode_int64(b + 29, b + 49) == INT64_MIN);
+        REQUIRE_THROWS(decode_int64(b + 50, b + 69));
+        REQUIRE_THROWS(decode_int64(b + 2, b + 3));
 }
+#endif
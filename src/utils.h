@@ -2,10 +2,44 @@
 
 #include <memory>
 #include <string>
+#include <cstddef>
+#include <stdint.h>
 
 namespace L3{
+        // AST nodes are owned by their function's Arena (see arena.h), so
+        // everything else just points at them.
         template <typename T>
-        using L3_ptr = std::shared_ptr<T>;
+        using L3_ptr = T*;
 
         std::string slurp_file(std::string filename);
+
+        /*
+          Read-only mmap of a whole source file. The parser runs directly on
+          the mapped bytes, so nothing gets copied until an AST node needs to
+          own a name.
+        */
+        class Mapped_File{
+        public:
+                explicit Mapped_File(const std::string& filename);
+                ~Mapped_File();
+
+                Mapped_File(const Mapped_File&) = delete;
+                Mapped_File& operator=(const Mapped_File&) = delete;
+
+                const char* begin() const { return data; }
+                const char* end() const { return data + len; }
+                std::size_t size() const { return len; }
+
+        private:
+                const char* data;
+                std::size_t len;
+        };
+
+        // stoll without the temporary string. Throws like stoll does.
+        int64_t decode_int64(const char* begin, const char* end);
+
+#ifdef UNIT_TEST
+        // operator new calls so far, for benches
+        std::size_t heap_allocations();
+#endif
 }
@@ -0,0 +1,65 @@
+#include <working_copy.h>
+#include <cassert>
+
+#ifdef UNIT_TEST
+#include <catch.hpp>
+#include <ll_parser.h>
+#endif
+
+using namespace L3;
+
+Working_Copy::Working_Copy(const Function& fun) :
+        body(fun.name)
+{
+        body.params = fun.params;
+        body.instructions.assign(fun.instructions.begin(), fun.instructions.end());
+}
+
+const CFG& Working_Copy::cfg(){
+        if(!cached_cfg){
+                cached_cfg.reset(new CFG{CFG::build(body)});
+        }
+        assert(cached_cfg->instruction_count() == body.instructions.size()
+               && "body changed without a body_changed()");
+        return *cached_cfg;
+}
+
+void Working_Copy::body_changed(){
+        cached_cfg.reset();
+}
+
+#ifdef UNIT_TEST
+std::string L3::dumped(const std::string& src, const std::function<void(Working_Copy&)>& pass){
+        Program p = ll_parse(src.data(), src.data() + src.size(), "test");
+        Dump d;
+        for(auto& fun : p.functions){
+                Working_Copy work{*fun};
+                if(pass){
+                        pass(work);
+                }
+                work.body.accept(d);
+                d.result << (fun == p.functions.back() ? "\n" : "\n\n");
+        }
+        return d.result.str();
+}
+
+TEST_CASE("a working copy starts out as the function"){
+        std::string src = "define :f(a, p){\n"
+                          "  x <- a + 1\n"
+                          "  store p <- x\n"
+                          "  return x\n"
+                          "}\n"
+                          "\n"
+                          "define :g(){\n"
+                          "  return\n"
+                          "}\n";
+        Program p = ll_parse(src.data(), src.data() + src.size(), "test");
+        Dump d;
+        p.accept(d);
+        REQUIRE(dumped(src) == d.result.str());
+
+        Working_Copy work{*p.functions[0]};
+        work.body.instructions.pop_back();
+        REQUIRE(p.functions[0]->instructions.size() == 3);
+}
+#endif
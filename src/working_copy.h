@@ -0,0 +1,50 @@
+#pragma once
+
+#include <L3.h>
+#include <cfg.h>
+
+#include <memory>
+#ifdef UNIT_TEST
+#include <functional>
+#include <string>
+#endif
+
+namespace L3{
+
+/*
+  What the L3 passes rewrite, so the parsed Function never changes and can
+  be compiled again (or by another thread) and come out the same.
+
+  Copying is cheap: nodes never change once they're made, a pass swaps out
+  whole instructions instead, so the copy starts out pointing at the very
+  same nodes as the original. Whatever a pass makes goes in the copy's own
+  arena and is gone with it.
+*/
+        class Working_Copy{
+        public:
+                explicit Working_Copy(const Function& fun);
+
+                Working_Copy(const Working_Copy&) = delete;
+                Working_Copy& operator=(const Working_Copy&) = delete;
+
+                // Same name, params and instructions as the original
+                Function body;
+
+                // Basic blocks of body, built on first ask and kept until
+                // body_changed(). Every pass that edits body has to call
+                // that before anybody asks again.
+                const CFG& cfg();
+                void body_changed();
+
+        private:
+                std::unique_ptr<CFG> cached_cfg;
+        };
+
+#ifdef UNIT_TEST
+        // src parsed, pass run on a working copy of each function, and the
+        // copies dumped the way Dump prints a whole program. Without a
+        // pass that's just the dump, to compare against.
+        std::string dumped(const std::string& src,
+                           const std::function<void(Working_Copy&)>& pass = nullptr);
+#endif
+}